@@ -0,0 +1,337 @@
+#include "BlockCompression.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// intrinsics for glm in this file only, see MeshKernels.cpp.
+#define GLM_FORCE_INTRINSICS
+#include <glm/detail/setup.hpp>
+#include <glm/simd/geometric.h>
+
+namespace
+{
+	const int BLOCK_TEXELS = 16;
+	const int PRINCIPAL_AXIS_ITERATIONS = 8;
+
+	// BC7 mode 6 interpolation weights, out of 64.
+	const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// one texel as 4 floats, rgba. Everything the encoders do goes through these, so there's one copy of the
+	// encoders for both paths.
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+	typedef glm_vec4 Texel;
+
+	inline Texel loadTexel(const unsigned char* p, bool alpha)
+	{
+		int32_t packed;
+		memcpy(&packed, p, sizeof(packed));
+		if (!alpha)
+			packed &= 0x00FFFFFF;
+		const __m128i zero = _mm_setzero_si128();
+		__m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+		return _mm_cvtepi32_ps(wide);
+	}
+	inline Texel makeTexel(float r, float g, float b, float a) { return _mm_setr_ps(r, g, b, a); }
+	inline Texel splat(float f) { return _mm_set1_ps(f); }
+	inline Texel add(Texel a, Texel b) { return glm_vec4_add(a, b); }
+	inline Texel sub(Texel a, Texel b) { return glm_vec4_sub(a, b); }
+	inline Texel mul(Texel a, Texel b) { return glm_vec4_mul(a, b); }
+	inline Texel minTexel(Texel a, Texel b) { return _mm_min_ps(a, b); }
+	inline Texel maxTexel(Texel a, Texel b) { return _mm_max_ps(a, b); }
+	inline float dot(Texel a, Texel b) { return _mm_cvtss_f32(glm_vec4_dot(a, b)); }
+	inline void storeTexel(float* out, Texel t) { _mm_storeu_ps(out, t); }
+#else
+	struct Texel
+	{
+		float c[4];
+	};
+
+	inline Texel loadTexel(const unsigned char* p, bool alpha) { return { { float(p[0]), float(p[1]), float(p[2]), alpha ? float(p[3]) : 0.0f } }; }
+	inline Texel makeTexel(float r, float g, float b, float a) { return { { r, g, b, a } }; }
+	inline Texel splat(float f) { return { { f, f, f, f } }; }
+	inline Texel add(Texel a, Texel b) { return { { a.c[0] + b.c[0], a.c[1] + b.c[1], a.c[2] + b.c[2], a.c[3] + b.c[3] } }; }
+	inline Texel sub(Texel a, Texel b) { return { { a.c[0] - b.c[0], a.c[1] - b.c[1], a.c[2] - b.c[2], a.c[3] - b.c[3] } }; }
+	inline Texel mul(Texel a, Texel b) { return { { a.c[0] * b.c[0], a.c[1] * b.c[1], a.c[2] * b.c[2], a.c[3] * b.c[3] } }; }
+	inline Texel minTexel(Texel a, Texel b)
+	{
+		return { { std::min(a.c[0], b.c[0]), std::min(a.c[1], b.c[1]), std::min(a.c[2], b.c[2]), std::min(a.c[3], b.c[3]) } };
+	}
+	inline Texel maxTexel(Texel a, Texel b)
+	{
+		return { { std::max(a.c[0], b.c[0]), std::max(a.c[1], b.c[1]), std::max(a.c[2], b.c[2]), std::max(a.c[3], b.c[3]) } };
+	}
+	inline float dot(Texel a, Texel b) { return a.c[0] * b.c[0] + a.c[1] * b.c[1] + a.c[2] * b.c[2] + a.c[3] * b.c[3]; }
+	inline void storeTexel(float* out, Texel t) { memcpy(out, t.c, sizeof(t.c)); }
+#endif
+
+	// the two ends of the line the block's texels lie closest to, pulled in by insetFraction of its length (the
+	// ends rarely land on a texel, and pulling them in spreads the error more evenly).
+	void fitEndpoints(const Texel* texels, float insetFraction, float* start, float* end)
+	{
+		Texel sum = splat(0.0f), low = texels[0], high = texels[0];
+		for (int i = 0; i < BLOCK_TEXELS; ++i)
+		{
+			sum = add(sum, texels[i]);
+			low = minTexel(low, texels[i]);
+			high = maxTexel(high, texels[i]);
+		}
+		Texel mean = mul(sum, splat(1.0f / BLOCK_TEXELS));
+
+		// covariance, a row at a time. It's symmetric, so multiplying by it is just a sum of rows.
+		Texel rows[4] = { splat(0.0f), splat(0.0f), splat(0.0f), splat(0.0f) };
+		for (int i = 0; i < BLOCK_TEXELS; ++i)
+		{
+			Texel d = sub(texels[i], mean);
+			float lanes[4];
+			storeTexel(lanes, d);
+			for (int c = 0; c < 4; ++c)
+				rows[c] = add(rows[c], mul(d, splat(lanes[c])));
+		}
+
+		// power iteration, starting from the bounding box diagonal.
+		Texel axis = sub(high, low);
+		for (int iteration = 0; iteration < PRINCIPAL_AXIS_ITERATIONS; ++iteration)
+		{
+			float lanes[4];
+			storeTexel(lanes, axis);
+			Texel next = splat(0.0f);
+			for (int c = 0; c < 4; ++c)
+				next = add(next, mul(rows[c], splat(lanes[c])));
+			float length = std::sqrt(dot(next, next));
+			if (length < 1e-6f)
+				break;
+			axis = mul(next, splat(1.0f / length));
+		}
+		float axisLength = std::sqrt(dot(axis, axis));
+		axis = axisLength > 1e-6f ? mul(axis, splat(1.0f / axisLength)) : splat(0.0f);
+
+		float lowest = 0.0f, highest = 0.0f;
+		for (int i = 0; i < BLOCK_TEXELS; ++i)
+		{
+			float t = dot(sub(texels[i], mean), axis);
+			lowest = std::min(lowest, t);
+			highest = std::max(highest, t);
+		}
+		float inset = (highest - lowest) * insetFraction;
+		lowest += inset;
+		highest -= inset;
+
+		storeTexel(start, add(mean, mul(axis, splat(lowest))));
+		storeTexel(end, add(mean, mul(axis, splat(highest))));
+	}
+
+	// index of the palette entry nearest texel.
+	int nearest(Texel texel, const Texel* palette, int paletteSize)
+	{
+		int best = 0;
+		float bestDistance = 0.0f;
+		for (int p = 0; p < paletteSize; ++p)
+		{
+			Texel d = sub(texel, palette[p]);
+			float distance = dot(d, d);
+			if (p == 0 || distance < bestDistance)
+			{
+				best = p;
+				bestDistance = distance;
+			}
+		}
+		return best;
+	}
+
+	int quantize(float value, int maximum)
+	{
+		return std::min(maximum, std::max(0, static_cast<int>(value * maximum / 255.0f + 0.5f)));
+	}
+
+	uint16_t packRgb565(const float* color)
+	{
+		return static_cast<uint16_t>(quantize(color[0], 31) << 11 | quantize(color[1], 63) << 5 | quantize(color[2], 31));
+	}
+
+	// what the hardware expands a 565 colour back to.
+	Texel unpackRgb565(uint16_t color)
+	{
+		int r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+		return makeTexel(float(r << 3 | r >> 2), float(g << 2 | g >> 4), float(b << 3 | b >> 2), 0.0f);
+	}
+
+	void encodeBC1(unsigned char* block, const unsigned char* rgba)
+	{
+		Texel texels[BLOCK_TEXELS];
+		for (int i = 0; i < BLOCK_TEXELS; ++i)
+			texels[i] = loadTexel(rgba + 4 * i, false);
+
+		float start[4], end[4];
+		fitEndpoints(texels, 1.0f / 16.0f, start, end);
+		uint16_t color0 = packRgb565(end), color1 = packRgb565(start);
+
+		// color0 > color1 picks the 4 colour mode. Equal ends can't, but then every index is 0 and the mode doesn't matter.
+		if (color0 < color1)
+			std::swap(color0, color1);
+
+		uint32_t indices = 0;
+		if (color0 != color1)
+		{
+			Texel palette[4];
+			palette[0] = unpackRgb565(color0);
+			palette[1] = unpackRgb565(color1);
+			palette[2] = mul(add(add(palette[0], palette[0]), palette[1]), splat(1.0f / 3.0f));
+			palette[3] = mul(add(add(palette[1], palette[1]), palette[0]), splat(1.0f / 3.0f));
+			for (int i = 0; i < BLOCK_TEXELS; ++i)
+				indices |= uint32_t(nearest(texels[i], palette, 4)) << (2 * i);
+		}
+
+		memcpy(block, &color0, 2);
+		memcpy(block + 2, &color1, 2);
+		memcpy(block + 4, &indices, 4);
+	}
+
+	// LSB first, the way BC7 blocks are laid out.
+	struct BitWriter
+	{
+		unsigned char* out;
+		int position = 0;
+
+		void write(uint32_t value, int bits)
+		{
+			for (int i = 0; i < bits; ++i, ++position)
+			{
+				if (value >> i & 1)
+					out[position / 8] |= static_cast<unsigned char>(1 << (position % 8));
+			}
+		}
+	};
+
+	// mode 6 endpoints are 7 bits a channel plus one p bit shared by the endpoint's channels. Picks the p bit that
+	// lands closer.
+	void quantizeBC7Endpoint(const float* color, int* channels, int& pBit)
+	{
+		float bestError = 0.0f;
+		for (int p = 0; p < 2; ++p)
+		{
+			int candidate[4];
+			float error = 0.0f;
+			for (int c = 0; c < 4; ++c)
+			{
+				candidate[c] = std::min(127, std::max(0, static_cast<int>((color[c] - p) * 0.5f + 0.5f)));
+				float d = float(candidate[c] * 2 + p) - color[c];
+				error += d * d;
+			}
+			if (p == 0 || error < bestError)
+			{
+				bestError = error;
+				pBit = p;
+				std::copy(candidate, candidate + 4, channels);
+			}
+		}
+	}
+
+	void encodeBC7(unsigned char* block, const unsigned char* rgba)
+	{
+		Texel texels[BLOCK_TEXELS];
+		for (int i = 0; i < BLOCK_TEXELS; ++i)
+			texels[i] = loadTexel(rgba + 4 * i, true);
+
+		float start[4], end[4];
+		fitEndpoints(texels, 1.0f / 32.0f, start, end);
+
+		int endpoints[2][4], pBits[2];
+		quantizeBC7Endpoint(start, endpoints[0], pBits[0]);
+		quantizeBC7Endpoint(end, endpoints[1], pBits[1]);
+
+		int expanded[2][4];
+		for (int e = 0; e < 2; ++e)
+		{
+			for (int c = 0; c < 4; ++c)
+				expanded[e][c] = endpoints[e][c] * 2 + pBits[e];
+		}
+
+		Texel palette[16];
+		for (int w = 0; w < 16; ++w)
+		{
+			int weight = BC7_WEIGHTS[w];
+			int c[4];
+			for (int k = 0; k < 4; ++k)
+				c[k] = (expanded[0][k] * (64 - weight) + expanded[1][k] * weight + 32) >> 6;
+			palette[w] = makeTexel(float(c[0]), float(c[1]), float(c[2]), float(c[3]));
+		}
+
+		// the weights are close to even steps, so projecting onto the line gets within one step of the nearest entry.
+		// Only it and its neighbours need checking, instead of all 16.
+		Texel line = sub(palette[15], palette[0]);
+		float lengthSquared = dot(line, line);
+		float toStep = lengthSquared > 0.0f ? 15.0f / lengthSquared : 0.0f;
+		int indices[BLOCK_TEXELS];
+		for (int i = 0; i < BLOCK_TEXELS; ++i)
+		{
+			int guess = static_cast<int>(dot(sub(texels[i], palette[0]), line) * toStep + 0.5f);
+			int first = std::min(14, std::max(0, guess - 1));
+			indices[i] = first + nearest(texels[i], palette + first, std::min(3, 16 - first));
+		}
+
+		// the first texel's index only has 3 bits, its top bit is taken to be 0. Flipping the ends makes it so.
+		if (indices[0] & 8)
+		{
+			std::swap(endpoints[0], endpoints[1]);
+			std::swap(pBits[0], pBits[1]);
+			for (int& index : indices)
+				index = 15 - index;
+		}
+
+		memset(block, 0, 16);
+		BitWriter bits = { block };
+		bits.write(1 << 6, 7); // mode 6
+		for (int c = 0; c < 4; ++c)
+		{
+			bits.write(endpoints[0][c], 7);
+			bits.write(endpoints[1][c], 7);
+		}
+		bits.write(pBits[0], 1);
+		bits.write(pBits[1], 1);
+		bits.write(indices[0], 3);
+		for (int i = 1; i < BLOCK_TEXELS; ++i)
+			bits.write(indices[i], 4);
+	}
+}
+
+size_t blockSize(BlockFormat format)
+{
+	return format == BLOCK_FORMAT_BC1 ? 8 : 16;
+}
+
+size_t encodedLevelSize(uint32_t width, uint32_t height, BlockFormat format)
+{
+	return size_t((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+}
+
+void encodeBlock(unsigned char* block, const unsigned char* texels, BlockFormat format)
+{
+	if (format == BLOCK_FORMAT_BC1)
+		encodeBC1(block, texels);
+	else
+		encodeBC7(block, texels);
+}
+
+void encodeBlockRows(unsigned char* out, const unsigned char* image, uint32_t width, uint32_t height, BlockFormat format,
+	uint32_t firstRow, uint32_t lastRow)
+{
+	uint32_t blocksWide = (width + 3) / 4;
+	size_t size = blockSize(format);
+	unsigned char texels[BLOCK_TEXELS * 4];
+	for (uint32_t by = firstRow; by < lastRow; ++by)
+	{
+		for (uint32_t bx = 0; bx < blocksWide; ++bx)
+		{
+			for (uint32_t y = 0; y < 4; ++y)
+			{
+				uint32_t row = std::min(by * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; ++x)
+				{
+					uint32_t column = std::min(bx * 4 + x, width - 1);
+					memcpy(texels + 4 * (y * 4 + x), image + (size_t(row) * width + column) * 4, 4);
+				}
+			}
+			encodeBlock(out + (size_t(by) * blocksWide + bx) * size, texels, format);
+		}
+	}
+}
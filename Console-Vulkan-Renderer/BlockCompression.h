@@ -0,0 +1,33 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+
+// BC1 / BC7 encoders for the texture cooker. Both fit a line through the 4x4 block (principal axis of its colours)
+// and snap every texel to the nearest point the format can put on it. Fast rather than best quality: no endpoint
+// refinement, and BC7 only uses mode 6 (one subset, 16 steps, RGBA). Vectorized on glm's SSE paths where there are
+// any, same as MeshKernels.
+//
+// Input is RGBA8 the way stb_image gives it, and the bytes are encoded as they are, so sRGB data stays sRGB.
+
+enum BlockFormat
+{
+	BLOCK_FORMAT_BC1, // RGB, 8 bytes a block. Alpha is dropped.
+	BLOCK_FORMAT_BC7 // RGBA, 16 bytes a block
+};
+
+size_t blockSize(BlockFormat format);
+
+// texels is a 4x4 block, 16 RGBA8 texels row by row. Writes blockSize(format) bytes.
+void encodeBlock(unsigned char* block, const unsigned char* texels, BlockFormat format);
+
+// encodes block rows [firstRow, lastRow) of a width x height RGBA8 image into out, which holds the whole level
+// (blocks row by row). Blocks hanging off the right / bottom edge repeat the last column / row.
+void encodeBlockRows(unsigned char* out, const unsigned char* image, uint32_t width, uint32_t height, BlockFormat format,
+	uint32_t firstRow, uint32_t lastRow);
+
+// bytes a width x height level takes.
+size_t encodedLevelSize(uint32_t width, uint32_t height, BlockFormat format);
+
+#endif // !BLOCK_COMPRESSION_H
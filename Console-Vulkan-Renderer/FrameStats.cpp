@@ -0,0 +1,163 @@
+#include "FrameStats.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <numeric>
+#include <stdexcept>
+
+const char* FRAME_PHASE_NAMES[FRAME_PHASE_COUNT] =
+{
+	"wait",
+	"acquire",
+	"stream",
+	"update",
+	"submit",
+	"present",
+	"frame"
+};
+
+// nearest rank percentile on an already sorted list.
+static double percentile(const std::vector<double>& sorted, double pct)
+{
+	size_t rank = static_cast<size_t>(std::ceil(pct / 100.0 * sorted.size()));
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+StatSummary StatSeries::summarize() const
+{
+	StatSummary summary;
+	summary.count = mSamples.size();
+	if (mSamples.empty())
+		return summary;
+
+	std::vector<double> sorted(mSamples);
+	std::sort(sorted.begin(), sorted.end());
+
+	summary.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+	summary.p50 = percentile(sorted, 50.0);
+	summary.p95 = percentile(sorted, 95.0);
+	summary.p99 = percentile(sorted, 99.0);
+	summary.max = sorted.back();
+
+	return summary;
+}
+
+double RollingSeries::mean() const
+{
+	if (mCount == 0)
+		return 0.0;
+	return std::accumulate(mSamples.begin(), mSamples.begin() + mCount, 0.0) / mCount;
+}
+
+double RollingSeries::max() const
+{
+	if (mCount == 0)
+		return 0.0;
+	return *std::max_element(mSamples.begin(), mSamples.begin() + mCount);
+}
+
+void printStatsTable(std::ostream& out, const std::vector<const StatSeries*>& series)
+{
+	out << std::left << std::setw(16) << "phase (ms)" << std::right
+		<< std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p95"
+		<< std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+
+	out << std::fixed << std::setprecision(3);
+	for (const StatSeries* s : series)
+	{
+		if (s->size() == 0)
+			continue;
+
+		StatSummary sum = s->summarize();
+		out << std::left << std::setw(16) << s->name() << std::right
+			<< std::setw(10) << sum.mean << std::setw(10) << sum.p50 << std::setw(10) << sum.p95
+			<< std::setw(10) << sum.p99 << std::setw(10) << sum.max << std::endl;
+	}
+	out << std::defaultfloat;
+}
+
+void writeStatsJson(std::ostream& out, const std::vector<const StatSeries*>& series, const std::string& indent)
+{
+	bool first = true;
+	for (const StatSeries* s : series)
+	{
+		if (s->size() == 0)
+			continue;
+
+		StatSummary sum = s->summarize();
+		out << (first ? "" : ",\n") << indent << "\"" << s->name() << "\": { \"count\": " << sum.count
+			<< ", \"mean\": " << sum.mean << ", \"p50\": " << sum.p50 << ", \"p95\": " << sum.p95
+			<< ", \"p99\": " << sum.p99 << ", \"max\": " << sum.max << " }";
+		first = false;
+	}
+	out << "\n";
+}
+
+FrameStats::FrameStats()
+{
+	for (int i = 0; i < FRAME_PHASE_COUNT; ++i)
+		mPhases[i] = StatSeries(FRAME_PHASE_NAMES[i]);
+}
+
+void FrameStats::start(size_t expectedFrames)
+{
+	for (StatSeries& phase : mPhases)
+	{
+		phase.clear();
+		phase.reserve(expectedFrames);
+	}
+
+	mRecording = true;
+}
+
+void FrameStats::finish(uint32_t frames, double timestep, double wallSeconds)
+{
+	mRecording = false;
+	mFrames = frames;
+	mTimestep = timestep;
+	mWallSeconds = wallSeconds;
+}
+
+std::vector<const StatSeries*> FrameStats::series() const
+{
+	std::vector<const StatSeries*> result;
+	for (const StatSeries& phase : mPhases)
+		result.push_back(&phase);
+	return result;
+}
+
+void FrameStats::printReport(std::ostream& out, const std::vector<const StatSeries*>& gpu) const
+{
+	out << "Benchmark: " << mFrames << " frames, fixed timestep " << mTimestep * 1000.0 << " ms, "
+		<< mWallSeconds << " s wall, " << (mWallSeconds > 0.0 ? mFrames / mWallSeconds : 0.0) << " fps" << std::endl;
+
+	std::vector<const StatSeries*> all = series();
+	all.insert(all.end(), gpu.begin(), gpu.end());
+	printStatsTable(out, all);
+}
+
+void FrameStats::writeJson(const std::string& path, const std::vector<const StatSeries*>& gpu) const
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+		throw std::runtime_error("Failed to open the benchmark results file for writing.");
+
+	file << "{\n";
+	file << "  \"frames\": " << mFrames << ",\n";
+	file << "  \"timestepMs\": " << mTimestep * 1000.0 << ",\n";
+	file << "  \"wallSeconds\": " << mWallSeconds << ",\n";
+	file << "  \"fps\": " << (mWallSeconds > 0.0 ? mFrames / mWallSeconds : 0.0) << ",\n";
+	file << "  \"cpu\": {\n";
+	writeStatsJson(file, series(), "    ");
+	file << "  }";
+
+	if (!gpu.empty())
+	{
+		file << ",\n  \"gpu\": {\n";
+		writeStatsJson(file, gpu, "    ");
+		file << "  }";
+	}
+
+	file << "\n}\n";
+}
@@ -0,0 +1,129 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <array>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// the CPU side stages of a frame we time in benchmark mode.
+enum FramePhase
+{
+	FRAME_PHASE_WAIT = 0, // waiting on the in flight fences
+	FRAME_PHASE_ACQUIRE, // vkAcquireNextImageKHR
+	FRAME_PHASE_STREAM, // uploads and streaming: pending load time uploads, mesh chunks, virtual texture feedback and pages
+	FRAME_PHASE_UPDATE, // updateUniformBuffer
+	FRAME_PHASE_SUBMIT, // vkQueueSubmit
+	FRAME_PHASE_PRESENT, // vkQueuePresentKHR
+	FRAME_PHASE_TOTAL, // the whole drawFrame call
+	FRAME_PHASE_COUNT
+};
+
+extern const char* FRAME_PHASE_NAMES[FRAME_PHASE_COUNT];
+
+using StatClock = std::chrono::high_resolution_clock;
+
+// milliseconds between two clock readings.
+inline double elapsedMs(StatClock::time_point start, StatClock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// summary numbers for one series of samples, all in milliseconds.
+struct StatSummary
+{
+	size_t count = 0;
+	double mean = 0.0;
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+	double max = 0.0;
+};
+
+// a named list of timing samples (ms). Just a vector, percentiles get worked out when asked for.
+class StatSeries
+{
+public:
+	explicit StatSeries(const std::string& name = "") : mName(name) {}
+
+	void reserve(size_t count) { mSamples.reserve(count); }
+	void clear() { mSamples.clear(); }
+	void add(double ms) { mSamples.push_back(ms); }
+
+	const std::string& name() const { return mName; }
+	size_t size() const { return mSamples.size(); }
+	StatSummary summarize() const;
+
+private:
+	std::string mName;
+	std::vector<double> mSamples;
+};
+
+// fixed size window over the last few samples, for live numbers (window title etc).
+class RollingSeries
+{
+public:
+	static const size_t CAPACITY = 120; // ~2 seconds at 60fps
+
+	void add(double ms)
+	{
+		mSamples[mNext] = ms;
+		mNext = (mNext + 1) % CAPACITY;
+		if (mCount < CAPACITY)
+			++mCount;
+	}
+
+	size_t size() const { return mCount; }
+	double mean() const;
+	double max() const;
+
+private:
+	std::array<double, CAPACITY> mSamples = {};
+	size_t mNext = 0;
+	size_t mCount = 0;
+};
+
+// print / write a bunch of series as a table or as a JSON object ("name": { "mean": ... }, ...)
+void printStatsTable(std::ostream& out, const std::vector<const StatSeries*>& series);
+void writeStatsJson(std::ostream& out, const std::vector<const StatSeries*>& series, const std::string& indent);
+
+// per phase CPU frame times for a benchmark run.
+class FrameStats
+{
+public:
+	FrameStats();
+
+	void start(size_t expectedFrames); // clears everything and starts recording
+	bool isRecording() const { return mRecording; }
+
+	void record(FramePhase phase, double ms)
+	{
+		if (phase == FRAME_PHASE_TOTAL)
+			mRollingFrame.add(ms);
+		if (mRecording)
+			mPhases[phase].add(ms);
+	}
+	void record(FramePhase phase, StatClock::time_point start, StatClock::time_point end) { record(phase, elapsedMs(start, end)); }
+
+	// stop recording and remember what the run looked like, for the report.
+	void finish(uint32_t frames, double timestep, double wallSeconds);
+
+	std::vector<const StatSeries*> series() const;
+	const RollingSeries& rollingFrame() const { return mRollingFrame; } // recent whole frame times, always recorded
+
+	// gpu series (from the GpuProfiler) get printed under the CPU ones, and go into their own "gpu" block in the JSON.
+	void printReport(std::ostream& out, const std::vector<const StatSeries*>& gpu = {}) const;
+	void writeJson(const std::string& path, const std::vector<const StatSeries*>& gpu = {}) const;
+
+private:
+	std::array<StatSeries, FRAME_PHASE_COUNT> mPhases;
+	RollingSeries mRollingFrame;
+	bool mRecording = false;
+
+	uint32_t mFrames = 0;
+	double mTimestep = 0.0;
+	double mWallSeconds = 0.0;
+};
+
+#endif // !FRAME_STATS_H
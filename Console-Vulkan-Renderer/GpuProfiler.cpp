@@ -0,0 +1,148 @@
+#include "GpuProfiler.h"
+#include <stdexcept>
+#include <string>
+
+const char* GPU_ZONE_NAMES[GPU_ZONE_COUNT] =
+{
+	"gpu frame",
+	"gpu main pass",
+	"gpu mesh draw",
+	"gpu readback"
+};
+
+GpuProfiler::GpuProfiler()
+{
+	for (int i = 0; i < GPU_ZONE_COUNT; ++i)
+		mHistory[i] = StatSeries(GPU_ZONE_NAMES[i]);
+}
+
+void GpuProfiler::create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t slotCount)
+{
+	destroy();
+
+	mDevice = device;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	uint32_t queueFamilyCt = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCt, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCt);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCt, queueFamilies.data());
+
+	// no valid bits means this queue can't do timestamps at all. Just run without GPU numbers then.
+	uint32_t validBits = queueFamilies[queueFamilyIndex].timestampValidBits;
+	if (validBits == 0 || properties.limits.timestampPeriod == 0.0f)
+		return;
+
+	mTimestampPeriod = properties.limits.timestampPeriod;
+	mTimestampMask = validBits >= 64 ? ~0ULL : ((1ULL << validBits) - 1);
+
+	VkQueryPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	poolInfo.queryCount = slotCount * QUERIES_PER_SLOT;
+
+	if (vkCreateQueryPool(mDevice, &poolInfo, nullptr, &mQueryPool) != VK_SUCCESS)
+		throw std::runtime_error("failed to create timestamp query pool!");
+
+	mSlotCount = slotCount;
+	mSubmitted.assign(slotCount, false);
+}
+
+void GpuProfiler::destroy()
+{
+	if (mQueryPool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(mDevice, mQueryPool, nullptr);
+
+	mQueryPool = VK_NULL_HANDLE;
+	mSlotCount = 0;
+	mSubmitted.clear();
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer cmd, uint32_t slot)
+{
+	if (!isSupported())
+		return;
+
+	// queries have to be reset before they get written again. Has to happen outside a render pass.
+	vkCmdResetQueryPool(cmd, mQueryPool, slot * QUERIES_PER_SLOT, QUERIES_PER_SLOT);
+	beginZone(cmd, slot, GPU_ZONE_FRAME);
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer cmd, uint32_t slot)
+{
+	endZone(cmd, slot, GPU_ZONE_FRAME);
+}
+
+void GpuProfiler::beginZone(VkCommandBuffer cmd, uint32_t slot, GpuZone zone)
+{
+	if (isSupported())
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, mQueryPool, queryIndex(slot, zone, false));
+}
+
+void GpuProfiler::endZone(VkCommandBuffer cmd, uint32_t slot, GpuZone zone)
+{
+	if (isSupported())
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, mQueryPool, queryIndex(slot, zone, true));
+}
+
+void GpuProfiler::collect(uint32_t slot)
+{
+	if (!isSupported() || slot >= mSlotCount || !mSubmitted[slot])
+		return;
+
+	// value + availability for every query. No WAIT bit, the fence already told us the GPU is done with these.
+	std::array<uint64_t, QUERIES_PER_SLOT * 2> results{};
+	VkResult result = vkGetQueryPoolResults(mDevice, mQueryPool, slot * QUERIES_PER_SLOT, QUERIES_PER_SLOT,
+		sizeof(results), results.data(), sizeof(uint64_t) * 2, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	if (result != VK_SUCCESS && result != VK_NOT_READY)
+		return;
+
+	mSubmitted[slot] = false;
+
+	for (int zone = 0; zone < GPU_ZONE_COUNT; ++zone)
+	{
+		uint32_t begin = (zone * 2) * 2, end = (zone * 2 + 1) * 2;
+
+		// zones that weren't recorded this frame (readback when it's off) never become available.
+		if (results[begin + 1] == 0 || results[end + 1] == 0)
+			continue;
+
+		uint64_t ticks = (results[end] - results[begin]) & mTimestampMask;
+		double ms = ticks * mTimestampPeriod / 1000000.0;
+
+		mRolling[zone].add(ms);
+		if (mRecording)
+			mHistory[zone].add(ms);
+	}
+}
+
+void GpuProfiler::collectAll()
+{
+	for (uint32_t slot = 0; slot < mSlotCount; ++slot)
+		collect(slot);
+}
+
+void GpuProfiler::startRecording(size_t expectedFrames)
+{
+	for (StatSeries& zone : mHistory)
+	{
+		zone.clear();
+		zone.reserve(expectedFrames);
+	}
+
+	mRecording = true;
+}
+
+std::vector<const StatSeries*> GpuProfiler::series() const
+{
+	std::vector<const StatSeries*> result;
+	if (!isSupported())
+		return result;
+
+	for (const StatSeries& zone : mHistory)
+		result.push_back(&zone);
+	return result;
+}
@@ -0,0 +1,69 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <vulkan/vulkan.h>
+#include <array>
+#include <vector>
+#include "FrameStats.h"
+
+// the spans of a command buffer we put timestamps around.
+enum GpuZone
+{
+	GPU_ZONE_FRAME = 0, // the whole command buffer
+	GPU_ZONE_MAIN_PASS, // the main render pass
+	GPU_ZONE_MESH_DRAW, // the mesh draw group inside the main pass
+	GPU_ZONE_READBACK, // headless readback copy
+	GPU_ZONE_COUNT
+};
+
+extern const char* GPU_ZONE_NAMES[GPU_ZONE_COUNT];
+
+// Timestamp query profiler. Every command buffer (one per swap chain / offscreen image) gets its own "slot" of
+// queries in one VkQueryPool. Results for a slot are only read once the fence for that image has been waited on,
+// so by then the GPU is done with them and reading never stalls.
+class GpuProfiler
+{
+public:
+	GpuProfiler();
+
+	// (re)create the query pool with one slot per command buffer. Stats are kept across calls.
+	void create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamilyIndex, uint32_t slotCount);
+	void destroy();
+
+	bool isSupported() const { return mQueryPool != VK_NULL_HANDLE; }
+
+	// recording, all no-ops when timestamps aren't supported.
+	void beginFrame(VkCommandBuffer cmd, uint32_t slot); // resets the slot's queries and opens GPU_ZONE_FRAME
+	void endFrame(VkCommandBuffer cmd, uint32_t slot);
+	void beginZone(VkCommandBuffer cmd, uint32_t slot, GpuZone zone);
+	void endZone(VkCommandBuffer cmd, uint32_t slot, GpuZone zone);
+
+	// call after the fence guarding this slot's last submit has been waited on, and before submitting it again.
+	void collect(uint32_t slot);
+	void collectAll(); // grab whatever is left once the device is idle (end of a run)
+	void markSubmitted(uint32_t slot) { if (slot < mSubmitted.size()) mSubmitted[slot] = true; }
+
+	// full history in benchmark mode, rolling window all the time.
+	void startRecording(size_t expectedFrames);
+	std::vector<const StatSeries*> series() const;
+	const RollingSeries& rolling(GpuZone zone) const { return mRolling[zone]; }
+
+private:
+	uint32_t queryIndex(uint32_t slot, GpuZone zone, bool end) const { return slot * QUERIES_PER_SLOT + zone * 2 + (end ? 1 : 0); }
+
+	static const uint32_t QUERIES_PER_SLOT = GPU_ZONE_COUNT * 2;
+
+	VkDevice mDevice = VK_NULL_HANDLE;
+	VkQueryPool mQueryPool = VK_NULL_HANDLE;
+	uint32_t mSlotCount = 0;
+	std::vector<bool> mSubmitted; // a slot that was never submitted has nothing to read.
+
+	double mTimestampPeriod = 1.0; // nanoseconds per tick
+	uint64_t mTimestampMask = ~0ULL; // only timestampValidBits of each value mean anything
+
+	bool mRecording = false;
+	std::array<StatSeries, GPU_ZONE_COUNT> mHistory;
+	std::array<RollingSeries, GPU_ZONE_COUNT> mRolling;
+};
+
+#endif // !GPU_PROFILER_H
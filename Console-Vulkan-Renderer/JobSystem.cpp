@@ -0,0 +1,218 @@
+#include "JobSystem.h"
+#include "Tracer.h"
+#include <algorithm>
+#include <string>
+
+namespace
+{
+	// which queue jobs scheduled from this thread go on. Workers set it, everyone else means the main thread's.
+	thread_local int tWorkerIndex = -1;
+}
+
+JobSystem::JobSystem(unsigned threadCount)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+
+	for (unsigned i = 0; i <= threadCount; ++i)
+		mQueues.emplace_back(new WorkQueue());
+
+	for (unsigned i = 0; i < threadCount; ++i)
+		mThreads.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+
+	for (std::thread& thread : mThreads)
+		thread.join();
+}
+
+Job* JobSystem::add(const char* name, std::function<void()> function, std::initializer_list<Job*> dependencies, JobAffinity affinity)
+{
+	mJobs.emplace_back();
+	Job* job = &mJobs.back();
+	job->name = name;
+	job->function = std::move(function);
+	job->affinity = affinity;
+
+	bool ready;
+	{
+		std::lock_guard<std::mutex> lock(mGraphMutex);
+		for (Job* dependency : dependencies)
+		{
+			if (!dependency)
+				continue;
+			job->dependencies.push_back(dependency);
+			if (!dependency->finished)
+			{
+				dependency->dependents.push_back(job);
+				++job->unfinishedDependencies;
+			}
+		}
+		ready = job->unfinishedDependencies == 0;
+	}
+
+	if (ready)
+		schedule(job);
+	return job;
+}
+
+void JobSystem::schedule(Job* job)
+{
+	if (job->affinity == JOB_MAIN_THREAD)
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mMainQueue.push_back(job);
+	}
+	else
+	{
+		// counted before it goes in: a thief can pop it the moment it's pushed, and its decrement mustn't come first
+		// or the count wraps. Counting early just means a sleeper can wake and find nothing for a moment.
+		{
+			std::lock_guard<std::mutex> lock(mWakeMutex);
+			++mQueuedCount;
+		}
+		// LIFO on our own queue keeps a job's follow up on the thread whose cache has its data.
+		WorkQueue& queue = *mQueues[tWorkerIndex >= 0 ? tWorkerIndex : mQueues.size() - 1];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(job);
+	}
+	mWake.notify_all();
+}
+
+Job* JobSystem::popOrSteal(unsigned index)
+{
+	{
+		WorkQueue& own = *mQueues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty())
+		{
+			Job* job = own.jobs.back();
+			own.jobs.pop_back();
+			--mQueuedCount;
+			return job;
+		}
+	}
+
+	// steal the oldest job, it's the one furthest from whatever the owner is working on.
+	for (size_t offset = 1; offset < mQueues.size(); ++offset)
+	{
+		WorkQueue& victim = *mQueues[(index + offset) % mQueues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty())
+		{
+			Job* job = victim.jobs.front();
+			victim.jobs.pop_front();
+			--mQueuedCount;
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+void JobSystem::execute(Job* job)
+{
+	for (Job* dependency : job->dependencies)
+	{
+		if (dependency->error)
+		{
+			job->error = dependency->error;
+			break;
+		}
+	}
+
+	if (!job->error)
+	{
+		TRACE_ZONE(job->name);
+		try
+		{
+			job->function();
+		}
+		catch (...)
+		{
+			job->error = std::current_exception();
+		}
+	}
+
+	std::vector<Job*> ready;
+	{
+		std::lock_guard<std::mutex> lock(mGraphMutex);
+		job->finished = true;
+		for (Job* dependent : job->dependents)
+		{
+			if (--dependent->unfinishedDependencies == 0)
+				ready.push_back(dependent);
+		}
+	}
+
+	for (Job* dependent : ready)
+		schedule(dependent);
+
+	// the main thread might be waiting on exactly this one.
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+	}
+	mWake.notify_all();
+}
+
+void JobSystem::workerLoop(unsigned index)
+{
+	tWorkerIndex = static_cast<int>(index);
+	if (Tracer::get().isEnabled())
+		Tracer::get().setThreadName("job worker " + std::to_string(index));
+
+	while (true)
+	{
+		if (Job* job = popOrSteal(index))
+		{
+			execute(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mWakeMutex);
+		mWake.wait(lock, [&]() { return mStop || mQueuedCount > 0; });
+		if (mStop)
+			return;
+	}
+}
+
+void JobSystem::wait(Job* job)
+{
+	unsigned mainIndex = static_cast<unsigned>(mQueues.size() - 1);
+	while (!job->finished)
+	{
+		Job* next = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mWakeMutex);
+			mWake.wait(lock, [&]() { return job->finished || !mMainQueue.empty() || mQueuedCount > 0; });
+			if (job->finished)
+				break;
+			if (!mMainQueue.empty())
+			{
+				next = mMainQueue.front();
+				mMainQueue.pop_front();
+			}
+		}
+
+		// main thread jobs first, they're the ones nobody else can run.
+		if (!next)
+			next = popOrSteal(mainIndex);
+		if (next)
+			execute(next);
+	}
+
+	if (job->error)
+		std::rethrow_exception(job->error);
+}
+
+void JobSystem::waitAll()
+{
+	for (Job& job : mJobs)
+		wait(&job);
+}
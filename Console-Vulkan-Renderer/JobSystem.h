@@ -0,0 +1,92 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// where a job is allowed to run.
+enum JobAffinity
+{
+	JOB_ANY_THREAD, // workers, or the main thread while it's waiting
+	JOB_MAIN_THREAD // only the thread that calls wait(). Anything touching GLFW or the Vulkan objects we build in order.
+};
+
+struct Job
+{
+	const char* name; // trace zone name, has to outlive the tracer like every other zone name
+	std::function<void()> function;
+	JobAffinity affinity;
+	std::vector<Job*> dependencies;
+
+	// guarded by JobSystem::mGraphMutex
+	uint32_t unfinishedDependencies = 0;
+	std::vector<Job*> dependents;
+
+	std::atomic<bool> finished{ false };
+	std::exception_ptr error; // set before finished, from the job or the first failed dependency
+};
+
+// Work stealing job system for building things out of a dependency graph. Every worker has its own deque: it pushes
+// and pops jobs at the back of its own, and when that runs dry it steals from the front of everyone else's. The
+// thread that owns the JobSystem (the main thread) gets a deque too, plus a queue of JOB_MAIN_THREAD jobs only it
+// runs, and it works through both while it waits.
+//
+// A job is queued once every job it depends on has finished. If one of those threw, the job doesn't run and gets
+// that exception instead, and wait() rethrows it on the main thread.
+class JobSystem
+{
+public:
+	// threadCount 0 means one worker per hardware thread, minus the main thread. With one core that's no workers at
+	// all and the main thread runs everything itself.
+	explicit JobSystem(unsigned threadCount = 0);
+	~JobSystem(); // call waitAll() first, jobs still queued get dropped
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// main thread only. Null dependencies are skipped, so optional steps can just pass a null job along.
+	Job* add(const char* name, std::function<void()> function, std::initializer_list<Job*> dependencies = {},
+		JobAffinity affinity = JOB_ANY_THREAD);
+
+	// main thread only. Runs jobs until job has finished, then rethrows its error if it had one.
+	void wait(Job* job);
+	void waitAll();
+
+	unsigned workerCount() const { return static_cast<unsigned>(mThreads.size()); }
+
+private:
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Job*> jobs;
+	};
+
+	void workerLoop(unsigned index);
+	void schedule(Job* job);
+	Job* popOrSteal(unsigned index); // own back first, then everyone else's front
+	void execute(Job* job);
+
+	std::deque<Job> mJobs; // a deque so the Job* we hand out never move
+	std::vector<std::unique_ptr<WorkQueue>> mQueues; // one per worker, the main thread's is last
+	std::vector<std::thread> mThreads;
+
+	std::mutex mGraphMutex; // dependency counts and dependents lists
+
+	// everyone sleeps on mWake. Workers wake for queued jobs, the main thread for those, main thread jobs and finishes.
+	std::mutex mWakeMutex;
+	std::condition_variable mWake;
+	std::deque<Job*> mMainQueue; // guarded by mWakeMutex
+	std::atomic<uint32_t> mQueuedCount{ 0 }; // JOB_ANY_THREAD jobs sitting in mQueues, or about to be
+	bool mStop = false; // guarded by mWakeMutex
+};
+
+#endif // !JOB_SYSTEM_H
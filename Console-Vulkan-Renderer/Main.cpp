@@ -1,10 +1,75 @@
 #include "VkRenderer.h"
+#include <cstring>
 
-int main()
+// usage: Console-Vulkan-Renderer [--headless] [--readback] [--frames N] [--size W H] [--benchmark N] [--benchmark-json PATH] [--trace PATH] [--mesh-stats] [--tinyobj] [--no-mesh-cache] [--compact-vertices] [--split-streams] [--no-lods] [--lod N] [--lod-error PIXELS] [--stream-mesh] [--serial-startup] [--kernel-benchmark TRIANGLES] [--cook-textures bc1|bc7] [--virtual-textures]
+int main(int argc, char** argv)
 {
-	VulkanRenderer renderer;
+	RendererSettings settings;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+			settings.headless = true;
+		else if (strcmp(argv[i], "--readback") == 0)
+			settings.readback = true;
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			settings.frameCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		else if (strcmp(argv[i], "--benchmark") == 0 && i + 1 < argc)
+		{
+			settings.benchmark = true;
+			settings.frameCount = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (strcmp(argv[i], "--benchmark-json") == 0 && i + 1 < argc)
+			settings.benchmarkJsonPath = argv[++i];
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			settings.tracePath = argv[++i];
+		else if (strcmp(argv[i], "--no-lods") == 0)
+			settings.generateLods = false;
+		else if (strcmp(argv[i], "--lod") == 0 && i + 1 < argc)
+			settings.forceLod = std::atoi(argv[++i]);
+		else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+			settings.lodPixelError = static_cast<float>(std::atof(argv[++i]));
+		else if (strcmp(argv[i], "--serial-startup") == 0)
+			settings.serialStartup = true;
+		else if (strcmp(argv[i], "--stream-mesh") == 0)
+			settings.streamMesh = true;
+		else if (strcmp(argv[i], "--split-streams") == 0)
+			settings.splitVertexStreams = true;
+		else if (strcmp(argv[i], "--compact-vertices") == 0)
+			settings.vertexFormat = VERTEX_FORMAT_COMPACT;
+		else if (strcmp(argv[i], "--no-mesh-cache") == 0)
+			settings.meshCache = false;
+		else if (strcmp(argv[i], "--tinyobj") == 0)
+			settings.tinyObjLoader = true;
+		else if (strcmp(argv[i], "--mesh-stats") == 0)
+			settings.meshStats = true;
+		else if (strcmp(argv[i], "--kernel-benchmark") == 0 && i + 1 < argc)
+			settings.kernelBenchmarkTriangles = static_cast<size_t>(std::strtoull(argv[++i], nullptr, 10));
+		else if (strcmp(argv[i], "--cook-textures") == 0 && i + 1 < argc)
+		{
+			settings.cookTextures = strcmp(argv[++i], "bc1") == 0 || strcmp(argv[i], "bc7") == 0;
+			settings.cookFormat = strcmp(argv[i], "bc1") == 0 ? BLOCK_FORMAT_BC1 : BLOCK_FORMAT_BC7;
+			// cooking was asked for, so don't go on and render without it.
+			if (!settings.cookTextures)
+			{
+				std::cerr << "Unknown texture format: " << argv[i] << " (bc1 or bc7)" << std::endl;
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--virtual-textures") == 0)
+			settings.virtualTextures = true;
+		else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc)
+		{
+			settings.width = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+			settings.height = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else
+			std::cerr << "Unknown argument: " << argv[i] << std::endl;
+	}
+
+	VulkanRenderer renderer(settings);
 
 	renderer.run();
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,120 @@
+#include "MappedFile.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+void MappedFile::open(const std::string& path)
+{
+	close();
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("failed to open file " + path);
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		throw std::runtime_error("failed to get size of file " + path);
+	}
+
+	mFile = file;
+	mSize = static_cast<size_t>(size.QuadPart);
+	mOpen = true;
+
+	// can't map an empty file on windows, just leave data null.
+	if (mSize == 0)
+		return;
+
+	mMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mMapping)
+	{
+		close();
+		throw std::runtime_error("failed to map file " + path);
+	}
+
+	mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if (!mData)
+	{
+		close();
+		throw std::runtime_error("failed to map view of file " + path);
+	}
+}
+
+void MappedFile::close()
+{
+	if (mData)
+		UnmapViewOfFile(mData);
+	if (mMapping)
+		CloseHandle(mMapping);
+	if (mFile)
+		CloseHandle(mFile);
+
+	mData = nullptr;
+	mMapping = nullptr;
+	mFile = nullptr;
+	mSize = 0;
+	mOpen = false;
+}
+
+#else
+
+void MappedFile::open(const std::string& path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("failed to open file " + path);
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("failed to get size of file " + path);
+	}
+
+	mFd = fd;
+	mSize = static_cast<size_t>(info.st_size);
+	mOpen = true;
+
+	if (mSize == 0)
+		return;
+
+	void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		close();
+		throw std::runtime_error("failed to map file " + path);
+	}
+
+	// we read front to back, let the kernel read ahead.
+	madvise(data, mSize, MADV_SEQUENTIAL);
+	mData = static_cast<const char*>(data);
+}
+
+void MappedFile::close()
+{
+	if (mData)
+		munmap(const_cast<char*>(mData), mSize);
+	if (mFd >= 0)
+		::close(mFd);
+
+	mData = nullptr;
+	mFd = -1;
+	mSize = 0;
+	mOpen = false;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only memory mapped file. The whole file gets mapped, and stays mapped until close() or the destructor.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string& path) { open(path); }
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// throws if the file can't be opened or mapped. An empty file opens fine with size() == 0 and data() == nullptr.
+	void open(const std::string& path);
+	void close();
+
+	const char* data() const { return mData; }
+	size_t size() const { return mSize; }
+	bool isOpen() const { return mOpen; }
+
+private:
+	const char* mData = nullptr;
+	size_t mSize = 0;
+	bool mOpen = false;
+
+#ifdef _WIN32
+	void* mFile = nullptr;
+	void* mMapping = nullptr;
+#else
+	int mFd = -1;
+#endif
+};
+
+#endif // !MAPPED_FILE_H
@@ -0,0 +1,271 @@
+#include "MemoryAllocator.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+static uint32_t orderFor(VkDeviceSize size)
+{
+	uint32_t order = 0;
+	while ((MEMORY_MIN_ALLOCATION << order) < size)
+		++order;
+	return order;
+}
+
+void MemoryAllocator::create(VkPhysicalDevice physicalDevice, VkDevice device)
+{
+	mDevice = device;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &mProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	mSeparateLinear = properties.limits.bufferImageGranularity > MEMORY_MIN_ALLOCATION;
+
+	mBlockSize.resize(mProperties.memoryHeapCount);
+	mHeapStats.resize(mProperties.memoryHeapCount);
+	for (uint32_t i = 0; i < mProperties.memoryHeapCount; ++i)
+	{
+		VkDeviceSize heapSize = mProperties.memoryHeaps[i].size;
+		VkDeviceSize blockSize = MEMORY_BLOCK_SIZE;
+		// an integrated GPU's little device local heap (or a 256MB BAR) shouldn't go in a couple of blocks.
+		if (heapSize < MEMORY_SMALL_HEAP)
+			while (blockSize > MEMORY_MIN_ALLOCATION * 1024 && blockSize > heapSize / 8)
+				blockSize /= 2;
+		mBlockSize[i] = blockSize;
+		mHeapStats[i].heapSize = heapSize;
+		mHeapStats[i].flags = mProperties.memoryHeaps[i].flags;
+	}
+
+	mPools.clear();
+	mPools.resize(mProperties.memoryTypeCount * (mSeparateLinear ? 2 : 1));
+}
+
+void MemoryAllocator::destroy()
+{
+	for (size_t p = 0; p < mPools.size(); ++p)
+	{
+		uint32_t memoryType = static_cast<uint32_t>(mSeparateLinear ? p / 2 : p);
+		for (auto& block : mPools[p])
+		{
+			if (!block)
+				continue;
+			if (block->allocations)
+				std::cerr << "memory allocator: " << block->allocations << " allocations still live in a block of memory type "
+					<< memoryType << std::endl;
+			freeDeviceMemory(block->memory, block->mapped != nullptr);
+		}
+	}
+	mPools.clear();
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < mProperties.memoryTypeCount; i++)
+	{
+		if ((typeFilter & (1 << i)) && (mProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+uint32_t MemoryAllocator::poolIndex(uint32_t memoryType, bool linear) const
+{
+	return mSeparateLinear ? memoryType * 2 + (linear ? 1 : 0) : memoryType;
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, unsigned char*& mapped)
+{
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(mDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+		throw std::runtime_error("failed to allocate device memory!");
+
+	mapped = nullptr;
+	if (mProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		void* data;
+		if (vkMapMemory(mDevice, memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+		{
+			vkFreeMemory(mDevice, memory, nullptr);
+			throw std::runtime_error("failed to map device memory!");
+		}
+		mapped = static_cast<unsigned char*>(data);
+	}
+
+	MemoryHeapStats& stats = mHeapStats[mProperties.memoryTypes[memoryType].heapIndex];
+	++stats.deviceAllocations;
+	return memory;
+}
+
+void MemoryAllocator::freeDeviceMemory(VkDeviceMemory memory, bool mapped)
+{
+	if (mapped)
+		vkUnmapMemory(mDevice, memory);
+	vkFreeMemory(mDevice, memory, nullptr);
+}
+
+bool MemoryAllocator::takeNode(Block& block, uint32_t order, VkDeviceSize& offset)
+{
+	// smallest free node that fits, split down to order. The halves that aren't used go on the free lists.
+	uint32_t found = order;
+	while (found <= block.topOrder && block.freeNodes[found].empty())
+		++found;
+	if (found > block.topOrder)
+		return false;
+
+	offset = *block.freeNodes[found].begin();
+	block.freeNodes[found].erase(block.freeNodes[found].begin());
+	while (found > order)
+	{
+		--found;
+		block.freeNodes[found].insert(offset + (MEMORY_MIN_ALLOCATION << found));
+	}
+	return true;
+}
+
+void MemoryAllocator::releaseNode(Block& block, uint32_t order, VkDeviceSize offset)
+{
+	// merge with the buddy for as long as it's free too.
+	while (order < block.topOrder)
+	{
+		VkDeviceSize buddy = offset ^ (MEMORY_MIN_ALLOCATION << order);
+		if (!block.freeNodes[order].erase(buddy))
+			break;
+		offset = std::min(offset, buddy);
+		++order;
+	}
+	block.freeNodes[order].insert(offset);
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear)
+{
+	MemoryAllocation allocation;
+	allocation.memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	allocation.size = requirements.size;
+	allocation.pool = poolIndex(allocation.memoryType, linear);
+
+	uint32_t heap = mProperties.memoryTypes[allocation.memoryType].heapIndex;
+	MemoryHeapStats& stats = mHeapStats[heap];
+	VkDeviceSize blockSize = mBlockSize[heap];
+	allocation.order = orderFor(std::max(requirements.size, requirements.alignment));
+	VkDeviceSize nodeSize = MEMORY_MIN_ALLOCATION << allocation.order;
+
+	if (nodeSize > blockSize / 2)
+	{
+		// big enough that a block would mostly be wasted around it.
+		allocation.memory = allocateDeviceMemory(allocation.memoryType, requirements.size, allocation.mapped);
+		++stats.dedicated;
+		stats.dedicatedBytes += requirements.size;
+		++stats.allocations;
+		stats.usedBytes += requirements.size;
+		stats.requestedBytes += requirements.size;
+		stats.peakBytes = std::max(stats.peakBytes, stats.blockBytes + stats.dedicatedBytes);
+		return allocation;
+	}
+
+	Pool& pool = mPools[allocation.pool];
+	Block* block = nullptr;
+	for (size_t i = 0; i < pool.size() && !block; ++i)
+	{
+		if (pool[i] && takeNode(*pool[i], allocation.order, allocation.offset))
+		{
+			block = pool[i].get();
+			allocation.block = static_cast<uint32_t>(i);
+		}
+	}
+
+	if (!block)
+	{
+		// nothing free anywhere, a new block in the first empty spot.
+		auto spot = std::find(pool.begin(), pool.end(), nullptr);
+		allocation.block = static_cast<uint32_t>(spot - pool.begin());
+		if (spot == pool.end())
+			pool.emplace_back();
+
+		std::unique_ptr<Block> created(new Block);
+		created->memory = allocateDeviceMemory(allocation.memoryType, blockSize, created->mapped);
+		created->topOrder = orderFor(blockSize);
+		created->freeNodes.resize(created->topOrder + 1);
+		created->freeNodes[created->topOrder].insert(0);
+		takeNode(*created, allocation.order, allocation.offset);
+
+		block = created.get();
+		pool[allocation.block] = std::move(created);
+		++stats.blocks;
+		stats.blockBytes += blockSize;
+		stats.peakBytes = std::max(stats.peakBytes, stats.blockBytes + stats.dedicatedBytes);
+	}
+
+	++block->allocations;
+	allocation.memory = block->memory;
+	if (block->mapped)
+		allocation.mapped = block->mapped + allocation.offset;
+	++stats.allocations;
+	stats.usedBytes += nodeSize;
+	stats.requestedBytes += requirements.size;
+	return allocation;
+}
+
+void MemoryAllocator::free(MemoryAllocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE)
+		return;
+
+	uint32_t heap = mProperties.memoryTypes[allocation.memoryType].heapIndex;
+	MemoryHeapStats& stats = mHeapStats[heap];
+	--stats.allocations;
+	stats.requestedBytes -= allocation.size;
+
+	if (allocation.block == MEMORY_DEDICATED)
+	{
+		freeDeviceMemory(allocation.memory, allocation.mapped != nullptr);
+		--stats.dedicated;
+		stats.dedicatedBytes -= allocation.size;
+		stats.usedBytes -= allocation.size;
+		allocation = MemoryAllocation();
+		return;
+	}
+
+	Pool& pool = mPools[allocation.pool];
+	Block& block = *pool[allocation.block];
+	releaseNode(block, allocation.order, allocation.offset);
+	stats.usedBytes -= MEMORY_MIN_ALLOCATION << allocation.order;
+
+	// an empty block is kept for the next allocation, unless the pool has another empty one already. Saves
+	// allocating and freeing a whole block over and over when something is created and destroyed every so often.
+	if (--block.allocations == 0)
+	{
+		bool otherEmpty = false;
+		for (size_t i = 0; i < pool.size(); ++i)
+			if (i != allocation.block && pool[i] && pool[i]->allocations == 0)
+				otherEmpty = true;
+		if (otherEmpty)
+		{
+			freeDeviceMemory(block.memory, block.mapped != nullptr);
+			pool[allocation.block].reset();
+			--stats.blocks;
+			stats.blockBytes -= mBlockSize[heap];
+		}
+	}
+	allocation = MemoryAllocation();
+}
+
+void MemoryAllocator::printStats(std::ostream& out) const
+{
+	const double MB = 1024.0 * 1024.0;
+	for (size_t i = 0; i < mHeapStats.size(); ++i)
+	{
+		const MemoryHeapStats& stats = mHeapStats[i];
+		if (!stats.deviceAllocations)
+			continue;
+		out << "Memory heap " << i << ((stats.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local, " : " (")
+			<< stats.heapSize / MB << " MB): " << stats.deviceAllocations << " device allocations, peak "
+			<< stats.peakBytes / MB << " MB. Still held: " << stats.blocks << " blocks (" << stats.blockBytes / MB << " MB) + "
+			<< stats.dedicated << " dedicated (" << stats.dedicatedBytes / MB << " MB), " << stats.allocations << " allocations using "
+			<< stats.usedBytes / MB << " MB (" << stats.requestedBytes / MB << " MB asked for)" << std::endl;
+	}
+}
@@ -0,0 +1,104 @@
+#ifndef MEMORY_ALLOCATOR_H
+#define MEMORY_ALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <vector>
+
+// Device memory for every buffer and image, carved out of a few big blocks instead of one vkAllocateMemory each.
+// Devices only allow maxMemoryAllocationCount allocations (4096 on plenty of them) and allocating is slow, so
+// a scene with a few hundred textures shouldn't cost a few hundred of them.
+//
+// - each memory type gets its own blocks of MEMORY_BLOCK_SIZE (less on small heaps), split with a buddy allocator.
+//   Every allocation is a power of two node at least as big as its alignment, so the offsets are always aligned.
+// - when bufferImageGranularity is bigger than the smallest node, buffers / linear images and optimal images get
+//   separate blocks, so the two kinds never share a granularity page and nothing needs padding.
+// - anything bigger than half a block gets memory of its own (a dedicated allocation).
+// - host visible blocks are mapped once, for their whole lifetime, and every allocation in them gets a pointer into
+//   that. Memory can't be mapped twice, so nothing else should call vkMapMemory on it.
+//
+// Main thread only, like the rest of the vulkan objects.
+
+const VkDeviceSize MEMORY_BLOCK_SIZE = VkDeviceSize(64) * 1024 * 1024; // power of two
+const VkDeviceSize MEMORY_MIN_ALLOCATION = 256; // smallest buddy node, also a power of two
+const VkDeviceSize MEMORY_SMALL_HEAP = VkDeviceSize(1024) * 1024 * 1024; // heaps under this get blocks of an eighth of their size
+
+const uint32_t MEMORY_DEDICATED = UINT32_MAX; // MemoryAllocation::block for memory of its own
+
+// somewhere in a block to bind a buffer / image to.
+struct MemoryAllocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE; // the whole block's, bind at offset
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0; // what was asked for
+	unsigned char* mapped = nullptr; // at offset, when the memory is host visible
+	uint32_t memoryType = 0;
+	uint32_t pool = 0; // which set of blocks, see MemoryAllocator::poolIndex
+	uint32_t block = MEMORY_DEDICATED;
+	uint32_t order = 0; // node size is MEMORY_MIN_ALLOCATION << order
+};
+
+struct MemoryHeapStats
+{
+	VkDeviceSize heapSize = 0;
+	VkMemoryHeapFlags flags = 0;
+	uint32_t blocks = 0;
+	VkDeviceSize blockBytes = 0;
+	uint32_t dedicated = 0;
+	VkDeviceSize dedicatedBytes = 0;
+	uint32_t allocations = 0; // live ones, in blocks or dedicated
+	VkDeviceSize usedBytes = 0; // node sizes, what the allocations actually take up of the blocks
+	VkDeviceSize requestedBytes = 0; // what they asked for
+	VkDeviceSize peakBytes = 0; // most device memory (blocks + dedicated) held at once
+	uint32_t deviceAllocations = 0; // vkAllocateMemory calls so far
+};
+
+class MemoryAllocator
+{
+public:
+	void create(VkPhysicalDevice physicalDevice, VkDevice device);
+	// frees every block. Everything allocated from them has to have been freed (and the device idle).
+	void destroy();
+
+	// linear is true for buffers and linear tiled images. Throws if there's no memory type with properties or the
+	// device is out of memory.
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+	// gives allocation back and resets it. Does nothing to an empty one.
+	void free(MemoryAllocation& allocation);
+
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+	std::vector<MemoryHeapStats> stats() const { return mHeapStats; }
+	void printStats(std::ostream& out) const;
+
+private:
+	struct Block
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		unsigned char* mapped = nullptr;
+		uint32_t topOrder = 0; // the whole block's order
+		std::vector<std::set<VkDeviceSize>> freeNodes; // offsets of the free nodes, per order
+		uint32_t allocations = 0;
+	};
+
+	// blocks of one memory type for one kind of resource, null where a block has been freed.
+	typedef std::vector<std::unique_ptr<Block>> Pool;
+
+	uint32_t poolIndex(uint32_t memoryType, bool linear) const;
+	VkDeviceMemory allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size, unsigned char*& mapped);
+	void freeDeviceMemory(VkDeviceMemory memory, bool mapped);
+	bool takeNode(Block& block, uint32_t order, VkDeviceSize& offset);
+	void releaseNode(Block& block, uint32_t order, VkDeviceSize offset);
+
+	VkDevice mDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties mProperties{};
+	bool mSeparateLinear = false; // bufferImageGranularity > MEMORY_MIN_ALLOCATION
+	std::vector<VkDeviceSize> mBlockSize; // per heap
+	std::vector<Pool> mPools; // per memory type, and per kind when mSeparateLinear
+	std::vector<MemoryHeapStats> mHeapStats;
+};
+
+#endif // !MEMORY_ALLOCATOR_H
@@ -0,0 +1,236 @@
+#include "MeshCache.h"
+#include "Tracer.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+	const char MESH_CACHE_MAGIC[4] = { 'V', 'K', 'M', 'C' };
+	// payloads start on this boundary, so the mapped pointers are fine to read as floats / uint32s.
+	const uint64_t MESH_CACHE_ALIGNMENT = 16;
+
+	struct MeshCacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceSize;
+		int64_t sourceMtime;
+		uint64_t contentHash;
+		uint32_t vertexSize;
+		uint32_t pathLength; // source path follows the header, not null terminated
+		uint32_t extraSize;
+		uint32_t reserved;
+		uint64_t extraOffset;
+		uint64_t vertexCount;
+		uint64_t indexCount;
+		uint64_t vertexOffset; // from the start of the file
+		uint64_t indexOffset;
+	};
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	inline uint64_t rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline uint64_t readU64(const unsigned char* p)
+	{
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	MeshSourceKey makeSourceKey(const std::string& sourcePath)
+	{
+		TRACE_FUNCTION();
+		MeshSourceKey key;
+		key.size = std::filesystem::file_size(sourcePath);
+		key.mtime = static_cast<int64_t>(std::filesystem::last_write_time(sourcePath).time_since_epoch().count());
+
+		MappedFile source(sourcePath);
+		key.contentHash = hashContent(source.data(), source.size());
+		return key;
+	}
+}
+
+// four independent lanes of multiply-rotate (xxhash style mixing) so it runs at memory speed, then a final
+// avalanche. Not cryptographic, just good enough to notice a changed file.
+uint64_t hashContent(const void* data, size_t size)
+{
+	const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+	const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+	const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	const unsigned char* end = p + size;
+
+	uint64_t lanes[4] = { PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1 };
+	while (end - p >= 32)
+	{
+		for (int i = 0; i < 4; ++i)
+			lanes[i] = rotl(lanes[i] + readU64(p + i * 8) * PRIME2, 31) * PRIME1;
+		p += 32;
+	}
+
+	uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18) + size;
+	while (end - p >= 8)
+	{
+		h ^= rotl(readU64(p) * PRIME2, 31) * PRIME1;
+		h = rotl(h, 27) * PRIME1 + PRIME3;
+		p += 8;
+	}
+	while (p < end)
+	{
+		h ^= *p++ * PRIME3;
+		h = rotl(h, 11) * PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+std::string MeshCache::cachePathFor(const std::string& sourcePath)
+{
+	// flatten the source path into a file name, so Models/a.obj and Other/a.obj don't collide.
+	std::string name = sourcePath;
+	for (char& c : name)
+	{
+		if (c == '/' || c == '\\' || c == ':')
+			c = '_';
+	}
+	return MESH_CACHE_DIRECTORY + "/" + name + ".meshcache";
+}
+
+bool MeshCache::open(const std::string& sourcePath, uint32_t vertexSize)
+{
+	TRACE_FUNCTION();
+	close();
+
+	mSourcePath = sourcePath;
+	mCachePath = cachePathFor(sourcePath);
+	mVertexSize = vertexSize;
+	mKey = makeSourceKey(sourcePath);
+
+	std::error_code error;
+	if (!std::filesystem::exists(mCachePath, error))
+		return false;
+
+	mFile.open(mCachePath);
+	const char* data = mFile.data();
+	size_t size = mFile.size();
+
+	MeshCacheHeader header;
+	if (size < sizeof(header))
+	{
+		close();
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	bool valid = memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == MESH_CACHE_VERSION
+		&& header.sourceSize == mKey.size
+		&& header.sourceMtime == mKey.mtime
+		&& header.contentHash == mKey.contentHash
+		&& header.vertexSize == vertexSize
+		&& sizeof(header) + header.pathLength <= size
+		&& std::string(data + sizeof(header), header.pathLength) == sourcePath
+		&& header.vertexOffset + header.vertexCount * vertexSize <= size
+		&& header.indexOffset + header.indexCount * sizeof(uint32_t) <= size
+		&& header.extraOffset + header.extraSize <= size;
+
+	if (!valid)
+	{
+		close();
+		return false;
+	}
+
+	mVertices = data + header.vertexOffset;
+	mVertexCount = static_cast<size_t>(header.vertexCount);
+	mIndices = reinterpret_cast<const uint32_t*>(data + header.indexOffset);
+	mIndexCount = static_cast<size_t>(header.indexCount);
+	mExtra = header.extraSize ? data + header.extraOffset : nullptr;
+	mExtraSize = header.extraSize;
+	return true;
+}
+
+void MeshCache::close()
+{
+	mFile.close();
+	mVertices = nullptr;
+	mVertexCount = 0;
+	mIndices = nullptr;
+	mIndexCount = 0;
+	mExtra = nullptr;
+	mExtraSize = 0;
+}
+
+bool MeshCache::write(const void* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+	const void* extra, uint32_t extraSize)
+{
+	TRACE_FUNCTION();
+
+	MeshCacheHeader header = {};
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.sourceSize = mKey.size;
+	header.sourceMtime = mKey.mtime;
+	header.contentHash = mKey.contentHash;
+	header.vertexSize = mVertexSize;
+	header.pathLength = static_cast<uint32_t>(mSourcePath.size());
+	header.vertexCount = vertexCount;
+	header.indexCount = indexCount;
+	header.vertexOffset = alignUp(sizeof(header) + header.pathLength, MESH_CACHE_ALIGNMENT);
+	header.indexOffset = alignUp(header.vertexOffset + vertexCount * mVertexSize, MESH_CACHE_ALIGNMENT);
+	header.extraSize = extraSize;
+	header.extraOffset = alignUp(header.indexOffset + indexCount * sizeof(uint32_t), MESH_CACHE_ALIGNMENT);
+
+	std::error_code error;
+	std::filesystem::create_directories(MESH_CACHE_DIRECTORY, error);
+
+	std::string tempPath = mCachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		const char padding[MESH_CACHE_ALIGNMENT] = {};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(mSourcePath.data(), mSourcePath.size());
+		file.write(padding, header.vertexOffset - (sizeof(header) + header.pathLength));
+		file.write(static_cast<const char*>(vertices), vertexCount * mVertexSize);
+		file.write(padding, header.indexOffset - (header.vertexOffset + vertexCount * mVertexSize));
+		file.write(reinterpret_cast<const char*>(indices), indexCount * sizeof(uint32_t));
+		file.write(padding, header.extraOffset - (header.indexOffset + indexCount * sizeof(uint32_t)));
+		if (extraSize)
+			file.write(static_cast<const char*>(extra), extraSize);
+
+		if (!file)
+		{
+			file.close();
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+	}
+
+	// can't rename over the cache while we've got it mapped (windows won't let us).
+	mFile.close();
+	std::filesystem::rename(tempPath, mCachePath, error);
+	if (error)
+	{
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,68 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "MappedFile.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Binary cache of the finished (welded, reordered) vertex and index buffers, so startup can skip parsing the obj.
+// One file per source mesh in MESH_CACHE_DIRECTORY. The header holds the key: source path, size, mtime and a hash
+// of the source contents. Any of those changing, or the format version / vertex size, counts as a miss.
+//
+// A hit leaves the cache file mapped, and vertices() / indices() point straight into it until close().
+
+const std::string MESH_CACHE_DIRECTORY = "Cache";
+// bump whenever the file layout or anything that changes the built mesh (loader, optimization passes) changes.
+const uint32_t MESH_CACHE_VERSION = 6;
+
+struct MeshSourceKey
+{
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	uint64_t contentHash = 0;
+};
+
+// 64 bit hash of a file's contents, the one the cache keys on. Also used to spot the same texture under two paths.
+uint64_t hashContent(const void* data, size_t size);
+
+class MeshCache
+{
+public:
+	// looks up sourcePath. True on a hit, with the payloads mapped. On a miss the source key is kept for write().
+	bool open(const std::string& sourcePath, uint32_t vertexSize);
+	void close();
+
+	// writes a cache for the source passed to the last open(). Goes through a temp file + rename, so a crash
+	// halfway through never leaves a broken cache behind. Returns false (and leaves things as they were) on failure.
+	// extra is a small blob stored alongside the mesh (e.g. the dequantization constants for a packed vertex format).
+	bool write(const void* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+		const void* extra = nullptr, uint32_t extraSize = 0);
+
+	const void* vertices() const { return mVertices; }
+	size_t vertexCount() const { return mVertexCount; }
+	const uint32_t* indices() const { return mIndices; }
+	size_t indexCount() const { return mIndexCount; }
+	const void* extra() const { return mExtra; }
+	uint32_t extraSize() const { return mExtraSize; }
+
+	const std::string& cachePath() const { return mCachePath; }
+
+	static std::string cachePathFor(const std::string& sourcePath);
+
+private:
+	MappedFile mFile;
+	std::string mSourcePath;
+	std::string mCachePath;
+	MeshSourceKey mKey;
+	uint32_t mVertexSize = 0;
+
+	const void* mVertices = nullptr;
+	size_t mVertexCount = 0;
+	const uint32_t* mIndices = nullptr;
+	size_t mIndexCount = 0;
+	const void* mExtra = nullptr;
+	uint32_t mExtraSize = 0;
+};
+
+#endif // !MESH_CACHE_H
@@ -0,0 +1,281 @@
+#include "MeshKernels.h"
+#include "FrameStats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// glm only uses intrinsics when asked to. Asking here and nowhere else keeps every other glm type in the renderer
+// (and the vertex layouts built out of them) the way it was, which is why nothing in MeshKernels.h is a glm type.
+#define GLM_FORCE_INTRINSICS
+#include <glm/detail/setup.hpp>
+#include <glm/simd/geometric.h>
+
+namespace
+{
+	const float* positionAt(const float* positions, size_t i, size_t stride)
+	{
+		return reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + i * stride);
+	}
+
+	const float DEFAULT_NORMAL[3] = { 0.0f, 1.0f, 0.0f };
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+	const bool KERNELS_VECTORIZED = true;
+
+	// xyz into a register with w zeroed. The last position is read a float at a time, a 4 wide load there could run
+	// off the end of the array.
+	inline glm_vec4 loadPosition(const float* p, bool last)
+	{
+		const glm_vec4 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+		return last ? _mm_setr_ps(p[0], p[1], p[2], 0.0f) : _mm_and_ps(_mm_loadu_ps(p), xyzMask);
+	}
+
+	inline void storePosition(float* p, glm_vec4 v)
+	{
+		alignas(16) float lanes[4];
+		_mm_store_ps(lanes, v);
+		memcpy(p, lanes, sizeof(float) * 3);
+	}
+	// adds the xyz of n onto p as an 8 byte xy and a 4 byte z, the same widths every time so the loads always line
+	// up with the last stores to the same vertex.
+	inline void accumulateNormal(float* p, glm_vec4 n)
+	{
+		glm_vec4 xy = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(p));
+		glm_vec4 sum = glm_vec4_add(_mm_movelh_ps(xy, _mm_load_ss(p + 2)), n);
+		_mm_storel_pi(reinterpret_cast<__m64*>(p), sum);
+		_mm_store_ss(p + 2, _mm_movehl_ps(sum, sum));
+	}
+#else
+	const bool KERNELS_VECTORIZED = false;
+#endif
+}
+
+void computeBoundsScalar(MeshBounds& bounds, const float* positions, size_t count, size_t stride)
+{
+	bounds = MeshBounds();
+	if (count == 0)
+		return;
+
+	for (int c = 0; c < 3; ++c)
+		bounds.min[c] = bounds.max[c] = positions[c];
+	for (size_t i = 1; i < count; ++i)
+	{
+		const float* p = positionAt(positions, i, stride);
+		for (int c = 0; c < 3; ++c)
+		{
+			bounds.min[c] = std::min(bounds.min[c], p[c]);
+			bounds.max[c] = std::max(bounds.max[c], p[c]);
+		}
+	}
+
+	for (int c = 0; c < 3; ++c)
+		bounds.center[c] = (bounds.min[c] + bounds.max[c]) * 0.5f;
+
+	// compare squared distances, one sqrt at the end.
+	float radiusSquared = 0.0f;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const float* p = positionAt(positions, i, stride);
+		float dx = p[0] - bounds.center[0], dy = p[1] - bounds.center[1], dz = p[2] - bounds.center[2];
+		radiusSquared = std::max(radiusSquared, dx * dx + dy * dy + dz * dz);
+	}
+	bounds.radius = std::sqrt(radiusSquared);
+}
+
+void computeBounds(MeshBounds& bounds, const float* positions, size_t count, size_t stride)
+{
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+	bounds = MeshBounds();
+	if (count == 0)
+		return;
+
+	// one vertex per register, all three axes at once.
+	glm_vec4 low = loadPosition(positions, count == 1);
+	glm_vec4 high = low;
+	for (size_t i = 1; i < count; ++i)
+	{
+		glm_vec4 p = loadPosition(positionAt(positions, i, stride), i == count - 1);
+		low = _mm_min_ps(low, p);
+		high = _mm_max_ps(high, p);
+	}
+	glm_vec4 center = glm_vec4_mul(glm_vec4_add(low, high), _mm_set1_ps(0.5f));
+
+	// glm_vec4_dot leaves the squared distance in every lane, so the max doesn't need a horizontal step at the end.
+	glm_vec4 radiusSquared = _mm_setzero_ps();
+	for (size_t i = 0; i < count; ++i)
+	{
+		glm_vec4 offset = glm_vec4_sub(loadPosition(positionAt(positions, i, stride), i == count - 1), center);
+		radiusSquared = _mm_max_ps(radiusSquared, glm_vec4_dot(offset, offset));
+	}
+
+	storePosition(bounds.min, low);
+	storePosition(bounds.max, high);
+	storePosition(bounds.center, center);
+	bounds.radius = std::sqrt(_mm_cvtss_f32(radiusSquared));
+#else
+	computeBoundsScalar(bounds, positions, count, stride);
+#endif
+}
+
+void generateNormalsScalar(float* normals, const float* positions, size_t positionCount, const uint32_t* indices, size_t indexCount)
+{
+	std::fill(normals, normals + positionCount * 3, 0.0f);
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		const float* a = &positions[3 * indices[i + 0]];
+		const float* b = &positions[3 * indices[i + 1]];
+		const float* c = &positions[3 * indices[i + 2]];
+		float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+		// twice the triangle's area long, which is the weighting we want.
+		float n[3] = {
+			e1[1] * e2[2] - e1[2] * e2[1],
+			e1[2] * e2[0] - e1[0] * e2[2],
+			e1[0] * e2[1] - e1[1] * e2[0]
+		};
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			float* sum = &normals[3 * indices[i + corner]];
+			sum[0] += n[0];
+			sum[1] += n[1];
+			sum[2] += n[2];
+		}
+	}
+
+	for (size_t v = 0; v < positionCount; ++v)
+	{
+		float* n = &normals[3 * v];
+		float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length > 0.0f)
+		{
+			n[0] /= length;
+			n[1] /= length;
+			n[2] /= length;
+		}
+		else
+			memcpy(n, DEFAULT_NORMAL, sizeof(DEFAULT_NORMAL));
+	}
+}
+
+void generateNormals(float* normals, const float* positions, size_t positionCount, const uint32_t* indices, size_t indexCount)
+{
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+	// the sums go straight into normals. A register per vertex of scratch would make the adds single instructions,
+	// but faulting in that much fresh memory costs more than it saves on big meshes. Summing 4 wide into normals
+	// (spilling into the next vertex's x) is worse still, neighbours' overlapping stores keep missing store forwarding.
+	std::fill(normals, normals + positionCount * 3, 0.0f);
+	size_t last = positionCount - 1;
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		uint32_t ia = indices[i + 0], ib = indices[i + 1], ic = indices[i + 2];
+		glm_vec4 a = loadPosition(&positions[3 * ia], ia == last);
+		glm_vec4 b = loadPosition(&positions[3 * ib], ib == last);
+		glm_vec4 c = loadPosition(&positions[3 * ic], ic == last);
+
+		// twice the triangle's area long, which is the weighting we want.
+		glm_vec4 n = glm_vec4_cross(glm_vec4_sub(b, a), glm_vec4_sub(c, a));
+		for (uint32_t v : { ia, ib, ic })
+			accumulateNormal(&normals[3 * v], n);
+	}
+
+	// a real divide rather than glm_vec4_normalize, its rsqrt estimate is only good to about 3 decimal places.
+	const glm_vec4 zero = _mm_setzero_ps();
+	const glm_vec4 fallback = _mm_setr_ps(DEFAULT_NORMAL[0], DEFAULT_NORMAL[1], DEFAULT_NORMAL[2], 0.0f);
+	for (size_t v = 0; v < positionCount; ++v)
+	{
+		glm_vec4 sum = loadPosition(&normals[3 * v], v == last);
+		glm_vec4 length = glm_vec4_length(sum);
+		glm_vec4 valid = _mm_cmpgt_ps(length, zero);
+		glm_vec4 n = _mm_div_ps(sum, length);
+		storePosition(&normals[3 * v], _mm_or_ps(_mm_and_ps(valid, n), _mm_andnot_ps(valid, fallback)));
+	}
+#else
+	generateNormalsScalar(normals, positions, positionCount, indices, indexCount);
+#endif
+}
+
+void benchmarkMeshKernels(size_t triangleCount)
+{
+	// a bumpy square grid, two triangles per cell. Grid order is about what a cache optimized mesh looks like.
+	size_t side = std::max<size_t>(1, static_cast<size_t>(std::ceil(std::sqrt(triangleCount / 2.0))));
+	size_t positionCount = (side + 1) * (side + 1);
+	std::vector<float> positions(positionCount * 3);
+	for (size_t y = 0; y <= side; ++y)
+	{
+		for (size_t x = 0; x <= side; ++x)
+		{
+			float* p = &positions[3 * (y * (side + 1) + x)];
+			p[0] = static_cast<float>(x) / side;
+			p[1] = 0.05f * std::sin(x * 0.37f) * std::cos(y * 0.53f);
+			p[2] = static_cast<float>(y) / side;
+		}
+	}
+
+	std::vector<uint32_t> indices;
+	indices.reserve(side * side * 6);
+	for (size_t y = 0; y < side; ++y)
+	{
+		for (size_t x = 0; x < side; ++x)
+		{
+			uint32_t corner = static_cast<uint32_t>(y * (side + 1) + x);
+			uint32_t below = corner + static_cast<uint32_t>(side + 1);
+			indices.insert(indices.end(), { corner, below, corner + 1, corner + 1, below, below + 1 });
+		}
+	}
+
+	std::cout << "mesh kernels: " << indices.size() / 3 << " triangles, " << positionCount << " vertices, "
+		<< (KERNELS_VECTORIZED ? "SSE" : "no SIMD on this target, both columns are scalar") << std::endl;
+
+	// best of a few runs, the first one also pays for faulting the output pages in.
+	const int RUNS = 5;
+	auto best = [&](auto kernel)
+	{
+		double fastest = 0.0;
+		for (int run = 0; run < RUNS; ++run)
+		{
+			StatClock::time_point start = StatClock::now();
+			kernel();
+			double ms = elapsedMs(start, StatClock::now());
+			fastest = run == 0 ? ms : std::min(fastest, ms);
+		}
+		return fastest;
+	};
+
+	auto printRow = [](const char* name, double scalarMs, double simdMs, double maxDifference)
+	{
+		std::cout << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(3)
+			<< std::setw(12) << scalarMs << std::setw(12) << simdMs << std::setw(9) << scalarMs / simdMs << "x"
+			<< std::scientific << std::setprecision(2) << std::setw(12) << maxDifference << std::endl;
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+	};
+
+	std::cout << std::left << std::setw(10) << "kernel" << std::right << std::setw(12) << "scalar ms" << std::setw(12) << "simd ms"
+		<< std::setw(10) << "speedup" << std::setw(12) << "max diff" << std::endl;
+
+	MeshBounds scalarBounds, simdBounds;
+	double scalarMs = best([&]() { computeBoundsScalar(scalarBounds, positions.data(), positionCount, sizeof(float) * 3); });
+	double simdMs = best([&]() { computeBounds(simdBounds, positions.data(), positionCount, sizeof(float) * 3); });
+	double difference = std::fabs(scalarBounds.radius - simdBounds.radius);
+	for (int c = 0; c < 3; ++c)
+	{
+		difference = std::max<double>(difference, std::fabs(scalarBounds.min[c] - simdBounds.min[c]));
+		difference = std::max<double>(difference, std::fabs(scalarBounds.max[c] - simdBounds.max[c]));
+		difference = std::max<double>(difference, std::fabs(scalarBounds.center[c] - simdBounds.center[c]));
+	}
+	printRow("bounds", scalarMs, simdMs, difference);
+
+	std::vector<float> scalarNormals(positionCount * 3), simdNormals(positionCount * 3);
+	scalarMs = best([&]() { generateNormalsScalar(scalarNormals.data(), positions.data(), positionCount, indices.data(), indices.size()); });
+	simdMs = best([&]() { generateNormals(simdNormals.data(), positions.data(), positionCount, indices.data(), indices.size()); });
+	difference = 0.0;
+	for (size_t i = 0; i < scalarNormals.size(); ++i)
+		difference = std::max<double>(difference, std::fabs(scalarNormals[i] - simdNormals[i]));
+	printRow("normals", scalarMs, simdMs, difference);
+}
@@ -0,0 +1,35 @@
+#ifndef MESH_KERNELS_H
+#define MESH_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Hot loops over whole meshes, vectorized on glm's SSE paths (glm/simd). Each one has a scalar twin that gives the
+// same answer, used where there's no SSE and by benchmarkMeshKernels to check the SIMD one against.
+//
+// Positions are 3 floats at the start of every vertex, stride bytes apart, so these work on Vertex arrays and on
+// plain xyz arrays (stride 12) alike.
+
+struct MeshBounds
+{
+	float min[3] = { 0.0f, 0.0f, 0.0f };
+	float max[3] = { 0.0f, 0.0f, 0.0f };
+	float center[3] = { 0.0f, 0.0f, 0.0f }; // bounding sphere: the AABB's center...
+	float radius = 0.0f; // ...out to the furthest vertex
+};
+
+// AABB, then a bounding sphere around its center. All zero for no vertices.
+void computeBounds(MeshBounds& bounds, const float* positions, size_t count, size_t stride);
+void computeBoundsScalar(MeshBounds& bounds, const float* positions, size_t count, size_t stride);
+
+// smooth normals for an indexed triangle list: every triangle adds its unnormalized cross product (so bigger
+// triangles count for more) to its three vertices, then each vertex's sum gets normalized. Vertices no triangle
+// gives a direction to get +y. positions are packed xyz, normals gets positionCount xyz.
+void generateNormals(float* normals, const float* positions, size_t positionCount, const uint32_t* indices, size_t indexCount);
+void generateNormalsScalar(float* normals, const float* positions, size_t positionCount, const uint32_t* indices, size_t indexCount);
+
+// times both versions of every kernel on a generated height field about triangleCount triangles big and prints
+// the best of a few runs, plus how far the SIMD results are from the scalar ones.
+void benchmarkMeshKernels(size_t triangleCount);
+
+#endif // !MESH_KERNELS_H
@@ -0,0 +1,683 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+	VertexCacheStats stats;
+	stats.vertexCount = vertexCount;
+	stats.indexCount = indexCount;
+
+	// FIFO cache. A vertex is in the cache if it went in less than cacheSize misses ago.
+	std::vector<size_t> cacheTime(vertexCount, 0);
+	size_t time = cacheSize + 1;
+
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		uint32_t v = indices[i];
+		if (time - cacheTime[v] > cacheSize)
+		{
+			cacheTime[v] = time++;
+			++stats.transformedVertices;
+		}
+	}
+
+	size_t triangleCount = indexCount / 3;
+	stats.acmr = triangleCount ? double(stats.transformedVertices) / triangleCount : 0.0;
+	stats.atvr = vertexCount ? double(stats.transformedVertices) / vertexCount : 0.0;
+
+	return stats;
+}
+
+// FNV-1a over the raw bytes. Vertices are small, this is plenty.
+static uint32_t hashBytes(const unsigned char* data, size_t size)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < size; ++i)
+	{
+		h ^= data[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+size_t generateVertexRemap(std::vector<uint32_t>& remap, const void* vertices, size_t vertexCount, size_t vertexSize)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(vertices);
+	const uint32_t EMPTY = ~0u;
+
+	remap.assign(vertexCount, EMPTY);
+
+	// open addressing table of vertex indices, kept under half full.
+	size_t tableSize = 1;
+	while (tableSize < vertexCount * 2)
+		tableSize *= 2;
+	std::vector<uint32_t> table(tableSize, EMPTY);
+
+	size_t uniqueCount = 0;
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		const unsigned char* vertex = bytes + i * vertexSize;
+		size_t slot = hashBytes(vertex, vertexSize) & (tableSize - 1);
+
+		// linear probe until we find this vertex or an empty slot.
+		while (table[slot] != EMPTY && memcmp(bytes + size_t(table[slot]) * vertexSize, vertex, vertexSize) != 0)
+			slot = (slot + 1) & (tableSize - 1);
+
+		if (table[slot] == EMPTY)
+		{
+			table[slot] = static_cast<uint32_t>(i);
+			remap[i] = static_cast<uint32_t>(uniqueCount++);
+		}
+		else
+			remap[i] = remap[table[slot]];
+	}
+
+	return uniqueCount;
+}
+
+void remapVertexBuffer(void* dst, const void* vertices, size_t vertexCount, size_t vertexSize, const std::vector<uint32_t>& remap)
+{
+	unsigned char* out = static_cast<unsigned char*>(dst);
+	const unsigned char* in = static_cast<const unsigned char*>(vertices);
+
+	for (size_t i = 0; i < vertexCount; ++i)
+		memcpy(out + size_t(remap[i]) * vertexSize, in + i * vertexSize, vertexSize);
+}
+
+void remapIndexBuffer(uint32_t* dst, const uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& remap)
+{
+	for (size_t i = 0; i < indexCount; ++i)
+		dst[i] = remap[indices[i]];
+}
+
+// Forsyth's scoring. Tom Forsyth, "Linear-Speed Vertex Cache Optimisation" (2006).
+namespace
+{
+	const int FORSYTH_CACHE_SIZE = 32;
+	const float FORSYTH_CACHE_DECAY = 1.5f;
+	const float FORSYTH_LAST_TRI_SCORE = 0.75f;
+	const float FORSYTH_VALENCE_SCALE = 2.0f;
+	const float FORSYTH_VALENCE_POWER = 0.5f;
+	const int FORSYTH_MAX_VALENCE = 64; // past this the valence boost is basically flat anyway
+
+	struct ForsythTables
+	{
+		float cache[FORSYTH_CACHE_SIZE];
+		float valence[FORSYTH_MAX_VALENCE + 1];
+
+		ForsythTables()
+		{
+			for (int i = 0; i < FORSYTH_CACHE_SIZE; ++i)
+			{
+				// the three verts of the last triangle get a fixed score so we don't favour one of them.
+				if (i < 3)
+					cache[i] = FORSYTH_LAST_TRI_SCORE;
+				else
+					cache[i] = powf(1.0f - float(i - 3) / (FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY);
+			}
+
+			valence[0] = 0.0f;
+			for (int i = 1; i <= FORSYTH_MAX_VALENCE; ++i)
+				valence[i] = FORSYTH_VALENCE_SCALE * powf(float(i), -FORSYTH_VALENCE_POWER);
+		}
+	};
+
+	float forsythScore(const ForsythTables& tables, int cachePosition, uint32_t remainingTriangles)
+	{
+		// no triangles left means nothing will ever want this vertex.
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = cachePosition >= 0 ? tables.cache[cachePosition] : 0.0f;
+		score += tables.valence[std::min<uint32_t>(remainingTriangles, FORSYTH_MAX_VALENCE)];
+		return score;
+	}
+}
+
+void optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	assert(indexCount % 3 == 0);
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	static const ForsythTables tables;
+
+	// vertex -> triangle adjacency, packed. activeCount shrinks as triangles get emitted.
+	std::vector<uint32_t> activeCount(vertexCount, 0);
+	for (size_t i = 0; i < indexCount; ++i)
+		++activeCount[indices[i]];
+
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v)
+		offsets[v + 1] = offsets[v] + activeCount[v];
+
+	std::vector<uint32_t> adjacency(indexCount);
+	{
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; ++t)
+			for (int k = 0; k < 3; ++k)
+				adjacency[fill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+		vertexScore[v] = forsythScore(tables, -1, activeCount[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (size_t t = 0; t < triangleCount; ++t)
+		triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+	// cache gets the new triangle's 3 verts pushed on the front, so it can hold 3 more than its size for a moment.
+	uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+	uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+	int cacheCount = 0;
+
+	size_t nextCandidate = 0; // where to look when the cache has nothing useful in it
+	size_t outTriangles = 0;
+	int64_t bestTriangle = -1;
+
+	while (outTriangles < triangleCount)
+	{
+		// nothing adjacent to the cache scored. Fall back to the first triangle we haven't emitted yet.
+		if (bestTriangle < 0)
+		{
+			while (emitted[nextCandidate])
+				++nextCandidate;
+			bestTriangle = static_cast<int64_t>(nextCandidate);
+		}
+
+		const uint32_t* tri = &indices[bestTriangle * 3];
+		dst[outTriangles * 3 + 0] = tri[0];
+		dst[outTriangles * 3 + 1] = tri[1];
+		dst[outTriangles * 3 + 2] = tri[2];
+		++outTriangles;
+		emitted[bestTriangle] = true;
+
+		// take the triangle off each vertex's active list.
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t v = tri[k];
+			uint32_t* begin = &adjacency[offsets[v]];
+			uint32_t* end = begin + activeCount[v];
+			uint32_t* found = std::find(begin, end, static_cast<uint32_t>(bestTriangle));
+			assert(found != end);
+			*found = *(end - 1);
+			--activeCount[v];
+		}
+
+		// new cache: this triangle's verts first, then whatever was in there before.
+		int newCount = 0;
+		for (int k = 0; k < 3; ++k)
+			newCache[newCount++] = tri[k];
+		for (int i = 0; i < cacheCount; ++i)
+		{
+			uint32_t v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				newCache[newCount++] = v;
+		}
+
+		// rescore everything that was or is in the cache, and the triangles around them.
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (int i = 0; i < newCount; ++i)
+		{
+			uint32_t v = newCache[i];
+			int position = i < FORSYTH_CACHE_SIZE ? i : -1;
+			cachePosition[v] = position;
+
+			float score = forsythScore(tables, position, activeCount[v]);
+			float delta = score - vertexScore[v];
+			vertexScore[v] = score;
+
+			for (uint32_t a = 0; a < activeCount[v]; ++a)
+			{
+				uint32_t t = adjacency[offsets[v] + a];
+				triangleScore[t] += delta;
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					bestTriangle = t;
+				}
+			}
+		}
+
+		cacheCount = std::min(newCount, FORSYTH_CACHE_SIZE);
+		std::copy(newCache, newCache + cacheCount, cache);
+	}
+}
+
+namespace
+{
+	struct OverdrawCluster
+	{
+		size_t firstTriangle;
+		size_t triangleCount;
+		float sortKey;
+	};
+}
+
+void optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+	size_t positionStride, float threshold)
+{
+	assert(indexCount % 3 == 0);
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	// copy first, dst is allowed to be the same buffer as indices.
+	std::vector<uint32_t> source(indices, indices + indexCount);
+
+	auto position = [&](uint32_t v) { return reinterpret_cast<const float*>(reinterpret_cast<const unsigned char*>(positions) + size_t(v) * positionStride); };
+
+	// split into clusters. A cluster can only start where the cache simulation misses on all 3 verts anyway
+	// (so reordering costs nothing there) and only once the current cluster is at least as good as the target ACMR.
+	float targetAcmr = static_cast<float>(analyzeVertexCache(source.data(), indexCount, vertexCount).acmr) * threshold;
+
+	std::vector<OverdrawCluster> clusters;
+	std::vector<size_t> cacheTime(vertexCount, 0);
+	size_t time = VERTEX_CACHE_SIZE + 1;
+	size_t clusterMisses = 0;
+
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t v = source[t * 3 + k];
+			if (time - cacheTime[v] > VERTEX_CACHE_SIZE)
+			{
+				cacheTime[v] = time++;
+				++misses;
+			}
+		}
+
+		bool split = clusters.empty();
+		if (!split && misses == 3)
+		{
+			OverdrawCluster& current = clusters.back();
+			split = float(clusterMisses) / current.triangleCount <= targetAcmr;
+		}
+
+		if (split)
+		{
+			clusters.push_back({ t, 0, 0.0f });
+			clusterMisses = 0;
+		}
+
+		++clusters.back().triangleCount;
+		clusterMisses += misses;
+	}
+
+	// mesh centroid, then for each cluster: how far out along its own average normal it sits from that centroid.
+	// Clusters facing out from the middle draw first and tend to occlude the rest.
+	float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+	for (size_t i = 0; i < indexCount; ++i)
+		for (int c = 0; c < 3; ++c)
+			meshCentroid[c] += position(source[i])[c];
+	for (int c = 0; c < 3; ++c)
+		meshCentroid[c] /= float(indexCount);
+
+	for (OverdrawCluster& cluster : clusters)
+	{
+		float centroid[3] = { 0.0f, 0.0f, 0.0f };
+		float normal[3] = { 0.0f, 0.0f, 0.0f };
+		float totalArea = 0.0f;
+
+		for (size_t t = cluster.firstTriangle; t < cluster.firstTriangle + cluster.triangleCount; ++t)
+		{
+			const float* p0 = position(source[t * 3 + 0]);
+			const float* p1 = position(source[t * 3 + 1]);
+			const float* p2 = position(source[t * 3 + 2]);
+
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]); // twice the area, doesn't matter here
+
+			for (int c = 0; c < 3; ++c)
+			{
+				centroid[c] += (p0[c] + p1[c] + p2[c]) * (area / 3.0f);
+				normal[c] += n[c];
+			}
+			totalArea += area;
+		}
+
+		float invArea = totalArea > 0.0f ? 1.0f / totalArea : 0.0f;
+		float normalLength = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		float invNormal = normalLength > 0.0f ? 1.0f / normalLength : 0.0f;
+
+		cluster.sortKey = 0.0f;
+		for (int c = 0; c < 3; ++c)
+			cluster.sortKey += (centroid[c] * invArea - meshCentroid[c]) * (normal[c] * invNormal);
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(),
+		[](const OverdrawCluster& a, const OverdrawCluster& b) { return a.sortKey > b.sortKey; });
+
+	size_t out = 0;
+	for (const OverdrawCluster& cluster : clusters)
+	{
+		memcpy(dst + out, source.data() + cluster.firstTriangle * 3, cluster.triangleCount * 3 * sizeof(uint32_t));
+		out += cluster.triangleCount * 3;
+	}
+}
+
+size_t optimizeVertexFetch(void* dstVertices, uint32_t* indices, size_t indexCount, const void* vertices, size_t vertexCount, size_t vertexSize)
+{
+	const uint32_t UNUSED = ~0u;
+	std::vector<uint32_t> remap(vertexCount, UNUSED);
+
+	unsigned char* out = static_cast<unsigned char*>(dstVertices);
+	const unsigned char* in = static_cast<const unsigned char*>(vertices);
+
+	// dstVertices and vertices can't overlap, we copy as we go.
+	uint32_t next = 0;
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		uint32_t v = indices[i];
+		if (remap[v] == UNUSED)
+		{
+			memcpy(out + size_t(next) * vertexSize, in + size_t(v) * vertexSize, vertexSize);
+			remap[v] = next++;
+		}
+		indices[i] = remap[v];
+	}
+
+	return next;
+}
+
+namespace
+{
+	// symmetric 4x4 error quadric, upper triangle, plus the total weight so errors come out as a mean.
+	struct Quadric
+	{
+		double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+		double a11 = 0, a12 = 0, a13 = 0;
+		double a22 = 0, a23 = 0;
+		double a33 = 0;
+		double weight = 0;
+
+		void addPlane(double nx, double ny, double nz, double d, double w)
+		{
+			a00 += w * nx * nx; a01 += w * nx * ny; a02 += w * nx * nz; a03 += w * nx * d;
+			a11 += w * ny * ny; a12 += w * ny * nz; a13 += w * ny * d;
+			a22 += w * nz * nz; a23 += w * nz * d;
+			a33 += w * d * d;
+			weight += w;
+		}
+
+		void add(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+			a11 += q.a11; a12 += q.a12; a13 += q.a13;
+			a22 += q.a22; a23 += q.a23;
+			a33 += q.a33;
+			weight += q.weight;
+		}
+
+		// mean squared distance from p to the planes that went in.
+		double error(const float* p) const
+		{
+			double x = p[0], y = p[1], z = p[2];
+			double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+				+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+				+ a22 * z * z + 2 * a23 * z
+				+ a33;
+			return weight > 0 ? std::fabs(e) / weight : 0.0;
+		}
+	};
+
+	struct Collapse
+	{
+		double cost;
+		uint32_t from;
+		uint32_t to;
+	};
+
+	inline void triangleNormal(const float* a, const float* b, const float* c, float* n)
+	{
+		float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+
+	inline uint64_t edgeKey(uint32_t a, uint32_t b)
+	{
+		return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+	}
+}
+
+size_t simplifyMesh(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+	size_t positionStride, size_t targetIndexCount, float targetError, float* resultError)
+{
+	assert(indexCount % 3 == 0);
+
+	auto position = [&](uint32_t v) { return reinterpret_cast<const float*>(reinterpret_cast<const unsigned char*>(positions) + size_t(v) * positionStride); };
+
+	std::vector<uint32_t> result(indices, indices + indexCount);
+	if (resultError)
+		*resultError = 0.0f;
+
+	// weld by position only. Copies of the same position (seams) share one quadric and are locked in place.
+	std::vector<float> packedPositions(vertexCount * 3);
+	for (size_t v = 0; v < vertexCount; ++v)
+		memcpy(&packedPositions[v * 3], position(static_cast<uint32_t>(v)), sizeof(float) * 3);
+
+	std::vector<uint32_t> positionId;
+	size_t positionCount = generateVertexRemap(positionId, packedPositions.data(), vertexCount, sizeof(float) * 3);
+
+	std::vector<uint32_t> copies(positionCount, 0);
+	std::vector<bool> referenced(vertexCount, false);
+	for (uint32_t index : result)
+		referenced[index] = true;
+	for (size_t v = 0; v < vertexCount; ++v)
+		if (referenced[v])
+			++copies[positionId[v]];
+
+	std::vector<bool> locked(positionCount, false);
+	for (size_t p = 0; p < positionCount; ++p)
+		locked[p] = copies[p] > 1;
+
+	// open and non manifold edges (by position) lock both ends too.
+	{
+		std::unordered_map<uint64_t, uint32_t> edgeUse;
+		edgeUse.reserve(indexCount);
+		for (size_t i = 0; i < indexCount; i += 3)
+			for (int k = 0; k < 3; ++k)
+				++edgeUse[edgeKey(positionId[result[i + k]], positionId[result[i + (k + 1) % 3]])];
+
+		for (const auto& edge : edgeUse)
+		{
+			if (edge.second != 2)
+			{
+				locked[uint32_t(edge.first >> 32)] = true;
+				locked[uint32_t(edge.first & 0xffffffffu)] = true;
+			}
+		}
+	}
+
+	// area weighted plane quadrics around each position.
+	std::vector<Quadric> quadrics(positionCount);
+	for (size_t i = 0; i < indexCount; i += 3)
+	{
+		const float* p0 = position(result[i + 0]);
+		float n[3];
+		triangleNormal(p0, position(result[i + 1]), position(result[i + 2]), n);
+		double length = std::sqrt(double(n[0]) * n[0] + double(n[1]) * n[1] + double(n[2]) * n[2]);
+		if (length == 0.0)
+			continue;
+
+		double nx = n[0] / length, ny = n[1] / length, nz = n[2] / length;
+		double d = -(nx * p0[0] + ny * p0[1] + nz * p0[2]);
+		for (int k = 0; k < 3; ++k)
+			quadrics[positionId[result[i + k]]].addPlane(nx, ny, nz, d, length * 0.5);
+	}
+
+	double errorLimit = double(targetError) * targetError;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<uint32_t> triangleOffsets(vertexCount + 1);
+	std::vector<uint32_t> vertexTriangles;
+	std::vector<bool> touched(vertexCount);
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> neighboursFrom, neighboursTo;
+
+	// each pass collapses a batch of cheap, independent edges, then rebuilds the index buffer.
+	while (result.size() > targetIndexCount)
+	{
+		size_t triangleCount = result.size() / 3;
+
+		// vertex -> triangle adjacency for this pass.
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (uint32_t index : result)
+			++triangleOffsets[index + 1];
+		for (size_t v = 0; v < vertexCount; ++v)
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		vertexTriangles.resize(result.size());
+		{
+			std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+			for (size_t i = 0; i < result.size(); ++i)
+				vertexTriangles[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t from = result[i + k];
+				uint32_t to = result[i + (k + 1) % 3];
+				if (locked[positionId[from]])
+					continue;
+
+				Quadric q = quadrics[positionId[from]];
+				q.add(quadrics[positionId[to]]);
+				collapses.push_back({ q.error(position(to)), from, to });
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		for (size_t v = 0; v < vertexCount; ++v)
+			remap[v] = static_cast<uint32_t>(v);
+		std::fill(touched.begin(), touched.end(), false);
+
+		size_t removedTriangles = 0;
+		size_t targetTriangles = targetIndexCount / 3;
+		size_t collapsed = 0;
+
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapse.cost > errorLimit || triangleCount - removedTriangles <= targetTriangles)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			uint32_t from = collapse.from, to = collapse.to;
+
+			// link condition: from and to can only share the two vertices across the edge, or we'd pinch the mesh.
+			neighboursFrom.clear();
+			neighboursTo.clear();
+			for (uint32_t t = triangleOffsets[from]; t < triangleOffsets[from + 1]; ++t)
+				for (int k = 0; k < 3; ++k)
+					neighboursFrom.push_back(positionId[result[vertexTriangles[t] * 3 + k]]);
+			for (uint32_t t = triangleOffsets[to]; t < triangleOffsets[to + 1]; ++t)
+				for (int k = 0; k < 3; ++k)
+					neighboursTo.push_back(positionId[result[vertexTriangles[t] * 3 + k]]);
+			std::sort(neighboursFrom.begin(), neighboursFrom.end());
+			neighboursFrom.erase(std::unique(neighboursFrom.begin(), neighboursFrom.end()), neighboursFrom.end());
+			std::sort(neighboursTo.begin(), neighboursTo.end());
+			neighboursTo.erase(std::unique(neighboursTo.begin(), neighboursTo.end()), neighboursTo.end());
+
+			size_t shared = 0;
+			for (size_t a = 0, b = 0; a < neighboursFrom.size() && b < neighboursTo.size();)
+			{
+				if (neighboursFrom[a] < neighboursTo[b])
+					++a;
+				else if (neighboursTo[b] < neighboursFrom[a])
+					++b;
+				else
+				{
+					++shared;
+					++a;
+					++b;
+				}
+			}
+			// shared includes from and to themselves.
+			if (shared > 4)
+				continue;
+
+			// no triangle around from is allowed to flip (or collapse to nothing) once from moves onto to.
+			bool flips = false;
+			size_t edgeTriangles = 0;
+			for (uint32_t t = triangleOffsets[from]; t < triangleOffsets[from + 1] && !flips; ++t)
+			{
+				const uint32_t* tri = &result[vertexTriangles[t] * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+				{
+					++edgeTriangles;
+					continue;
+				}
+
+				const float* corners[3];
+				const float* moved[3];
+				for (int k = 0; k < 3; ++k)
+				{
+					corners[k] = position(tri[k]);
+					moved[k] = tri[k] == from ? position(to) : corners[k];
+				}
+
+				float before[3], after[3];
+				triangleNormal(corners[0], corners[1], corners[2], before);
+				triangleNormal(moved[0], moved[1], moved[2], after);
+				float dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+				float beforeLength = std::sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]);
+				float afterLength = std::sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+				// needs to keep pointing within ~75 degrees of where it did.
+				flips = dot <= 0.25f * beforeLength * afterLength;
+			}
+			if (flips)
+				continue;
+
+			remap[from] = to;
+			quadrics[positionId[to]].add(quadrics[positionId[from]]);
+			removedTriangles += edgeTriangles;
+			++collapsed;
+			if (resultError)
+				*resultError = std::max(*resultError, static_cast<float>(std::sqrt(collapse.cost)));
+
+			// everything around from changed shape, leave it alone for the rest of this pass.
+			touched[to] = true;
+			for (uint32_t t = triangleOffsets[from]; t < triangleOffsets[from + 1]; ++t)
+				for (int k = 0; k < 3; ++k)
+					touched[result[vertexTriangles[t] * 3 + k]] = true;
+		}
+
+		if (collapsed == 0)
+			break;
+
+		// apply and drop the triangles that collapsed.
+		size_t out = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			result[out++] = a;
+			result[out++] = b;
+			result[out++] = c;
+		}
+		result.resize(out);
+	}
+
+	std::copy(result.begin(), result.end(), dst);
+	return result.size();
+}
@@ -0,0 +1,57 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Indexed mesh build stage. Everything works on raw vertex bytes + uint32 indices so it doesn't care what the
+// vertex layout is, as long as it's plain old data with no padding (hashing / comparing goes byte by byte).
+//
+// Usual order: weld (generateVertexRemap + remap*), optimizeVertexCache, optimizeOverdraw, optimizeVertexFetch.
+
+// cache size we simulate when measuring, and that the overdraw pass tries not to make worse.
+const size_t VERTEX_CACHE_SIZE = 16;
+
+// post transform cache numbers for an index buffer (FIFO cache of cacheSize entries).
+struct VertexCacheStats
+{
+	size_t vertexCount = 0;
+	size_t indexCount = 0;
+	size_t transformedVertices = 0; // cache misses
+	double acmr = 0.0; // average cache miss ratio: misses per triangle, 0.5 is the best you can do, 3 is the worst
+	double atvr = 0.0; // average transformed vertex ratio: misses per unique vertex, 1 is perfect
+};
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Hash based welding. Fills remap[i] with the new index for vertex i, where binary identical vertices share an index.
+// New indices are handed out in order of first appearance. Returns the number of unique vertices.
+size_t generateVertexRemap(std::vector<uint32_t>& remap, const void* vertices, size_t vertexCount, size_t vertexSize);
+
+// apply a remap. The vertex version writes each unique vertex once (dst needs room for the unique count).
+void remapVertexBuffer(void* dst, const void* vertices, size_t vertexCount, size_t vertexSize, const std::vector<uint32_t>& remap);
+void remapIndexBuffer(uint32_t* dst, const uint32_t* indices, size_t indexCount, const std::vector<uint32_t>& remap);
+
+// Forsyth's "linear speed vertex cache optimisation". Reorders triangles so they reuse recently transformed vertices.
+void optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+// Reorders clusters of triangles (from a cache optimized index buffer) so the ones facing outwards draw first,
+// which cuts overdraw. Only splits the buffer where it won't push the ACMR past threshold * the current ACMR.
+// positions points at the first float of the first vertex's position, positionStride is the vertex size in bytes.
+void optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+	size_t positionStride, float threshold = 1.05f);
+
+// Reorders the vertex buffer into the order the index buffer first touches vertices, and rewrites the indices to
+// match, so fetches walk memory forwards. Unreferenced vertices get dropped. Returns the new vertex count.
+size_t optimizeVertexFetch(void* dstVertices, uint32_t* indices, size_t indexCount, const void* vertices, size_t vertexCount, size_t vertexSize);
+
+// Quadric error edge collapse simplification (Garland & Heckbert '97). Vertices only ever collapse onto one of their
+// neighbours, so the result indexes the same vertex buffer as the input. Vertices whose position is shared with
+// another vertex (uv / normal seams) or that sit on an open or non manifold edge never move, so seams don't tear.
+// Stops at targetIndexCount, or when the cheapest collapse left would move the surface more than targetError
+// (object space distance). Returns the new index count, and the largest error it accepted in resultError.
+size_t simplifyMesh(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+	size_t positionStride, size_t targetIndexCount, float targetError, float* resultError = nullptr);
+
+#endif // !MESH_OPTIMIZER_H
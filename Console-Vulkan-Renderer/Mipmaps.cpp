@@ -0,0 +1,157 @@
+#include "Mipmaps.h"
+#include "ParallelFor.h"
+#include "Tracer.h"
+#include <algorithm>
+#include <cmath>
+
+// glm's SSE helpers, same deal as MeshKernels.cpp: intrinsics are only switched on in this file.
+#define GLM_FORCE_INTRINSICS
+#include <glm/detail/setup.hpp>
+#include <glm/simd/common.h>
+
+namespace
+{
+	// below this many rows a level isn't worth waking threads for.
+	const uint32_t MIP_ROWS_PER_JOB = 32;
+
+	// 12 bits of linear precision is enough that every sRGB byte survives the round trip.
+	const int LINEAR_TO_SRGB_SIZE = 4096;
+
+	struct SrgbTables
+	{
+		float toLinear[256];
+		unsigned char fromLinear[LINEAR_TO_SRGB_SIZE];
+
+		SrgbTables()
+		{
+			for (int i = 0; i < 256; ++i)
+			{
+				float c = i / 255.0f;
+				toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			for (int i = 0; i < LINEAR_TO_SRGB_SIZE; ++i)
+			{
+				float l = i / float(LINEAR_TO_SRGB_SIZE - 1);
+				float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+				fromLinear[i] = static_cast<unsigned char>(std::min(255.0f, c * 255.0f + 0.5f));
+			}
+		}
+	};
+
+	const SrgbTables& srgbTables()
+	{
+		static const SrgbTables tables;
+		return tables;
+	}
+
+	// one row of the next level down. above / below are the two source rows it covers.
+	void filterRow(unsigned char* out, const unsigned char* above, const unsigned char* below, uint32_t width)
+	{
+		const SrgbTables& tables = srgbTables();
+		const float* toLinear = tables.toLinear;
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+		// rgb through the sRGB table, alpha is already linear. Then all four channels of the 2x2 at once.
+		auto load = [toLinear](const unsigned char* texel)
+		{
+			return _mm_setr_ps(toLinear[texel[0]], toLinear[texel[1]], toLinear[texel[2]], texel[3] * (1.0f / 255.0f));
+		};
+		const glm_vec4 quarter = _mm_set1_ps(0.25f);
+		const glm_vec4 scale = _mm_setr_ps(LINEAR_TO_SRGB_SIZE - 1.0f, LINEAR_TO_SRGB_SIZE - 1.0f, LINEAR_TO_SRGB_SIZE - 1.0f, 255.0f);
+		const glm_vec4 half = _mm_set1_ps(0.5f);
+
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const unsigned char* a = above + 8 * x;
+			const unsigned char* b = below + 8 * x;
+			glm_vec4 sum = glm_vec4_add(glm_vec4_add(load(a), load(a + 4)), glm_vec4_add(load(b), load(b + 4)));
+
+			// rounded table index for rgb, the byte itself for alpha.
+			alignas(16) int32_t index[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_cvttps_epi32(glm_vec4_add(glm_vec4_mul(glm_vec4_mul(sum, quarter), scale), half)));
+			out[4 * x + 0] = tables.fromLinear[index[0]];
+			out[4 * x + 1] = tables.fromLinear[index[1]];
+			out[4 * x + 2] = tables.fromLinear[index[2]];
+			out[4 * x + 3] = static_cast<unsigned char>(index[3]);
+		}
+#else
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const unsigned char* a = above + 8 * x;
+			const unsigned char* b = below + 8 * x;
+			for (int c = 0; c < 3; ++c)
+			{
+				float linear = (toLinear[a[c]] + toLinear[a[c + 4]] + toLinear[b[c]] + toLinear[b[c + 4]]) * 0.25f;
+				out[4 * x + c] = tables.fromLinear[static_cast<int>(linear * (LINEAR_TO_SRGB_SIZE - 1) + 0.5f)];
+			}
+			out[4 * x + 3] = static_cast<unsigned char>((a[3] + a[7] + b[3] + b[7] + 2) / 4);
+		}
+#endif
+	}
+}
+
+uint32_t mipLevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	for (uint32_t side = std::max(width, height); side > 1; side /= 2)
+		++levels;
+	return levels;
+}
+
+size_t layoutMipChain(uint32_t width, uint32_t height, std::vector<MipLevel>& levels)
+{
+	levels.resize(mipLevelCount(width, height));
+	size_t offset = 0;
+	for (MipLevel& level : levels)
+	{
+		level = { offset, width, height };
+		offset += size_t(width) * height * 4;
+		width = std::max(1u, width / 2);
+		height = std::max(1u, height / 2);
+	}
+	return offset;
+}
+
+void generateMipChain(unsigned char* chain, const std::vector<MipLevel>& levels, unsigned threadCount)
+{
+	TRACE_FUNCTION();
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 1; i < levels.size(); ++i)
+	{
+		const MipLevel& source = levels[i - 1];
+		const MipLevel& level = levels[i];
+		size_t sourcePitch = size_t(source.width) * 4;
+
+		// a side that's already 1 stays 1, so both source texels / rows are the same one.
+		size_t stepX = source.width > 1 ? 4 : 0;
+		size_t stepY = source.height > 1 ? sourcePitch : 0;
+
+		auto filterRows = [&](size_t job)
+		{
+			uint32_t firstRow = static_cast<uint32_t>(job) * MIP_ROWS_PER_JOB;
+			uint32_t lastRow = std::min(level.height, firstRow + MIP_ROWS_PER_JOB);
+			for (uint32_t y = firstRow; y < lastRow; ++y)
+			{
+				const unsigned char* above = chain + source.offset + (size_t(y) * 2) * sourcePitch;
+				unsigned char* out = chain + level.offset + size_t(y) * level.width * 4;
+				if (stepX)
+					filterRow(out, above, above + stepY, level.width);
+				else
+				{
+					// 1 texel wide source: make the 2 texel rows filterRow wants out of it.
+					unsigned char pairs[16];
+					std::copy(above, above + 4, pairs);
+					std::copy(above, above + 4, pairs + 4);
+					std::copy(above + stepY, above + stepY + 4, pairs + 8);
+					std::copy(above + stepY, above + stepY + 4, pairs + 12);
+					filterRow(out, pairs, pairs + 8, 1);
+				}
+			}
+		};
+
+		size_t jobCount = (level.height + MIP_ROWS_PER_JOB - 1) / MIP_ROWS_PER_JOB;
+		parallelFor(jobCount, threadCount, "mip worker", filterRows);
+	}
+}
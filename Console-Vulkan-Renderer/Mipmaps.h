@@ -0,0 +1,30 @@
+#ifndef MIPMAPS_H
+#define MIPMAPS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CPU side of texture mip chains, for RGBA8 sRGB textures. The renderer blits its mips on the GPU when the format
+// can be linearly filtered, and falls back to generateMipChain otherwise.
+
+// where one level sits in a packed chain: level 0 first, each one straight after the one before.
+struct MipLevel
+{
+	size_t offset; // bytes
+	uint32_t width;
+	uint32_t height;
+};
+
+// levels down to 1x1: floor(log2(max side)) + 1.
+uint32_t mipLevelCount(uint32_t width, uint32_t height);
+
+// fills levels for a full chain of 4 byte texels and returns the bytes the whole chain takes.
+size_t layoutMipChain(uint32_t width, uint32_t height, std::vector<MipLevel>& levels);
+
+// chain is laid out by layoutMipChain with level 0 already in it. Builds every other level from the one above with a
+// 2x2 box filter, averaging in linear space (alpha as is) the way a blit on an sRGB format does. Odd sizes drop the
+// last row / column. Rows get split across threadCount threads, 0 means one per hardware thread.
+void generateMipChain(unsigned char* chain, const std::vector<MipLevel>& levels, unsigned threadCount = 0);
+
+#endif // !MIPMAPS_H
@@ -0,0 +1,897 @@
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "FrameStats.h"
+#include "MeshKernels.h"
+#include "ParallelFor.h"
+#include "Tracer.h"
+#include <tiny_obj_loader.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+	// don't bother splitting below this, the threads cost more than the parsing.
+	const size_t MIN_CHUNK_SIZE = 256 * 1024;
+	// chunks per thread, so one slow chunk doesn't leave everyone else waiting.
+	const size_t CHUNKS_PER_THREAD = 8;
+
+	// a negative (relative) index that was resolved against this chunk's counts only. Gets the counts of every
+	// chunk before it added during the merge.
+	struct ObjFixup
+	{
+		uint32_t corner;
+		uint8_t component; // 0 vertex, 1 texcoord, 2 normal
+	};
+
+	// a g / o / usemtl line. Everything after it until the next one belongs to that shape or material.
+	struct ObjGroupEvent
+	{
+		uint32_t face; // faces in the chunk before this line
+		bool material; // usemtl, otherwise g / o
+		std::string name;
+		size_t index = 0; // where it lands in the chunk's triangulated indices
+	};
+
+	struct ObjChunk
+	{
+		const char* begin;
+		const char* end;
+
+		std::vector<float> positions;
+		std::vector<float> texcoords;
+		std::vector<float> normals;
+		std::vector<ObjIndex> corners; // every face corner, faces back to back
+		std::vector<uint32_t> faceSizes;
+		std::vector<ObjFixup> fixups;
+		std::vector<ObjGroupEvent> events;
+		std::vector<std::vector<std::string>> materialLibraries; // one entry per mtllib line, every file name on it
+
+		size_t lineCount = 0;
+		size_t errorLine = 0; // 1 based within the chunk, 0 if it parsed fine
+
+		// where this chunk's stuff goes in the merged arrays.
+		size_t positionBase = 0, texcoordBase = 0, normalBase = 0, triangleBase = 0;
+		size_t triangleCount = 0; // indices, really. Expected count until the chunk is triangulated, then the real one.
+	};
+
+	inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+	inline bool isDigit(char c) { return static_cast<unsigned>(c - '0') < 10u; }
+
+	inline void skipSpace(const char*& token, const char* end)
+	{
+		while (token < end && isSpace(*token))
+			++token;
+	}
+
+	// end of the current token, same as tinyobj's strcspn(token, " \t\r"), but bounded by the line.
+	inline const char* tokenEnd(const char* token, const char* end)
+	{
+		while (token < end && !isSpace(*token) && *token != '\r')
+			++token;
+		return token;
+	}
+
+	// tinyobj's tryParseDouble, arithmetic kept exactly the same so we produce the same bits.
+	// What makes it fast here is that there's no stream, no line copies and no strspn/strcspn.
+	// Leaves result alone if there's no number, and returns where it stopped reading.
+	const char* parseDouble(const char* s, const char* sEnd, double* result)
+	{
+		if (s >= sEnd)
+			return s;
+
+		double mantissa = 0.0;
+		int exponent = 0;
+		char sign = '+';
+		const char* curr = s;
+		int read = 0;
+		bool leadingDot = false;
+
+		if (*curr == '+' || *curr == '-')
+		{
+			sign = *curr++;
+			if (curr != sEnd && *curr == '.')
+				leadingDot = true;
+		}
+		else if (*curr == '.')
+			leadingDot = true;
+		else if (!isDigit(*curr))
+			return curr;
+
+		if (!leadingDot)
+		{
+			while (curr != sEnd && isDigit(*curr))
+			{
+				mantissa *= 10;
+				mantissa += static_cast<int>(*curr - '0');
+				++curr;
+				++read;
+			}
+			if (read == 0)
+				return curr;
+		}
+
+		if (curr != sEnd && *curr == '.')
+		{
+			static const double POW_LUT[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+			const int LUT_ENTRIES = sizeof(POW_LUT) / sizeof(POW_LUT[0]);
+
+			++curr;
+			read = 1;
+			while (curr != sEnd && isDigit(*curr))
+			{
+				mantissa += static_cast<int>(*curr - '0') * (read < LUT_ENTRIES ? POW_LUT[read] : std::pow(10.0, -read));
+				++read;
+				++curr;
+			}
+		}
+
+		if (curr != sEnd && (*curr == 'e' || *curr == 'E'))
+		{
+			++curr;
+			char expSign = '+';
+			if (curr != sEnd && (*curr == '+' || *curr == '-'))
+				expSign = *curr++;
+			else if (curr == sEnd || !isDigit(*curr))
+				return curr; // empty exponent isn't allowed
+
+			read = 0;
+			while (curr != sEnd && isDigit(*curr))
+			{
+				exponent *= 10;
+				exponent += static_cast<int>(*curr - '0');
+				++curr;
+				++read;
+			}
+			exponent *= (expSign == '+' ? 1 : -1);
+			if (read == 0)
+				return curr;
+		}
+
+		*result = (sign == '+' ? 1 : -1) * (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+		return curr;
+	}
+
+	inline float parseFloat(const char*& token, const char* end)
+	{
+		skipSpace(token, end);
+
+		// the number grammar never takes in a space or \r, so parsing up to the end of the line gives the same value
+		// as tinyobj's parse up to the end of the token. Saves walking every token twice.
+		double value = 0.0;
+		token = parseDouble(token, end, &value);
+		token = tokenEnd(token, end);
+		return static_cast<float>(value);
+	}
+
+	// atoi, bounded by the line.
+	inline int parseInt(const char* token, const char* end)
+	{
+		while (token < end && (isSpace(*token) || *token == '\r' || *token == '\n' || *token == '\v' || *token == '\f'))
+			++token;
+
+		bool negative = false;
+		if (token < end && (*token == '+' || *token == '-'))
+			negative = *token++ == '-';
+
+		int value = 0;
+		while (token < end && isDigit(*token))
+			value = value * 10 + (*token++ - '0');
+		return negative ? -value : value;
+	}
+
+	inline void skipIndex(const char*& token, const char* end)
+	{
+		while (token < end && *token != '/' && !isSpace(*token) && *token != '\r')
+			++token;
+	}
+
+	// one face corner: i, i/j, i//k or i/j/k. Relative indices get resolved against this chunk's counts and queued
+	// up for a fixup. False on a zero index, same as tinyobj.
+	bool parseCorner(const char*& token, const char* end, ObjChunk& chunk)
+	{
+		int counts[3] = {
+			static_cast<int>(chunk.positions.size() / 3),
+			static_cast<int>(chunk.texcoords.size() / 2),
+			static_cast<int>(chunk.normals.size() / 3)
+		};
+		int values[3] = { -1, -1, -1 };
+		uint32_t cornerIndex = static_cast<uint32_t>(chunk.corners.size());
+
+		auto fix = [&](int component) -> bool
+		{
+			int raw = parseInt(token, end);
+			skipIndex(token, end);
+			if (raw > 0)
+				values[component] = raw - 1;
+			else if (raw < 0)
+			{
+				values[component] = counts[component] + raw;
+				chunk.fixups.push_back({ cornerIndex, static_cast<uint8_t>(component) });
+			}
+			else
+				return false;
+			return true;
+		};
+
+		if (!fix(0))
+			return false;
+
+		if (token < end && *token == '/')
+		{
+			++token;
+			if (token < end && *token == '/')
+			{
+				++token;
+				if (!fix(2))
+					return false;
+			}
+			else
+			{
+				if (!fix(1))
+					return false;
+				if (token < end && *token == '/')
+				{
+					++token;
+					if (!fix(2))
+						return false;
+				}
+			}
+		}
+
+		chunk.corners.push_back({ values[0], values[1], values[2] });
+		return true;
+	}
+
+	// every whitespace separated token left on the line, joined with single spaces.
+	std::string joinNames(const char* token, const char* lineEnd)
+	{
+		std::string names;
+		while (true)
+		{
+			while (token < lineEnd && (isSpace(*token) || *token == '\r'))
+				++token;
+			if (token >= lineEnd)
+				break;
+			const char* end = tokenEnd(token, lineEnd);
+			if (!names.empty())
+				names += ' ';
+			names.append(token, end);
+			token = end;
+		}
+		return names;
+	}
+
+	void parseChunk(ObjChunk& chunk)
+	{
+		TRACE_ZONE("parseObjChunk");
+
+		const char* p = chunk.begin;
+		while (p < chunk.end)
+		{
+			// tinyobj ends a line at \n, \r or \r\n.
+			const char* lineEnd = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+			if (!lineEnd)
+				lineEnd = chunk.end;
+			// a lone \r ends a line too. Rare enough that checking the whole line for one afterwards is fine.
+			const char* carriageReturn = static_cast<const char*>(memchr(p, '\r', lineEnd - p));
+			if (carriageReturn)
+				lineEnd = carriageReturn;
+			const char* next = lineEnd;
+			if (next < chunk.end)
+				next += (*next == '\r' && next + 1 < chunk.end && next[1] == '\n') ? 2 : 1;
+
+			++chunk.lineCount;
+			const char* token = p;
+			p = next;
+
+			skipSpace(token, lineEnd);
+			size_t length = lineEnd - token;
+			if (length < 2)
+				continue;
+
+			if (token[0] == 'v' && isSpace(token[1]))
+			{
+				token += 2;
+				float x = parseFloat(token, lineEnd);
+				float y = parseFloat(token, lineEnd);
+				float z = parseFloat(token, lineEnd);
+				chunk.positions.push_back(x);
+				chunk.positions.push_back(y);
+				chunk.positions.push_back(z);
+			}
+			else if (length >= 3 && token[0] == 'v' && token[1] == 'n' && isSpace(token[2]))
+			{
+				token += 3;
+				float x = parseFloat(token, lineEnd);
+				float y = parseFloat(token, lineEnd);
+				float z = parseFloat(token, lineEnd);
+				chunk.normals.push_back(x);
+				chunk.normals.push_back(y);
+				chunk.normals.push_back(z);
+			}
+			else if (length >= 3 && token[0] == 'v' && token[1] == 't' && isSpace(token[2]))
+			{
+				token += 3;
+				float u = parseFloat(token, lineEnd);
+				float v = parseFloat(token, lineEnd);
+				chunk.texcoords.push_back(u);
+				chunk.texcoords.push_back(v);
+			}
+			else if (token[0] == 'f' && isSpace(token[1]))
+			{
+				token += 2;
+				skipSpace(token, lineEnd);
+
+				size_t firstCorner = chunk.corners.size();
+				while (token < lineEnd)
+				{
+					if (!parseCorner(token, lineEnd, chunk))
+					{
+						chunk.errorLine = chunk.lineCount;
+						return;
+					}
+					while (token < lineEnd && (isSpace(*token) || *token == '\r'))
+						++token;
+				}
+
+				chunk.faceSizes.push_back(static_cast<uint32_t>(chunk.corners.size() - firstCorner));
+			}
+			else if ((token[0] == 'g' || token[0] == 'o') && isSpace(token[1]))
+			{
+				// tinyobj joins every name on a g line with single spaces, so we do too.
+				token += 2;
+				chunk.events.push_back({ static_cast<uint32_t>(chunk.faceSizes.size()), false, joinNames(token, lineEnd) });
+			}
+			else if (length > 7 && memcmp(token, "usemtl", 6) == 0 && isSpace(token[6]))
+			{
+				token += 7;
+				skipSpace(token, lineEnd);
+				chunk.events.push_back({ static_cast<uint32_t>(chunk.faceSizes.size()), true, std::string(token, tokenEnd(token, lineEnd)) });
+			}
+			else if (length > 7 && memcmp(token, "mtllib", 6) == 0 && isSpace(token[6]))
+			{
+				token += 7;
+				std::vector<std::string> files;
+				std::string names = joinNames(token, lineEnd);
+				for (size_t start = 0, end; start < names.size(); start = end + 1)
+				{
+					end = std::min(names.find(' ', start), names.size());
+					files.push_back(names.substr(start, end - start));
+				}
+				if (!files.empty())
+					chunk.materialLibraries.push_back(files);
+			}
+		}
+	}
+
+	// an upper bound on the indices parseChunk + triangulateFace will make out of [begin, end): every whitespace
+	// separated token on an f line counts as a corner. Much cheaper than parsing, nothing gets converted.
+	size_t countFaceIndices(const char* begin, const char* end)
+	{
+		size_t indexCount = 0;
+		const char* p = begin;
+		while (p < end)
+		{
+			const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+			if (!lineEnd)
+				lineEnd = end;
+			const char* token = p;
+			p = lineEnd + 1;
+
+			skipSpace(token, lineEnd);
+			if (lineEnd - token < 2 || token[0] != 'f' || !isSpace(token[1]))
+				continue;
+
+			size_t corners = 0;
+			token += 2;
+			while (token < lineEnd)
+			{
+				skipSpace(token, lineEnd);
+				if (token < lineEnd && *token != '\r')
+					++corners;
+				while (token < lineEnd && !isSpace(*token))
+					++token;
+			}
+			if (corners >= 3)
+				indexCount += (corners - 2) * 3;
+		}
+		return indexCount;
+	}
+
+	// cut [data, data + size) into pieces of about chunkSize, each ending just after a line break so no line
+	// straddles two chunks.
+	std::vector<ObjChunk> splitAtLines(const char* data, size_t size, size_t chunkSize)
+	{
+		std::vector<ObjChunk> chunks;
+		size_t offset = 0;
+		while (offset < size)
+		{
+			size_t chunkEnd = std::min(size, offset + chunkSize);
+			while (chunkEnd < size && data[chunkEnd - 1] != '\n')
+				++chunkEnd;
+
+			ObjChunk chunk;
+			chunk.begin = data + offset;
+			chunk.end = data + chunkEnd;
+			chunks.push_back(std::move(chunk));
+			offset = chunkEnd;
+		}
+		return chunks;
+	}
+
+	// indices [begin, end) as one more run of shape / material, folded into the last run if that's the same one.
+	void addGroup(std::vector<ObjGroup>& groups, const std::string& shape, int material, size_t begin, size_t end)
+	{
+		if (end <= begin)
+			return;
+		if (!groups.empty() && groups.back().shape == shape && groups.back().material == material &&
+			groups.back().firstIndex + groups.back().indexCount == begin)
+			groups.back().indexCount += end - begin;
+		else
+			groups.push_back({ shape, material, begin, end - begin });
+	}
+
+	// same as tinyobj: the first file on the mtllib line that opens gets loaded, relative to the obj. Material
+	// names that are already taken keep their first definition.
+	void loadMaterialLibrary(const std::string& objPath, const std::vector<std::string>& files, std::vector<ObjMaterial>& materials,
+		std::map<std::string, int>& materialIds)
+	{
+		std::string directory = objPath.substr(0, objPath.find_last_of("/\\") + 1);
+		for (const std::string& file : files)
+		{
+			std::ifstream stream(directory + file);
+			if (!stream)
+				continue;
+
+			std::vector<tinyobj::material_t> loaded;
+			std::map<std::string, int> loadedIds;
+			std::string warn, err;
+			tinyobj::LoadMtl(&loadedIds, &loaded, &stream, &warn, &err);
+
+			for (const tinyobj::material_t& source : loaded)
+			{
+				if (materialIds.count(source.name))
+					continue;
+				ObjMaterial material;
+				material.name = source.name;
+				std::copy(source.diffuse, source.diffuse + 3, material.diffuse);
+				if (!source.diffuse_texname.empty())
+					material.diffuseTexture = directory + source.diffuse_texname;
+				materialIds[material.name] = static_cast<int>(materials.size());
+				materials.push_back(material);
+			}
+			return;
+		}
+	}
+
+	// tinyobj's pnpoly.
+	bool pointInTriangle(const float* vx, const float* vy, float tx, float ty)
+	{
+		bool inside = false;
+		for (int i = 0, j = 2; i < 3; j = i++)
+		{
+			if (((vy[i] > ty) != (vy[j] > ty)) && (tx < (vx[j] - vx[i]) * (ty - vy[i]) / (vy[j] - vy[i]) + vx[i]))
+				inside = !inside;
+		}
+		return inside;
+	}
+
+	// Triangulates one face the way tinyobj does (exportGroupsToShape with triangulate on): ear clipping in the
+	// plane the polygon is most facing. Triangles just go straight through. remaining is scratch space, passed in so
+	// we don't allocate per face. Writes at most (cornerCount - 2) * 3 indices to out, returns the end of what it wrote.
+	ObjIndex* triangulateFace(const ObjIndex* face, size_t cornerCount, const std::vector<float>& v, std::vector<ObjIndex>& remaining,
+		ObjIndex* out)
+	{
+		if (cornerCount < 3)
+			return out;
+		if (cornerCount == 3)
+			return std::copy(face, face + 3, out);
+
+		auto inRange = [&](int index, size_t component) { return size_t(index) * 3 + component < v.size(); };
+
+		// find the two axes to work in
+		size_t axes[2] = { 1, 2 };
+		for (size_t k = 0; k < cornerCount; ++k)
+		{
+			size_t vi0 = size_t(face[(k + 0) % cornerCount].vertex);
+			size_t vi1 = size_t(face[(k + 1) % cornerCount].vertex);
+			size_t vi2 = size_t(face[(k + 2) % cornerCount].vertex);
+			if (vi0 * 3 + 2 >= v.size() || vi1 * 3 + 2 >= v.size() || vi2 * 3 + 2 >= v.size())
+				continue;
+
+			float e0x = v[vi1 * 3 + 0] - v[vi0 * 3 + 0];
+			float e0y = v[vi1 * 3 + 1] - v[vi0 * 3 + 1];
+			float e0z = v[vi1 * 3 + 2] - v[vi0 * 3 + 2];
+			float e1x = v[vi2 * 3 + 0] - v[vi1 * 3 + 0];
+			float e1y = v[vi2 * 3 + 1] - v[vi1 * 3 + 1];
+			float e1z = v[vi2 * 3 + 2] - v[vi1 * 3 + 2];
+			float cx = std::fabs(e0y * e1z - e0z * e1y);
+			float cy = std::fabs(e0z * e1x - e0x * e1z);
+			float cz = std::fabs(e0x * e1y - e0y * e1x);
+			const float epsilon = std::numeric_limits<float>::epsilon();
+			if (cx > epsilon || cy > epsilon || cz > epsilon)
+			{
+				// found a corner
+				if (!(cx > cy && cx > cz))
+				{
+					axes[0] = 0;
+					if (cz > cx && cz > cy)
+						axes[1] = 1;
+				}
+				break;
+			}
+		}
+
+		float area = 0.0f;
+		for (size_t k = 0; k < cornerCount; ++k)
+		{
+			int vi0 = face[(k + 0) % cornerCount].vertex;
+			int vi1 = face[(k + 1) % cornerCount].vertex;
+			if (!inRange(vi0, axes[0]) || !inRange(vi0, axes[1]) || !inRange(vi1, axes[0]) || !inRange(vi1, axes[1]))
+				continue;
+
+			float v0x = v[size_t(vi0) * 3 + axes[0]];
+			float v0y = v[size_t(vi0) * 3 + axes[1]];
+			float v1x = v[size_t(vi1) * 3 + axes[0]];
+			float v1y = v[size_t(vi1) * 3 + axes[1]];
+			area += (v0x * v1y - v0y * v1x) * 0.5f;
+		}
+
+		remaining.assign(face, face + cornerCount);
+		size_t guess = 0;
+		size_t remainingIterations = cornerCount;
+		size_t previousRemaining = cornerCount;
+
+		while (remaining.size() > 3 && remainingIterations > 0)
+		{
+			size_t count = remaining.size();
+			if (guess >= count)
+				guess -= count;
+
+			if (previousRemaining != count)
+			{
+				// we clipped an ear last time round, reset the counters.
+				previousRemaining = count;
+				remainingIterations = count;
+			}
+			else
+				--remainingIterations;
+
+			ObjIndex ear[3];
+			float vx[3], vy[3];
+			for (size_t k = 0; k < 3; ++k)
+			{
+				ear[k] = remaining[(guess + k) % count];
+				int vi = ear[k].vertex;
+				if (!inRange(vi, axes[0]) || !inRange(vi, axes[1]))
+				{
+					vx[k] = 0.0f;
+					vy[k] = 0.0f;
+				}
+				else
+				{
+					vx[k] = v[size_t(vi) * 3 + axes[0]];
+					vy[k] = v[size_t(vi) * 3 + axes[1]];
+				}
+			}
+
+			float e0x = vx[1] - vx[0];
+			float e0y = vy[1] - vy[0];
+			float e1x = vx[2] - vx[1];
+			float e1y = vy[2] - vy[1];
+			float cross = e0x * e1y - e0y * e1x;
+			// reflex corner, can't clip it.
+			if (cross * area < 0.0f)
+			{
+				++guess;
+				continue;
+			}
+
+			// no other corner can be inside the ear.
+			bool overlap = false;
+			for (size_t other = 3; other < count; ++other)
+			{
+				int ovi = remaining[(guess + other) % count].vertex;
+				if (!inRange(ovi, axes[0]) || !inRange(ovi, axes[1]))
+					continue;
+				if (pointInTriangle(vx, vy, v[size_t(ovi) * 3 + axes[0]], v[size_t(ovi) * 3 + axes[1]]))
+				{
+					overlap = true;
+					break;
+				}
+			}
+
+			if (overlap)
+			{
+				++guess;
+				continue;
+			}
+
+			out = std::copy(ear, ear + 3, out);
+			remaining.erase(remaining.begin() + (guess + 1) % count);
+		}
+
+		if (remaining.size() == 3)
+			out = std::copy(remaining.begin(), remaining.end(), out);
+		return out;
+	}
+}
+
+void loadObjParallel(const std::string& path, ObjMesh& mesh, unsigned threadCount, ObjLoadStats* stats)
+{
+	TRACE_FUNCTION();
+	StatClock::time_point start = StatClock::now();
+
+	MappedFile file(path);
+	const char* data = file.data();
+	size_t size = file.size();
+
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<ObjChunk> chunks = splitAtLines(data, size, std::max(MIN_CHUNK_SIZE, size / (size_t(threadCount) * CHUNKS_PER_THREAD) + 1));
+
+	parallelFor(chunks.size(), threadCount, "obj worker", [&](size_t i) { parseChunk(chunks[i]); });
+	StatClock::time_point parsed = StatClock::now();
+
+	// report the first bad line in the file, with a file wide line number.
+	size_t linesBefore = 0;
+	for (const ObjChunk& chunk : chunks)
+	{
+		if (chunk.errorLine)
+			throw std::runtime_error("Failed parse `f' line(e.g. zero value for face index. line " + std::to_string(linesBefore + chunk.errorLine) + ".)");
+		linesBefore += chunk.lineCount;
+	}
+
+	// prefix sums over the attribute counts.
+	size_t positionCount = 0, texcoordCount = 0, normalCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		chunk.positionBase = positionCount;
+		chunk.texcoordBase = texcoordCount;
+		chunk.normalBase = normalCount;
+		positionCount += chunk.positions.size();
+		texcoordCount += chunk.texcoords.size();
+		normalCount += chunk.normals.size();
+	}
+
+	mesh.positions.resize(positionCount);
+	mesh.texcoords.resize(texcoordCount);
+	mesh.normals.resize(normalCount);
+
+	// copy the attributes in and fix up relative indices, now that we know every chunk's base.
+	parallelFor(chunks.size(), threadCount, "obj worker", [&](size_t i)
+	{
+		ObjChunk& chunk = chunks[i];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.positions.begin() + chunk.positionBase);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), mesh.texcoords.begin() + chunk.texcoordBase);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), mesh.normals.begin() + chunk.normalBase);
+
+		for (const ObjFixup& fixup : chunk.fixups)
+		{
+			ObjIndex& corner = chunk.corners[fixup.corner];
+			if (fixup.component == 0)
+				corner.vertex += static_cast<int>(chunk.positionBase / 3);
+			else if (fixup.component == 1)
+				corner.texcoord += static_cast<int>(chunk.texcoordBase / 2);
+			else
+				corner.normal += static_cast<int>(chunk.normalBase / 3);
+		}
+	});
+
+	// a polygon with n corners clips into n - 2 triangles unless it's degenerate, so prefix sum that and have each
+	// chunk triangulate straight into its spot in the output.
+	size_t indexCount = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		size_t expected = 0;
+		for (uint32_t faceSize : chunk.faceSizes)
+			expected += faceSize >= 3 ? (faceSize - 2) * 3 : 0;
+
+		chunk.triangleBase = indexCount;
+		chunk.triangleCount = expected;
+		indexCount += expected;
+	}
+
+	mesh.indices.resize(indexCount);
+
+	// triangulating needs every position, so it waits for the copy above.
+	parallelFor(chunks.size(), threadCount, "obj worker", [&](size_t i)
+	{
+		ObjChunk& chunk = chunks[i];
+		ObjIndex* out = mesh.indices.data() + chunk.triangleBase;
+		ObjIndex* outEnd = out;
+		std::vector<ObjIndex> scratch;
+		const ObjIndex* face = chunk.corners.data();
+		size_t event = 0;
+		for (uint32_t f = 0; f < chunk.faceSizes.size(); ++f)
+		{
+			for (; event < chunk.events.size() && chunk.events[event].face == f; ++event)
+				chunk.events[event].index = outEnd - out;
+			outEnd = triangulateFace(face, chunk.faceSizes[f], mesh.positions, scratch, outEnd);
+			face += chunk.faceSizes[f];
+		}
+		for (; event < chunk.events.size(); ++event)
+			chunk.events[event].index = outEnd - out;
+		chunk.triangleCount = outEnd - out;
+	});
+
+	// close the gaps left by faces that clipped into fewer triangles than expected. Only moves anything on bad input.
+	size_t written = 0;
+	for (ObjChunk& chunk : chunks)
+	{
+		if (written != chunk.triangleBase)
+			std::copy(mesh.indices.begin() + chunk.triangleBase, mesh.indices.begin() + chunk.triangleBase + chunk.triangleCount,
+				mesh.indices.begin() + written);
+		chunk.triangleBase = written;
+		written += chunk.triangleCount;
+	}
+	mesh.indices.resize(written);
+
+	// materials first, usemtl lines get looked up in them. Tiny, so no point spreading it out.
+	std::map<std::string, int> materialIds;
+	for (const ObjChunk& chunk : chunks)
+		for (const std::vector<std::string>& files : chunk.materialLibraries)
+			loadMaterialLibrary(path, files, mesh.materials, materialIds);
+
+	// then the shape / material runs, in file order.
+	std::string shape;
+	int material = -1;
+	size_t runStart = 0;
+	for (const ObjChunk& chunk : chunks)
+	{
+		for (const ObjGroupEvent& event : chunk.events)
+		{
+			addGroup(mesh.groups, shape, material, runStart, chunk.triangleBase + event.index);
+			runStart = chunk.triangleBase + event.index;
+			if (event.material)
+			{
+				auto found = materialIds.find(event.name);
+				material = found != materialIds.end() ? found->second : -1;
+			}
+			else
+				shape = event.name;
+		}
+	}
+	addGroup(mesh.groups, shape, material, runStart, written);
+
+	if (stats)
+	{
+		StatClock::time_point end = StatClock::now();
+		stats->bytes = size;
+		stats->chunks = chunks.size();
+		stats->threads = threadCount;
+		stats->parseMs = elapsedMs(start, parsed);
+		stats->mergeMs = elapsedMs(parsed, end);
+		stats->totalMs = elapsedMs(start, end);
+	}
+}
+
+void generateMissingNormals(ObjMesh& mesh, std::vector<uint32_t>& positionRemap)
+{
+	bool missing = false;
+	for (const ObjIndex& index : mesh.indices)
+		missing = missing || index.normal < 0;
+	if (!missing)
+		return;
+
+	TRACE_FUNCTION();
+
+	// only the positions these triangles use, packed, so a chunk's worth of faces costs a chunk's worth of work
+	// however big the file they point back into is.
+	positionRemap.resize(mesh.positions.size() / 3, UINT32_MAX);
+	std::vector<uint32_t> used;
+	std::vector<float> positions;
+	std::vector<uint32_t> indices(mesh.indices.size());
+	for (size_t i = 0; i < mesh.indices.size(); ++i)
+	{
+		if (mesh.indices[i].vertex < 0 || static_cast<size_t>(mesh.indices[i].vertex) >= positionRemap.size())
+			throw std::runtime_error("Face points at a vertex that doesn't exist: " + std::to_string(mesh.indices[i].vertex + 1));
+		uint32_t& local = positionRemap[mesh.indices[i].vertex];
+		if (local == UINT32_MAX)
+		{
+			local = static_cast<uint32_t>(used.size());
+			used.push_back(mesh.indices[i].vertex);
+			positions.insert(positions.end(), &mesh.positions[3 * mesh.indices[i].vertex], &mesh.positions[3 * mesh.indices[i].vertex] + 3);
+		}
+		indices[i] = local;
+	}
+
+	size_t normalBase = mesh.normals.size() / 3;
+	mesh.normals.resize(mesh.normals.size() + positions.size());
+	generateNormals(&mesh.normals[normalBase * 3], positions.data(), used.size(), indices.data(), indices.size());
+
+	for (size_t i = 0; i < mesh.indices.size(); ++i)
+	{
+		if (mesh.indices[i].normal < 0)
+			mesh.indices[i].normal = static_cast<int>(normalBase + indices[i]);
+	}
+
+	// back to all unused for the next call.
+	for (uint32_t position : used)
+		positionRemap[position] = UINT32_MAX;
+}
+
+void ObjStreamReader::open(const std::string& path, unsigned threadCount)
+{
+	TRACE_FUNCTION();
+	mFile.open(path);
+	mOffset = 0;
+	mLineCount = 0;
+
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	// the count is a plain memchr walk, but it still touches the whole file, so spread it out.
+	std::vector<ObjChunk> chunks = splitAtLines(mFile.data(), mFile.size(), std::max(MIN_CHUNK_SIZE, mFile.size() / threadCount + 1));
+	std::vector<size_t> counts(chunks.size());
+	parallelFor(chunks.size(), threadCount, "obj worker", [&](size_t i) { counts[i] = countFaceIndices(chunks[i].begin, chunks[i].end); });
+
+	mIndexCount = 0;
+	for (size_t count : counts)
+		mIndexCount += count;
+}
+
+bool ObjStreamReader::next(ObjMesh& mesh, size_t chunkSize)
+{
+	TRACE_FUNCTION();
+	const char* data = mFile.data();
+	size_t size = mFile.size();
+	if (mOffset >= size)
+		return false;
+
+	size_t chunkEnd = std::min(size, mOffset + chunkSize);
+	while (chunkEnd < size && data[chunkEnd - 1] != '\n')
+		++chunkEnd;
+
+	ObjChunk chunk;
+	chunk.begin = data + mOffset;
+	chunk.end = data + chunkEnd;
+	mOffset = chunkEnd;
+
+	parseChunk(chunk);
+	if (chunk.errorLine)
+		throw std::runtime_error("Failed parse `f' line(e.g. zero value for face index. line " + std::to_string(mLineCount + chunk.errorLine) + ".)");
+	mLineCount += chunk.lineCount;
+
+	// same as the merge in loadObjParallel, except everything before this chunk is already in mesh.
+	int positionBase = static_cast<int>(mesh.positions.size() / 3);
+	int texcoordBase = static_cast<int>(mesh.texcoords.size() / 2);
+	int normalBase = static_cast<int>(mesh.normals.size() / 3);
+	mesh.positions.insert(mesh.positions.end(), chunk.positions.begin(), chunk.positions.end());
+	mesh.texcoords.insert(mesh.texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+	mesh.normals.insert(mesh.normals.end(), chunk.normals.begin(), chunk.normals.end());
+
+	for (const ObjFixup& fixup : chunk.fixups)
+	{
+		ObjIndex& corner = chunk.corners[fixup.corner];
+		if (fixup.component == 0)
+			corner.vertex += positionBase;
+		else if (fixup.component == 1)
+			corner.texcoord += texcoordBase;
+		else
+			corner.normal += normalBase;
+	}
+
+	size_t expected = 0;
+	for (uint32_t faceSize : chunk.faceSizes)
+		expected += faceSize >= 3 ? (faceSize - 2) * 3 : 0;
+
+	mesh.indices.resize(expected);
+	ObjIndex* out = mesh.indices.data();
+	const ObjIndex* face = chunk.corners.data();
+	for (uint32_t faceSize : chunk.faceSizes)
+	{
+		out = triangulateFace(face, faceSize, mesh.positions, mScratch, out);
+		face += faceSize;
+	}
+	mesh.indices.resize(out - mesh.indices.data());
+	return true;
+}
@@ -0,0 +1,102 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <cstddef>
+#include <cstdint>
+#include "MappedFile.h"
+#include <string>
+#include <vector>
+
+// Parallel OBJ loader. Memory maps the file, cuts it into chunks at line boundaries, parses the chunks on worker
+// threads and stitches the results together with prefix sums. v / vt / vn / f make the mesh, g / o / usemtl split it into
+// groups, and mtllib files get read with tinyobj's LoadMtl. Everything else (smoothing groups, lines...) gets skipped.
+//
+// The output matches what tinyobj::LoadObj gives loadModel: same float parsing, same index fixing, and the same
+// ear clipping for faces with more than 3 corners, so triangles come out in the same order with the same corners.
+
+// zero based like tinyobj::index_t, -1 when the face didn't give one.
+struct ObjIndex
+{
+	int vertex;
+	int texcoord;
+	int normal;
+};
+
+// what we keep out of an .mtl material.
+struct ObjMaterial
+{
+	std::string name;
+	float diffuse[3]; // Kd
+	std::string diffuseTexture; // map_Kd, already relative to the working directory. Empty if there isn't one.
+};
+
+// a run of triangles that share a shape (g / o) and a material (usemtl).
+struct ObjGroup
+{
+	std::string shape; // empty before the first g / o
+	int material; // index into ObjMesh::materials, -1 for none (no usemtl yet, or a name no mtllib had)
+	size_t firstIndex;
+	size_t indexCount;
+};
+
+struct ObjMesh
+{
+	std::vector<float> positions; // xyz
+	std::vector<float> texcoords; // uv
+	std::vector<float> normals; // xyz
+	std::vector<ObjIndex> indices; // 3 per triangle, file order
+	std::vector<ObjMaterial> materials; // from every mtllib, in the order they were read
+	std::vector<ObjGroup> groups; // covers every index, in file order. Neighbours with the same shape and material get merged.
+};
+
+struct ObjLoadStats
+{
+	size_t bytes = 0;
+	size_t chunks = 0;
+	unsigned threads = 0;
+	double parseMs = 0.0; // chunk parsing, all threads
+	double mergeMs = 0.0; // prefix sums, copies, fixups and triangulation
+	double totalMs = 0.0; // includes mapping the file
+};
+
+// threadCount 0 means one per hardware thread. Throws std::runtime_error on a file we can't read or a bad face.
+void loadObjParallel(const std::string& path, ObjMesh& mesh, unsigned threadCount = 0, ObjLoadStats* stats = nullptr);
+
+// Gives every corner in mesh.indices that has no vn a smooth, area weighted normal, out of the triangles in
+// mesh.indices that share its position. The generated normals get appended to mesh.normals. positionRemap is
+// scratch: pass the same one (empty the first time) for every chunk when streaming, so it isn't rebuilt per call.
+void generateMissingNormals(ObjMesh& mesh, std::vector<uint32_t>& positionRemap);
+
+// how much of the file ObjStreamReader::next parses per call by default.
+const size_t OBJ_STREAM_CHUNK_SIZE = 1024 * 1024;
+
+// Reads an OBJ front to back a chunk at a time, for drawing a model while the rest of it is still loading. Parsing
+// and triangulation are the same as loadObjParallel, just on one thread and in file order. Shapes and materials
+// aren't tracked, mesh.materials and mesh.groups stay empty.
+class ObjStreamReader
+{
+public:
+	// maps the file and counts the faces so the caller can size its buffers up front. threadCount is for the count
+	// only, 0 means one per hardware thread. Throws std::runtime_error if the file can't be read.
+	void open(const std::string& path, unsigned threadCount = 0);
+	void close() { mFile.close(); }
+
+	// indices the whole file triangulates into, at most. Only less on faces that don't clip cleanly.
+	size_t indexCount() const { return mIndexCount; }
+	size_t bytesRead() const { return mOffset; }
+	size_t size() const { return mFile.size(); }
+
+	// parses about chunkSize more bytes. Attributes get appended to mesh (faces can point back at anything before
+	// them), and mesh.indices is replaced with just this chunk's triangles. False once the whole file's been read.
+	// Throws std::runtime_error on a bad face, same as loadObjParallel.
+	bool next(ObjMesh& mesh, size_t chunkSize = OBJ_STREAM_CHUNK_SIZE);
+
+private:
+	MappedFile mFile;
+	size_t mOffset = 0;
+	size_t mLineCount = 0; // lines before mOffset, for error messages
+	size_t mIndexCount = 0;
+	std::vector<ObjIndex> mScratch; // triangulateFace's scratch
+};
+
+#endif // !OBJ_LOADER_H
@@ -0,0 +1,36 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include "Tracer.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// run fn(0..count-1) across threadCount threads (the calling thread is one of them). The extra threads show up in
+// traces as "<threadName> 1", "<threadName> 2"...
+template <typename Fn>
+void parallelFor(size_t count, unsigned threadCount, const char* threadName, const Fn& fn)
+{
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < count; i = next++)
+			fn(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < threadCount && t < count; ++t)
+		threads.emplace_back([&, t]()
+		{
+			if (Tracer::get().isEnabled())
+				Tracer::get().setThreadName(std::string(threadName) + " " + std::to_string(t));
+			worker();
+		});
+	worker();
+
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+#endif // !PARALLEL_FOR_H
@@ -0,0 +1,55 @@
+#include "SamplerCache.h"
+#include "MeshCache.h"
+#include <cstring>
+#include <stdexcept>
+
+static_assert(sizeof(SamplerKey) == 16 * 4, "SamplerKey has padding, it can't be hashed or compared as bytes");
+
+SamplerKey::SamplerKey(const VkSamplerCreateInfo& info)
+	: flags(info.flags)
+	, magFilter(info.magFilter), minFilter(info.minFilter), mipmapMode(info.mipmapMode)
+	, addressModeU(info.addressModeU), addressModeV(info.addressModeV), addressModeW(info.addressModeW)
+	, mipLodBias(info.mipLodBias)
+	, anisotropyEnable(info.anisotropyEnable)
+	, maxAnisotropy(info.anisotropyEnable ? info.maxAnisotropy : 0.0f) // ignored when it's off
+	, compareEnable(info.compareEnable)
+	, compareOp(info.compareEnable ? info.compareOp : 0) // same
+	, minLod(info.minLod), maxLod(info.maxLod)
+	, borderColor(info.borderColor)
+	, unnormalizedCoordinates(info.unnormalizedCoordinates)
+{
+}
+
+bool SamplerKey::operator==(const SamplerKey& other) const
+{
+	return memcmp(this, &other, sizeof(SamplerKey)) == 0;
+}
+
+size_t SamplerKeyHash::operator()(const SamplerKey& key) const
+{
+	return static_cast<size_t>(hashContent(&key, sizeof(key)));
+}
+
+VkSampler SamplerCache::get(VkDevice device, const VkSamplerCreateInfo& info)
+{
+	if (info.pNext)
+		throw std::runtime_error("sampler cache: pNext chains aren't part of the key");
+
+	SamplerKey key(info);
+	auto found = mSamplers.find(key);
+	if (found != mSamplers.end())
+		return found->second;
+
+	VkSampler sampler;
+	if (vkCreateSampler(device, &info, nullptr, &sampler) != VK_SUCCESS)
+		throw std::runtime_error("failed to create texture sampler!");
+	mSamplers.emplace(key, sampler);
+	return sampler;
+}
+
+void SamplerCache::destroyAll(VkDevice device)
+{
+	for (auto& entry : mSamplers)
+		vkDestroySampler(device, entry.second, nullptr);
+	mSamplers.clear();
+}
@@ -0,0 +1,51 @@
+#ifndef SAMPLER_CACHE_H
+#define SAMPLER_CACHE_H
+
+#include <vulkan/vulkan.h>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+// One VkSampler per distinct sampler state, however many textures / materials ask for it. Devices only allow
+// maxSamplerAllocationCount samplers (4000 on plenty of them), and most materials want one of a handful of states.
+//
+// Samplers live until destroyAll, they're tiny and there are never many. Main thread only.
+
+// every field of VkSamplerCreateInfo that changes the sampler, packed with no padding so it hashes as bytes.
+struct SamplerKey
+{
+	uint32_t flags;
+	uint32_t magFilter, minFilter, mipmapMode;
+	uint32_t addressModeU, addressModeV, addressModeW;
+	float mipLodBias;
+	uint32_t anisotropyEnable;
+	float maxAnisotropy;
+	uint32_t compareEnable, compareOp;
+	float minLod, maxLod;
+	uint32_t borderColor;
+	uint32_t unnormalizedCoordinates;
+
+	explicit SamplerKey(const VkSamplerCreateInfo& info);
+	bool operator==(const SamplerKey& other) const;
+};
+
+struct SamplerKeyHash
+{
+	size_t operator()(const SamplerKey& key) const;
+};
+
+class SamplerCache
+{
+public:
+	// the sampler for info's state, created the first time it's asked for. info can't have a pNext chain, nothing
+	// in one would be part of the key.
+	VkSampler get(VkDevice device, const VkSamplerCreateInfo& info);
+	void destroyAll(VkDevice device);
+
+	size_t size() const { return mSamplers.size(); }
+
+private:
+	std::unordered_map<SamplerKey, VkSampler, SamplerKeyHash> mSamplers;
+};
+
+#endif // !SAMPLER_CACHE_H
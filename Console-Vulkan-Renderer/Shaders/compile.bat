@@ -1,6 +1,8 @@
 C:\VulkanSDK\1.1.130.0\Bin32\glslangvalidator.exe -e shader.frag 
 
 C:\VulkanSDK\1.1.130.0\Bin32\glslc.exe shader.vert -o vert.spv
+C:\VulkanSDK\1.1.130.0\Bin32\glslc.exe -DCOMPACT_VERTEX shader.vert -o vert_compact.spv
 C:\VulkanSDK\1.1.130.0\Bin32\glslc.exe shader.frag -o frag.spv
+C:\VulkanSDK\1.1.130.0\Bin32\glslc.exe -DVIRTUAL_TEXTURE shader.frag -o frag_virtual.spv
 
 cmd /k
\ No newline at end of file
@@ -3,12 +3,61 @@
 
 layout(location = 0) out vec4 outColor;
 
-layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec3 vNormal;
 layout(location = 3) in vec3 vPosition;
 
+// per submesh, straight after the vertex shader's MeshDequantization. MaterialParams and VirtualTextureParams in
+// VkRenderer.h.
+layout(push_constant) uniform DrawParams
+{
+	layout(offset = 48) vec4 diffuse; // the material's Kd, white when it has none
+#ifdef VIRTUAL_TEXTURE
+	vec2 size; // virtual texels at mip 0, a whole number of pages
+	uint mipCount;
+	uint textureIndex;
+#endif
+} draw;
+
+#ifdef VIRTUAL_TEXTURE
+// virtual texturing, see VirtualTexture.h. These have to match the constants in there.
+const float PAGE_SIZE = 128.0;
+const float PAGE_BORDER = 4.0;
+const float SLOT_SIZE = 136.0;
+const float ATLAS_SIZE = 136.0 * 16.0;
+const uint FEEDBACK_TILE = 8u;
+
+layout(binding = 1) uniform sampler2D pageAtlas; // resident pages with their borders, bilinear and clamped
+layout(binding = 2) uniform usampler2D pageTable; // per page per mip: atlas slot x, y, the mip that's actually in it, valid
+layout(std430, binding = 3) buffer Feedback
+{
+	uint jitter; // x | y << 8: the pixel of each tile that writes this frame
+	uint tilesPerRow;
+	uint requests[]; // page ids, one per tile
+} feedback;
+
+// which page of mip level uv is on.
+ivec2 pageAt(vec2 uv, int level)
+{
+	ivec2 pages = textureSize(pageTable, level);
+	return clamp(ivec2(uv * draw.size / (exp2(float(level)) * PAGE_SIZE)), ivec2(0), pages - 1);
+}
+
+// uv at mip level, or from whichever coarser page is standing in for it until it streams in.
+vec4 sampleVirtual(vec2 uv, int level)
+{
+	uvec4 entry = texelFetch(pageTable, pageAt(uv, level), level);
+	if (entry.a == 0u)
+		return vec4(0.5); // not even the last mip is in yet
+
+	int resident = int(entry.b);
+	vec2 texel = uv * draw.size / exp2(float(resident));
+	vec2 inPage = clamp(texel - vec2(pageAt(uv, resident)) * PAGE_SIZE, vec2(0.0), vec2(PAGE_SIZE));
+	return textureLod(pageAtlas, (vec2(entry.rg) * SLOT_SIZE + PAGE_BORDER + inPage) / ATLAS_SIZE, 0.0);
+}
+#else
 layout(binding = 1) uniform sampler2D texSampler;
+#endif
 
 vec4 lightPos = vec4(0.0, 1.0, 0.0, 1.0);
 vec4 lightCol = vec4(1.0, 1.0, 1.0, 1.0);
@@ -46,5 +95,26 @@ void main()
 	//outColor = vec4(fragTexCoord, 0.0, 1.0);
 	//outColor = vec4(1.0, 1.0, 1.0, 1.0);
 	//outColor = vec4(vNormal, 1.0);
-	outColor = phongCalc() * texture(texSampler, fragTexCoord);
+#ifdef VIRTUAL_TEXTURE
+	// the mip the hardware would pick, from the texel footprint. The two mips either side get blended here, the
+	// atlas can't do trilinear across pages.
+	vec2 texel = fragTexCoord * draw.size;
+	vec2 dx = dFdx(texel), dy = dFdy(texel);
+	float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0, float(draw.mipCount - 1u));
+	int level = int(lod);
+	vec2 uv = fract(fragTexCoord); // repeat addressing, the atlas can't wrap for us
+	vec4 texColor = mix(sampleVirtual(uv, level), sampleVirtual(uv, min(level + 1, int(draw.mipCount) - 1)), fract(lod));
+
+	// one pixel per tile asks for the finer of the two.
+	uvec2 pixel = uvec2(gl_FragCoord.xy);
+	if (all(equal(pixel % FEEDBACK_TILE, uvec2(feedback.jitter & 0xFFu, feedback.jitter >> 8))))
+	{
+		uvec2 page = uvec2(pageAt(uv, level));
+		uvec2 tile = pixel / FEEDBACK_TILE;
+		feedback.requests[tile.y * feedback.tilesPerRow + tile.x] = page.x | page.y << 10 | uint(level) << 20 | draw.textureIndex << 24;
+	}
+#else
+	vec4 texColor = texture(texSampler, fragTexCoord);
+#endif
+	outColor = phongCalc() * texColor * draw.diffuse;
 }
\ No newline at end of file
@@ -8,10 +8,34 @@ layout(binding=0) uniform UniformBufferObject
 	mat4 proj;
 } ubo;
 
+#ifdef COMPACT_VERTEX
+// CompactVertex: everything arrives as normalized ints, these put it back in object space.
+layout(push_constant) uniform MeshDequantization
+{
+	vec4 posOffset;
+	vec4 posScale;
+	vec4 texCoordOffsetScale;
+} dequant;
+
+layout(location = 0) in vec4 inPackedPosition;
+layout(location = 2) in vec2 inPackedTexCoord;
+layout(location = 3) in vec2 inPackedNormal;
+
+// octahedral normal back to a unit vector (encodeOctahedral in VertexQuantization.h is the other half).
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+#else
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
 layout(location = 3) in vec3 inNormal;
+#endif
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
@@ -20,6 +44,13 @@ layout(location = 3) out vec3 vPosition;
 
 void main()
 {
+#ifdef COMPACT_VERTEX
+	vec3 inPosition = dequant.posOffset.xyz + inPackedPosition.xyz * dequant.posScale.xyz;
+	vec3 inColor = vec3(1.0);
+	vec2 inTexCoord = dequant.texCoordOffsetScale.xy + inPackedTexCoord * dequant.texCoordOffsetScale.zw;
+	vec3 inNormal = octDecode(inPackedNormal);
+#endif
+
     gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
 	fragColor = inColor;
 	fragTexCoord = inTexCoord;
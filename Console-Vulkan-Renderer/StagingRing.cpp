@@ -0,0 +1,96 @@
+#include "StagingRing.h"
+#include <stdexcept>
+
+void StagingRing::create(VkDevice device, MemoryAllocator& allocator, VkDeviceSize size, VkMemoryPropertyFlags properties)
+{
+	mDevice = device;
+	mSize = size;
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &mBuffer) != VK_SUCCESS)
+		throw std::runtime_error("failed to create the staging ring!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, mBuffer, &memRequirements);
+	mMemory = allocator.allocate(memRequirements, properties, true);
+	vkBindBufferMemory(device, mBuffer, mMemory.memory, mMemory.offset);
+
+	mHead = mTail = mSubmitted = 0;
+	mInFlight.clear();
+}
+
+void StagingRing::destroy(MemoryAllocator& allocator)
+{
+	vkDestroyBuffer(mDevice, mBuffer, nullptr);
+	allocator.free(mMemory);
+	mBuffer = VK_NULL_HANDLE;
+	mInFlight.clear();
+}
+
+bool StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment, StagingRegion& region)
+{
+	reclaim();
+
+	// empty, so start over at offset 0 and the whole ring is there for the taking.
+	if (mHead == mTail)
+		mHead = mTail = mSubmitted = (mHead + mSize - 1) / mSize * mSize;
+
+	uint64_t start = (mHead + alignment - 1) & ~uint64_t(alignment - 1);
+	if (start % mSize + size > mSize)
+		start = (start / mSize + 1) * mSize;
+	if (size > mSize || start + size - mTail > mSize)
+		return false;
+
+	mHead = start + size;
+	region.buffer = mBuffer;
+	region.offset = start % mSize;
+	region.mapped = mMemory.mapped + region.offset;
+	return true;
+}
+
+void StagingRing::submit(VkFence fence)
+{
+	if (mHead == mSubmitted)
+		return;
+	mInFlight.push_back({ fence, mHead });
+	mSubmitted = mHead;
+	reclaim();
+}
+
+void StagingRing::reclaim()
+{
+	while (!mInFlight.empty())
+	{
+		const Batch& batch = mInFlight.front();
+		if (batch.fence != VK_NULL_HANDLE && vkGetFenceStatus(mDevice, batch.fence) != VK_SUCCESS)
+			break;
+		mTail = batch.end;
+		mInFlight.pop_front();
+	}
+}
+
+void StagingRing::fenceSignalled(VkFence fence)
+{
+	for (Batch& batch : mInFlight)
+	{
+		if (batch.fence == fence)
+			batch.fence = VK_NULL_HANDLE;
+	}
+	reclaim();
+}
+
+bool StagingRing::waitOldest()
+{
+	if (mInFlight.empty())
+		return false;
+	const Batch& batch = mInFlight.front();
+	if (batch.fence != VK_NULL_HANDLE)
+		vkWaitForFences(mDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+	mTail = batch.end;
+	mInFlight.pop_front();
+	return true;
+}
@@ -0,0 +1,69 @@
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include "MemoryAllocator.h"
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <deque>
+
+// The one staging buffer every upload goes through: textures, the mesh, streamed chunks and virtual texture pages.
+// It's created and mapped once, uploads take pieces of it, and a piece comes back when the fence of the submit that
+// copied out of it has signalled. So uploading at runtime never creates or allocates anything.
+//
+// Pieces are handed out and given back in order, like any ring buffer. allocate() takes from the head, submit()
+// hands everything taken since the last submit to one fence, and the tail moves up as those fences signal. A piece
+// never wraps around the end of the buffer, the head skips back to the start instead.
+//
+// Main thread only, like the rest of the vulkan objects.
+
+const VkDeviceSize STAGING_RING_SIZE = 64 * 1024 * 1024;
+
+struct StagingRegion
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0; // in buffer
+	unsigned char* mapped = nullptr; // buffer's memory at offset
+};
+
+class StagingRing
+{
+public:
+	void create(VkDevice device, MemoryAllocator& allocator, VkDeviceSize size, VkMemoryPropertyFlags properties);
+	// nothing can still be copying out of it.
+	void destroy(MemoryAllocator& allocator);
+
+	// size bytes at alignment (a power of two). False when they won't be free until more of the submits so far finish,
+	// or never will be because size is more than the whole ring.
+	bool allocate(VkDeviceSize size, VkDeviceSize alignment, StagingRegion& region);
+	// everything allocated since the last submit comes back once fence signals. VK_NULL_HANDLE for copies the caller
+	// has already waited on (or pieces nothing ended up copying out of).
+	void submit(VkFence fence);
+	// gives back what the finished submits were holding. allocate does this first thing.
+	void reclaim();
+	// fence has signalled and is about to be reset or destroyed, so nothing should ask about it again. Whatever it
+	// was holding counts as done. Call it before reusing or destroying a fence passed to submit.
+	void fenceSignalled(VkFence fence);
+	// waits for the oldest submit still holding anything, and gives its pieces back. False if there isn't one.
+	bool waitOldest();
+
+	VkBuffer buffer() const { return mBuffer; }
+	VkDeviceSize size() const { return mSize; }
+
+private:
+	struct Batch
+	{
+		VkFence fence;
+		uint64_t end; // mHead when it was submitted
+	};
+
+	VkDevice mDevice = VK_NULL_HANDLE;
+	VkBuffer mBuffer = VK_NULL_HANDLE;
+	MemoryAllocation mMemory;
+	VkDeviceSize mSize = 0;
+	// positions only ever count up, the offset is position % mSize. Everything from mTail to mHead is in use.
+	uint64_t mHead = 0, mTail = 0;
+	uint64_t mSubmitted = 0; // mHead at the last submit
+	std::deque<Batch> mInFlight; // oldest first
+};
+
+#endif // !STAGING_RING_H
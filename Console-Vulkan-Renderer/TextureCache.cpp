@@ -0,0 +1,89 @@
+#include "TextureCache.h"
+#include <algorithm>
+#include <stdexcept>
+
+TextureHandle TextureCache::acquire(const TextureKey& key)
+{
+	auto found = mLookup.find(key);
+	if (found == mLookup.end())
+		return INVALID_TEXTURE_HANDLE;
+	addRef(found->second);
+	return found->second;
+}
+
+TextureHandle TextureCache::insert(const TextureKey& key, const CachedTexture& texture)
+{
+	if (mLookup.count(key))
+		throw std::runtime_error("texture cache: key inserted twice");
+
+	TextureHandle handle;
+	if (!mFreeHandles.empty())
+	{
+		handle = mFreeHandles.back();
+		mFreeHandles.pop_back();
+	}
+	else
+	{
+		handle = static_cast<TextureHandle>(mEntries.size());
+		mEntries.emplace_back();
+	}
+
+	Entry& entry = mEntries[handle];
+	entry.texture = texture;
+	entry.key = key;
+	entry.refCount = 1;
+	entry.live = true;
+	mLookup[key] = handle;
+	return handle;
+}
+
+void TextureCache::addRef(TextureHandle handle)
+{
+	Entry& entry = mEntries[handle];
+	// picked back up before it got collected.
+	if (entry.refCount++ == 0)
+		mUnreferenced.erase(std::find(mUnreferenced.begin(), mUnreferenced.end(), handle));
+}
+
+void TextureCache::release(TextureHandle handle, uint64_t frameNumber)
+{
+	Entry& entry = mEntries[handle];
+	if (entry.refCount == 0)
+		throw std::runtime_error("texture cache: released a texture with no references");
+	if (--entry.refCount == 0)
+	{
+		entry.releasedFrame = frameNumber;
+		mUnreferenced.push_back(handle);
+	}
+}
+
+void TextureCache::collect(VkDevice device, MemoryAllocator& allocator, uint64_t frameNumber, uint64_t framesInFlight)
+{
+	// oldest first, so everything after the first one that's too new is too new as well.
+	size_t collected = 0;
+	while (collected < mUnreferenced.size() && mEntries[mUnreferenced[collected]].releasedFrame + framesInFlight <= frameNumber)
+		destroy(device, allocator, mUnreferenced[collected++]);
+	mUnreferenced.erase(mUnreferenced.begin(), mUnreferenced.begin() + collected);
+}
+
+void TextureCache::destroyAll(VkDevice device, MemoryAllocator& allocator)
+{
+	for (TextureHandle handle = 0; handle < mEntries.size(); ++handle)
+	{
+		if (mEntries[handle].live)
+			destroy(device, allocator, handle);
+	}
+	mUnreferenced.clear();
+}
+
+void TextureCache::destroy(VkDevice device, MemoryAllocator& allocator, TextureHandle handle)
+{
+	Entry& entry = mEntries[handle];
+	vkDestroyImageView(device, entry.texture.view, nullptr);
+	vkDestroyImage(device, entry.texture.image, nullptr);
+	allocator.free(entry.texture.memory);
+
+	mLookup.erase(entry.key);
+	entry = Entry();
+	mFreeHandles.push_back(handle);
+}
@@ -0,0 +1,83 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "MemoryAllocator.h"
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// The textures that are on the GPU, shared by everything that asks for the same file contents in the same format.
+// Keyed by a hash of the file's bytes rather than its path, so a copy of a texture under another name (or another
+// model's folder) gets the same image too.
+//
+// Handles are ref counted. Dropping the last reference doesn't destroy anything straight away, a frame still in
+// flight could be sampling the image. The entry waits until MAX_FRAMES_IN_FLIGHT more frames have started (so their
+// fences have been waited on), and if someone acquires it again before then it's simply picked back up.
+//
+// Main thread only, like the rest of the vulkan objects.
+
+typedef uint32_t TextureHandle;
+const TextureHandle INVALID_TEXTURE_HANDLE = UINT32_MAX;
+
+struct TextureKey
+{
+	uint64_t contentHash = 0; // of the file the texture loads from
+	VkFormat format = VK_FORMAT_UNDEFINED; // the format it was asked for, not necessarily the one it ends up in
+
+	bool operator<(const TextureKey& other) const
+	{
+		return contentHash != other.contentHash ? contentHash < other.contentHash : format < other.format;
+	}
+};
+
+// what the cache owns and destroys.
+struct CachedTexture
+{
+	VkImage image = VK_NULL_HANDLE;
+	MemoryAllocation memory;
+	VkImageView view = VK_NULL_HANDLE;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t mipLevels = 1;
+};
+
+class TextureCache
+{
+public:
+	// an extra reference to key's texture, or INVALID_TEXTURE_HANDLE if it isn't cached.
+	TextureHandle acquire(const TextureKey& key);
+	// takes ownership of a texture that's just been uploaded, with one reference. key mustn't be cached already.
+	TextureHandle insert(const TextureKey& key, const CachedTexture& texture);
+
+	void addRef(TextureHandle handle);
+	// frameNumber is the frame being recorded now, the last one that could still use the texture.
+	void release(TextureHandle handle, uint64_t frameNumber);
+
+	// destroys what's been unreferenced since before frame frameNumber - framesInFlight. Call once a frame, after
+	// waiting on its fence.
+	void collect(VkDevice device, MemoryAllocator& allocator, uint64_t frameNumber, uint64_t framesInFlight);
+	// destroys everything, referenced or not. The device has to be idle.
+	void destroyAll(VkDevice device, MemoryAllocator& allocator);
+
+	CachedTexture& get(TextureHandle handle) { return mEntries[handle].texture; }
+	size_t liveCount() const { return mLookup.size(); }
+
+private:
+	struct Entry
+	{
+		CachedTexture texture;
+		TextureKey key;
+		uint32_t refCount = 0;
+		uint64_t releasedFrame = 0; // when refCount last hit 0
+		bool live = false;
+	};
+
+	void destroy(VkDevice device, MemoryAllocator& allocator, TextureHandle handle);
+
+	std::vector<Entry> mEntries; // indexed by handle
+	std::vector<TextureHandle> mFreeHandles;
+	std::map<TextureKey, TextureHandle> mLookup; // live entries, referenced or waiting to be collected
+	std::vector<TextureHandle> mUnreferenced; // live entries with no references, oldest release first
+};
+
+#endif // !TEXTURE_CACHE_H
@@ -0,0 +1,268 @@
+#include "TextureCooker.h"
+#include "FrameStats.h"
+#include "Mipmaps.h"
+#include "ParallelFor.h"
+#include "Tracer.h"
+#include <vulkan/vulkan.h>
+#include <stb_image.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	// block rows per job. A 4k level is 1024 rows, so plenty of jobs to go round, and small levels are one each.
+	const uint32_t ENCODE_ROWS_PER_JOB = 8;
+
+	const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	// Khronos data format descriptor values for a basic descriptor block (KHR_DF_*).
+	const uint32_t DF_MODEL_BC1A = 128;
+	const uint32_t DF_MODEL_BC7 = 134;
+	const uint32_t DF_PRIMARIES_BT709 = 1;
+	const uint32_t DF_TRANSFER_SRGB = 2;
+	const uint32_t DF_VERSION = 2;
+	const uint32_t DF_BASIC_BLOCK_SIZE = 24;
+	const uint32_t DF_SAMPLE_SIZE = 16;
+
+	struct EncodeJob
+	{
+		size_t level;
+		uint32_t firstRow, lastRow;
+	};
+
+	void append32(std::vector<unsigned char>& out, uint32_t value)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+		out.insert(out.end(), bytes, bytes + sizeof(value));
+	}
+
+	void append64(std::vector<unsigned char>& out, uint64_t value)
+	{
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+		out.insert(out.end(), bytes, bytes + sizeof(value));
+	}
+
+	size_t alignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// one basic descriptor block with a single sample covering the whole compressed block.
+	void appendDataFormatDescriptor(std::vector<unsigned char>& out, BlockFormat format)
+	{
+		uint32_t bytes = static_cast<uint32_t>(blockSize(format));
+		append32(out, 4 + DF_BASIC_BLOCK_SIZE + DF_SAMPLE_SIZE); // dfdTotalSize
+		append32(out, 0); // vendor 0 (Khronos), descriptor type 0 (basic)
+		append32(out, DF_VERSION | (DF_BASIC_BLOCK_SIZE + DF_SAMPLE_SIZE) << 16);
+		append32(out, (format == BLOCK_FORMAT_BC1 ? DF_MODEL_BC1A : DF_MODEL_BC7) | DF_PRIMARIES_BT709 << 8 | DF_TRANSFER_SRGB << 16);
+		append32(out, 3 | 3 << 8); // 4x4x1x1 texel block, each stored as size - 1
+		append32(out, bytes); // bytesPlane0
+		append32(out, 0);
+		// sample: bit offset 0, bit length (minus 1), channel 0 (colour), no qualifiers. Full range.
+		append32(out, (bytes * 8 - 1) << 16);
+		append32(out, 0);
+		append32(out, 0);
+		append32(out, UINT32_MAX);
+	}
+
+	bool writeKtx2(const std::string& path, BlockFormat format, const std::vector<MipLevel>& levels,
+		const std::vector<std::vector<unsigned char>>& encoded)
+	{
+		const size_t headerSize = 80;
+		size_t levelCount = levels.size();
+		size_t dfdOffset = headerSize + levelCount * 24;
+
+		std::vector<unsigned char> descriptor;
+		appendDataFormatDescriptor(descriptor, format);
+
+		std::string writer = "Console-Vulkan-Renderer texture cooker " + std::to_string(TEXTURE_COOK_VERSION);
+		std::vector<unsigned char> keyValues;
+		std::string pair = std::string("KTXwriter") + '\0' + writer + '\0';
+		append32(keyValues, static_cast<uint32_t>(pair.size()));
+		keyValues.insert(keyValues.end(), pair.begin(), pair.end());
+		keyValues.resize(alignUp(keyValues.size(), 4), 0);
+		size_t kvdOffset = dfdOffset + descriptor.size();
+
+		// level data goes smallest first, each level aligned to the block size.
+		std::vector<size_t> offsets(levelCount);
+		size_t end = kvdOffset + keyValues.size();
+		for (size_t i = levelCount; i-- > 0;)
+		{
+			offsets[i] = alignUp(end, blockSize(format));
+			end = offsets[i] + encoded[i].size();
+		}
+
+		std::vector<unsigned char> header(KTX2_IDENTIFIER, KTX2_IDENTIFIER + sizeof(KTX2_IDENTIFIER));
+		append32(header, format == BLOCK_FORMAT_BC1 ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC7_SRGB_BLOCK);
+		append32(header, 1); // typeSize, 1 for block compressed
+		append32(header, levels[0].width);
+		append32(header, levels[0].height);
+		append32(header, 0); // pixelDepth
+		append32(header, 0); // layerCount
+		append32(header, 1); // faceCount
+		append32(header, static_cast<uint32_t>(levelCount));
+		append32(header, 0); // supercompressionScheme
+		append32(header, static_cast<uint32_t>(dfdOffset));
+		append32(header, static_cast<uint32_t>(descriptor.size()));
+		append32(header, static_cast<uint32_t>(kvdOffset));
+		append32(header, static_cast<uint32_t>(keyValues.size()));
+		append64(header, 0); // no supercompression global data
+		append64(header, 0);
+		for (size_t i = 0; i < levelCount; ++i)
+		{
+			append64(header, offsets[i]);
+			append64(header, encoded[i].size());
+			append64(header, encoded[i].size());
+		}
+		header.insert(header.end(), descriptor.begin(), descriptor.end());
+		header.insert(header.end(), keyValues.begin(), keyValues.end());
+
+		std::error_code error;
+		std::filesystem::create_directories(COOKED_TEXTURE_DIRECTORY, error);
+
+		std::string tempPath = path + ".tmp";
+		{
+			std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+			if (!file)
+				return false;
+
+			const char padding[16] = {};
+			file.write(reinterpret_cast<const char*>(header.data()), header.size());
+			size_t written = header.size();
+			for (size_t i = levelCount; i-- > 0;)
+			{
+				file.write(padding, offsets[i] - written);
+				file.write(reinterpret_cast<const char*>(encoded[i].data()), encoded[i].size());
+				written = offsets[i] + encoded[i].size();
+			}
+
+			if (!file)
+			{
+				file.close();
+				std::filesystem::remove(tempPath, error);
+				return false;
+			}
+		}
+
+		std::filesystem::rename(tempPath, path, error);
+		if (error)
+		{
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+		return true;
+	}
+}
+
+std::string cookedTexturePath(const std::string& sourcePath)
+{
+	std::string name = sourcePath;
+	for (char& c : name)
+	{
+		if (c == '/' || c == '\\' || c == ':')
+			c = '_';
+	}
+	return COOKED_TEXTURE_DIRECTORY + "/" + name + ".ktx2";
+}
+
+std::string findCookedTexture(const std::string& sourcePath)
+{
+	std::string cookedPath = cookedTexturePath(sourcePath);
+	std::error_code error;
+	auto cookedTime = std::filesystem::last_write_time(cookedPath, error);
+	if (error)
+		return std::string();
+	auto sourceTime = std::filesystem::last_write_time(sourcePath, error);
+	if (error || cookedTime < sourceTime)
+		return std::string();
+	return cookedPath;
+}
+
+size_t cookTextures(const std::string& directory, BlockFormat format, unsigned threadCount)
+{
+	TRACE_FUNCTION();
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<std::string> sources;
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+	{
+		if (entry.is_regular_file())
+			sources.push_back(entry.path().generic_string());
+	}
+	std::sort(sources.begin(), sources.end());
+	if (error)
+		std::cerr << "can't read " << directory << ": " << error.message() << std::endl;
+
+	const char* formatName = format == BLOCK_FORMAT_BC1 ? "BC1" : "BC7";
+	size_t cooked = 0;
+	double totalEncodeMs = 0.0;
+	double totalMegapixels = 0.0;
+	for (const std::string& source : sources)
+	{
+		int width, height, channels;
+		unsigned char* pixels = stbi_load(source.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+		if (!pixels)
+		{
+			std::cerr << "skipping " << source << ": " << stbi_failure_reason() << std::endl;
+			continue;
+		}
+
+		std::vector<MipLevel> levels;
+		std::vector<unsigned char> chain(layoutMipChain(static_cast<uint32_t>(width), static_cast<uint32_t>(height), levels));
+		memcpy(chain.data(), pixels, size_t(width) * height * 4);
+		stbi_image_free(pixels);
+		generateMipChain(chain.data(), levels, threadCount);
+
+		// every level's block rows in one list, so the small levels fill in around the big one.
+		std::vector<std::vector<unsigned char>> encoded(levels.size());
+		std::vector<EncodeJob> jobs;
+		double megapixels = 0.0;
+		for (size_t i = 0; i < levels.size(); ++i)
+		{
+			encoded[i].resize(encodedLevelSize(levels[i].width, levels[i].height, format));
+			megapixels += double(levels[i].width) * levels[i].height / 1e6;
+			uint32_t rows = (levels[i].height + 3) / 4;
+			for (uint32_t row = 0; row < rows; row += ENCODE_ROWS_PER_JOB)
+				jobs.push_back({ i, row, std::min(rows, row + ENCODE_ROWS_PER_JOB) });
+		}
+
+		StatClock::time_point start = StatClock::now();
+		parallelFor(jobs.size(), threadCount, "cook worker", [&](size_t j)
+		{
+			const EncodeJob& job = jobs[j];
+			const MipLevel& level = levels[job.level];
+			encodeBlockRows(encoded[job.level].data(), chain.data() + level.offset, level.width, level.height, format, job.firstRow, job.lastRow);
+		});
+		double encodeMs = elapsedMs(start, StatClock::now());
+
+		std::string cookedPath = cookedTexturePath(source);
+		if (!writeKtx2(cookedPath, format, levels, encoded))
+		{
+			std::cerr << "couldn't write " << cookedPath << std::endl;
+			continue;
+		}
+
+		std::cout << source << " -> " << cookedPath << ": " << width << "x" << height << " " << formatName << ", "
+			<< levels.size() << " levels, encoded in " << encodeMs << " ms" << std::endl;
+		totalEncodeMs += encodeMs;
+		totalMegapixels += megapixels;
+		++cooked;
+	}
+
+	if (totalEncodeMs > 0.0)
+	{
+		double megapixelsPerSecond = totalMegapixels / (totalEncodeMs / 1000.0);
+		std::cout << "cooked " << cooked << " textures, " << totalMegapixels << " megapixels (mips included) in " << totalEncodeMs
+			<< " ms on " << threadCount << " threads: " << megapixelsPerSecond << " MP/s, " << megapixelsPerSecond / threadCount
+			<< " MP/s per core" << std::endl;
+	}
+	else
+		std::cout << "no textures cooked from " << directory << std::endl;
+	return cooked;
+}
@@ -0,0 +1,29 @@
+#ifndef TEXTURE_COOKER_H
+#define TEXTURE_COOKER_H
+
+#include "BlockCompression.h"
+#include <string>
+
+// Offline texture cooking (--cook-textures). Every image stb_image can read in a directory gets a full mip chain
+// (generateMipChain), block compressed to BC1 or BC7 on every core, written as a KTX2 file under
+// COOKED_TEXTURE_DIRECTORY. KTX2 is the container: versioned by its identifier, levels at fixed aligned offsets so
+// it can be mapped and copied straight into a staging buffer, and loadTextureFile already reads it.
+//
+// The renderer picks up the cooked file in place of the source whenever it's at least as new as the source.
+
+const std::string TEXTURE_DIRECTORY = "Textures";
+const std::string COOKED_TEXTURE_DIRECTORY = "Cache";
+// goes in the KTXwriter key. Bump when the encoders change what they write.
+const uint32_t TEXTURE_COOK_VERSION = 1;
+
+// where the cooked version of sourcePath goes, flattened the same way as MeshCache::cachePathFor.
+std::string cookedTexturePath(const std::string& sourcePath);
+
+// cookedTexturePath(sourcePath) if it exists and isn't older than sourcePath, otherwise empty.
+std::string findCookedTexture(const std::string& sourcePath);
+
+// cooks every image in directory, printing each one and the encode throughput (megapixels a second, per core) at
+// the end. Images that won't load or write get a warning and are skipped. Returns how many got cooked.
+size_t cookTextures(const std::string& directory, BlockFormat format, unsigned threadCount = 0);
+
+#endif // !TEXTURE_COOKER_H
@@ -0,0 +1,233 @@
+#include "TextureFile.h"
+#include "Tracer.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace
+{
+	const unsigned char KTX2_MAGIC[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	const size_t KTX2_HEADER_SIZE = 80; // identifier, 9 uint32s, then the dfd / kvd / sgd index
+	const size_t KTX2_LEVEL_SIZE = 24; // byteOffset, byteLength, uncompressedByteLength, all uint64
+
+	const unsigned char DDS_MAGIC[4] = { 'D', 'D', 'S', ' ' };
+	const size_t DDS_HEADER_SIZE = 124;
+	const size_t DDS_DX10_HEADER_SIZE = 20;
+	const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+	const uint32_t DDPF_FOURCC = 0x4;
+	const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+	const uint32_t DDSCAPS2_VOLUME = 0x200000;
+	const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+	// everything in both formats is little endian, same as every machine we build for.
+	template <typename T>
+	T read(const MappedFile& file, size_t offset)
+	{
+		T value;
+		memcpy(&value, file.data() + offset, sizeof(T));
+		return value;
+	}
+
+	uint32_t fourCC(const char* code)
+	{
+		return uint32_t(uint8_t(code[0])) | uint32_t(uint8_t(code[1])) << 8 | uint32_t(uint8_t(code[2])) << 16 | uint32_t(uint8_t(code[3])) << 24;
+	}
+
+	// the DXGI_FORMATs we take out of a DX10 header. Colour data in old style DDS files is taken to be sRGB, like
+	// the jpgs we load.
+	VkFormat formatFromDxgi(uint32_t dxgiFormat)
+	{
+		switch (dxgiFormat)
+		{
+		case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+		case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+		case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+		case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+		case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+		case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+		case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+		case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+		case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+		case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+		default: return VK_FORMAT_UNDEFINED;
+		}
+	}
+
+	VkFormat formatFromFourCC(uint32_t code)
+	{
+		if (code == fourCC("DXT1"))
+			return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+		if (code == fourCC("DXT5"))
+			return VK_FORMAT_BC3_SRGB_BLOCK;
+		if (code == fourCC("ATI2") || code == fourCC("BC5U"))
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		return VK_FORMAT_UNDEFINED;
+	}
+
+	// width x height down to 1x1: floor(log2(max(width, height))) + 1. Anything past that in a file is junk.
+	uint32_t fullMipCount(uint32_t width, uint32_t height)
+	{
+		uint32_t count = 1;
+		for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+			++count;
+		return count;
+	}
+
+	// copies levelCount levels out of file into texture. levelOffset(i) is where level i starts in the file.
+	template <typename LevelOffset>
+	void copyLevels(const std::string& path, const MappedFile& file, TextureFile& texture, uint32_t levelCount,
+		const LevelOffset& levelOffset)
+	{
+		texture.levels.clear();
+		texture.levelData.clear();
+		texture.size = 0;
+		uint32_t width = texture.width, height = texture.height;
+		for (uint32_t i = 0; i < levelCount; ++i)
+		{
+			size_t size = textureLevelSize(texture.format, width, height);
+			size_t offset = levelOffset(i);
+			if (offset > file.size() || file.size() - offset < size)
+				throw std::runtime_error(path + ": mip " + std::to_string(i) + " runs past the end of the file");
+
+			texture.levels.push_back({ texture.size, width, height });
+			texture.levelData.push_back(file.data() + offset);
+			texture.size += size;
+
+			// last level reached 1x1 before the file ran out of levels, the rest are junk.
+			if (width == 1 && height == 1)
+				break;
+			width = std::max(1u, width / 2);
+			height = std::max(1u, height / 2);
+		}
+	}
+
+	void loadKtx2(const std::string& path, const MappedFile& file, TextureFile& texture)
+	{
+		if (file.size() < KTX2_HEADER_SIZE)
+			throw std::runtime_error(path + ": KTX2 header is cut off");
+
+		texture.format = static_cast<VkFormat>(read<uint32_t>(file, 12));
+		texture.width = read<uint32_t>(file, 20);
+		texture.height = read<uint32_t>(file, 24);
+		uint32_t depth = read<uint32_t>(file, 28);
+		uint32_t layerCount = read<uint32_t>(file, 32);
+		uint32_t faceCount = read<uint32_t>(file, 36);
+		uint32_t levelCount = std::max(1u, read<uint32_t>(file, 40)); // 0 means "make your own mips", we just use level 0
+		uint32_t supercompression = read<uint32_t>(file, 44);
+
+		if (texture.width == 0 || texture.height == 0)
+			throw std::runtime_error(path + ": texture has no pixels");
+		if (depth > 1 || layerCount > 1 || faceCount != 1)
+			throw std::runtime_error(path + ": only single 2D KTX2 textures are supported");
+		levelCount = std::min(levelCount, fullMipCount(texture.width, texture.height));
+		if (supercompression != 0)
+			throw std::runtime_error(path + ": supercompressed KTX2 isn't supported, re-export it without supercompression");
+		if (textureLevelSize(texture.format, 1, 1) == 0)
+			throw std::runtime_error(path + ": unsupported KTX2 vkFormat " + std::to_string(texture.format));
+		if (file.size() < KTX2_HEADER_SIZE + size_t(levelCount) * KTX2_LEVEL_SIZE)
+			throw std::runtime_error(path + ": KTX2 level index is cut off");
+
+		copyLevels(path, file, texture, levelCount, [&](uint32_t level)
+		{
+			return static_cast<size_t>(read<uint64_t>(file, KTX2_HEADER_SIZE + level * KTX2_LEVEL_SIZE));
+		});
+	}
+
+	void loadDds(const std::string& path, const MappedFile& file, TextureFile& texture)
+	{
+		const size_t header = sizeof(DDS_MAGIC);
+		if (file.size() < header + DDS_HEADER_SIZE)
+			throw std::runtime_error(path + ": DDS header is cut off");
+
+		uint32_t flags = read<uint32_t>(file, header + 4);
+		texture.height = read<uint32_t>(file, header + 8);
+		texture.width = read<uint32_t>(file, header + 12);
+		uint32_t levelCount = flags & DDSD_MIPMAPCOUNT ? std::max(1u, read<uint32_t>(file, header + 24)) : 1;
+		uint32_t pixelFormatFlags = read<uint32_t>(file, header + 76);
+		uint32_t code = read<uint32_t>(file, header + 80);
+		uint32_t caps2 = read<uint32_t>(file, header + 108);
+
+		if (texture.width == 0 || texture.height == 0)
+			throw std::runtime_error(path + ": texture has no pixels");
+		if (caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME))
+			throw std::runtime_error(path + ": only single 2D DDS textures are supported");
+		levelCount = std::min(levelCount, fullMipCount(texture.width, texture.height));
+
+		size_t dataOffset = header + DDS_HEADER_SIZE;
+		if (!(pixelFormatFlags & DDPF_FOURCC))
+			throw std::runtime_error(path + ": uncompressed DDS pixel formats aren't supported");
+		if (code == fourCC("DX10"))
+		{
+			if (file.size() < dataOffset + DDS_DX10_HEADER_SIZE)
+				throw std::runtime_error(path + ": DDS DX10 header is cut off");
+			texture.format = formatFromDxgi(read<uint32_t>(file, dataOffset));
+			uint32_t dimension = read<uint32_t>(file, dataOffset + 4);
+			uint32_t arraySize = read<uint32_t>(file, dataOffset + 12);
+			if (dimension != DDS_DIMENSION_TEXTURE2D || arraySize > 1)
+				throw std::runtime_error(path + ": only single 2D DDS textures are supported");
+			dataOffset += DDS_DX10_HEADER_SIZE;
+		}
+		else
+			texture.format = formatFromFourCC(code);
+
+		if (texture.format == VK_FORMAT_UNDEFINED)
+			throw std::runtime_error(path + ": unsupported DDS pixel format");
+
+		// levels are back to back, biggest first.
+		std::vector<size_t> offsets(1, dataOffset);
+		uint32_t width = texture.width, height = texture.height;
+		for (uint32_t i = 1; i < levelCount; ++i)
+		{
+			offsets.push_back(offsets.back() + textureLevelSize(texture.format, width, height));
+			width = std::max(1u, width / 2);
+			height = std::max(1u, height / 2);
+		}
+		copyLevels(path, file, texture, levelCount, [&](uint32_t level) { return offsets[level]; });
+	}
+}
+
+size_t textureLevelSize(VkFormat format, uint32_t width, uint32_t height)
+{
+	// BCn works on 4x4 blocks, a partial block at the edge still takes a whole one.
+	size_t blocks = size_t((width + 3) / 4) * ((height + 3) / 4);
+	switch (format)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		return size_t(width) * height * 4;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		return blocks * 8;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return blocks * 16;
+	default:
+		return 0;
+	}
+}
+
+bool loadTextureFile(const std::string& path, TextureFile& texture)
+{
+	TRACE_FUNCTION();
+	std::error_code error;
+	if (!std::filesystem::is_regular_file(path, error))
+		return false;
+
+	std::unique_ptr<MappedFile> file(new MappedFile(path));
+	if (file->size() >= sizeof(KTX2_MAGIC) && memcmp(file->data(), KTX2_MAGIC, sizeof(KTX2_MAGIC)) == 0)
+		loadKtx2(path, *file, texture);
+	else if (file->size() >= sizeof(DDS_MAGIC) && memcmp(file->data(), DDS_MAGIC, sizeof(DDS_MAGIC)) == 0)
+		loadDds(path, *file, texture);
+	else
+		return false;
+
+	texture.file = std::move(file);
+	return true;
+}
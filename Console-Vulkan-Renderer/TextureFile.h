@@ -0,0 +1,33 @@
+#ifndef TEXTURE_FILE_H
+#define TEXTURE_FILE_H
+
+#include <vulkan/vulkan.h>
+#include "MappedFile.h"
+#include "Mipmaps.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Loader for textures that are already GPU ready: KTX2 and DDS files holding BC1 / BC3 / BC5 / BC7 (or plain RGBA8)
+// with their mips. The file stays mapped and the levels are used as they are, there's no decoding, so they go straight
+// from the mapping into a staging buffer. Only single 2D images are supported: no cube maps, arrays, 3D textures or KTX2
+// supercompression.
+
+struct TextureFile
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0, height = 0;
+	std::vector<MipLevel> levels; // level 0 first. Offsets are for a staging buffer, packed the way layoutMipChain packs them.
+	std::vector<const char*> levelData; // each level's bytes in the mapped file
+	size_t size = 0; // bytes of every level together
+	std::unique_ptr<MappedFile> file; // keeps levelData valid
+};
+
+// bytes one level of format takes at this size. 0 for formats loadTextureFile doesn't know.
+size_t textureLevelSize(VkFormat format, uint32_t width, uint32_t height);
+
+// false if path isn't a KTX2 or DDS file (by its magic number), so it can go to stb_image instead. Throws
+// std::runtime_error for a KTX2 / DDS file that's broken or uses something we don't support.
+bool loadTextureFile(const std::string& path, TextureFile& texture);
+
+#endif // !TEXTURE_FILE_H
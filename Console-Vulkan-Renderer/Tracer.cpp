@@ -0,0 +1,81 @@
+#include "Tracer.h"
+#include <fstream>
+#include <stdexcept>
+
+Tracer& Tracer::get()
+{
+	static Tracer tracer;
+	return tracer;
+}
+
+ThreadTraceBuffer& Tracer::threadBuffer()
+{
+	// every thread registers its buffer once, after that it's just a thread local pointer.
+	thread_local ThreadTraceBuffer* buffer = nullptr;
+	if (!buffer)
+	{
+		std::lock_guard<std::mutex> lock(mRegistryMutex);
+		mBuffers.emplace_back(new ThreadTraceBuffer(static_cast<uint32_t>(mBuffers.size())));
+		buffer = mBuffers.back().get();
+	}
+	return *buffer;
+}
+
+void Tracer::setThreadName(const std::string& name)
+{
+	uint32_t id = threadBuffer().threadId();
+
+	std::lock_guard<std::mutex> lock(mRegistryMutex);
+	mThreadNames.emplace_back(id, name);
+}
+
+// JSON strings can't have raw quotes / backslashes in them.
+static void writeJsonString(std::ostream& out, const char* str)
+{
+	out << '"';
+	for (; *str; ++str)
+	{
+		if (*str == '"' || *str == '\\')
+			out << '\\';
+		out << *str;
+	}
+	out << '"';
+}
+
+void Tracer::dump(const std::string& path)
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+		throw std::runtime_error("Failed to open the trace file for writing.");
+
+	std::lock_guard<std::mutex> lock(mRegistryMutex);
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	bool first = true;
+	for (const auto& threadName : mThreadNames)
+	{
+		file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << threadName.first
+			<< ",\"name\":\"thread_name\",\"args\":{\"name\":";
+		writeJsonString(file, threadName.second.c_str());
+		file << "}}";
+		first = false;
+	}
+
+	// "X" = complete event, timestamps are in microseconds.
+	file.precision(3);
+	file << std::fixed;
+	for (const auto& buffer : mBuffers)
+	{
+		uint32_t tid = buffer->threadId();
+		buffer->forEach([&](const TraceEvent& event)
+		{
+			file << (first ? "" : ",\n") << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"name\":";
+			writeJsonString(file, event.name);
+			file << ",\"ts\":" << event.startNs / 1000.0 << ",\"dur\":" << event.durationNs / 1000.0 << "}";
+			first = false;
+		});
+	}
+
+	file << "\n]}\n";
+}
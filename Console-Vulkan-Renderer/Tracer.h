@@ -0,0 +1,140 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped zone CPU tracer. Drop TRACE_ZONE("name") (or TRACE_FUNCTION()) at the top of a scope and, when tracing
+// is on, the scope's start + duration gets appended to a buffer owned by the calling thread. Each thread only
+// ever writes its own buffer, so recording takes no locks. Tracer::dump writes everything out as Chrome
+// trace_event JSON, which chrome://tracing or ui.perfetto.dev can open.
+//
+// Zone names have to outlive the tracer (string literals, __func__).
+
+struct TraceEvent
+{
+	const char* name;
+	uint64_t startNs; // since the tracer was created
+	uint64_t durationNs;
+};
+
+// one thread's events. A linked list of fixed size chunks, so appending never moves old events and the
+// dumping thread can walk it while the owner keeps writing.
+class ThreadTraceBuffer
+{
+public:
+	static const size_t CHUNK_SIZE = 16384;
+
+	ThreadTraceBuffer(uint32_t threadId) : mThreadId(threadId), mHead(new Chunk()), mTail(mHead.get()) {}
+
+	void push(const TraceEvent& event)
+	{
+		size_t count = mTail->count.load(std::memory_order_relaxed);
+		if (count == CHUNK_SIZE)
+		{
+			Chunk* next = new Chunk();
+			mTail->next.reset(next);
+			mTail->nextReady.store(next, std::memory_order_release);
+			mTail = next;
+			count = 0;
+		}
+
+		mTail->events[count] = event;
+		mTail->count.store(count + 1, std::memory_order_release); // publish to the reader
+	}
+
+	uint32_t threadId() const { return mThreadId; }
+
+	// walk every published event, from any thread.
+	template <typename Func>
+	void forEach(Func func) const
+	{
+		for (const Chunk* chunk = mHead.get(); chunk; chunk = chunk->nextReady.load(std::memory_order_acquire))
+		{
+			size_t count = chunk->count.load(std::memory_order_acquire);
+			for (size_t i = 0; i < count; ++i)
+				func(chunk->events[i]);
+		}
+	}
+
+private:
+	struct Chunk
+	{
+		TraceEvent events[CHUNK_SIZE];
+		std::atomic<size_t> count{ 0 };
+		std::unique_ptr<Chunk> next; // owner only
+		std::atomic<Chunk*> nextReady{ nullptr }; // what the reader follows
+	};
+
+	uint32_t mThreadId;
+	std::unique_ptr<Chunk> mHead;
+	Chunk* mTail;
+};
+
+class Tracer
+{
+public:
+	static Tracer& get();
+
+	void setEnabled(bool enabled) { mEnabled.store(enabled, std::memory_order_relaxed); }
+	bool isEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+	uint64_t nowNs() const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mEpoch).count();
+	}
+
+	void record(const char* name, uint64_t startNs, uint64_t endNs) { threadBuffer().push({ name, startNs, endNs - startNs }); }
+
+	void setThreadName(const std::string& name); // shows up as the track name in the viewer
+
+	// write everything recorded so far as Chrome trace_event JSON.
+	void dump(const std::string& path);
+
+private:
+	Tracer() : mEpoch(std::chrono::steady_clock::now()) {}
+
+	ThreadTraceBuffer& threadBuffer();
+
+	std::atomic<bool> mEnabled{ false };
+	std::chrono::steady_clock::time_point mEpoch;
+
+	std::mutex mRegistryMutex; // only taken the first time a thread records, and when dumping
+	std::vector<std::unique_ptr<ThreadTraceBuffer>> mBuffers;
+	std::vector<std::pair<uint32_t, std::string>> mThreadNames;
+};
+
+// RAII zone. Costs one relaxed load when tracing is off.
+class TraceZone
+{
+public:
+	explicit TraceZone(const char* name)
+		: mName(name), mStartNs(Tracer::get().isEnabled() ? Tracer::get().nowNs() : NOT_TRACING) {}
+
+	~TraceZone()
+	{
+		if (mStartNs != NOT_TRACING)
+			Tracer::get().record(mName, mStartNs, Tracer::get().nowNs());
+	}
+
+	TraceZone(const TraceZone&) = delete;
+	TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+	static const uint64_t NOT_TRACING = ~0ULL;
+
+	const char* mName;
+	uint64_t mStartNs;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone_, __LINE__)(name)
+#define TRACE_FUNCTION() TRACE_ZONE(__func__)
+
+#endif // !TRACER_H
@@ -0,0 +1,158 @@
+#include "UploadBatch.h"
+#include <stdexcept>
+
+void UploadBatch::create(VkDevice device, VkQueue queue, uint32_t queueFamily, StagingRing& staging, MemoryAllocator& allocator)
+{
+	mDevice = device;
+	mQueue = queue;
+	mStaging = &staging;
+	mAllocator = &allocator;
+	mCurrent = 0;
+	mRecording = false;
+	mSubmitted = 0;
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamily;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &mCommandPool) != VK_SUCCESS)
+		throw std::runtime_error("Error creating the upload command pool");
+
+	VkCommandBuffer commandBuffers[UPLOAD_BATCH_COUNT];
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = mCommandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = UPLOAD_BATCH_COUNT;
+	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers) != VK_SUCCESS)
+		throw std::runtime_error("Unable to allocate upload command buffers!");
+
+	// signalled, so the first record() of each doesn't wait.
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	for (uint32_t i = 0; i < UPLOAD_BATCH_COUNT; ++i)
+	{
+		mBatches[i] = Batch();
+		mBatches[i].commandBuffer = commandBuffers[i];
+		if (vkCreateFence(device, &fenceInfo, nullptr, &mBatches[i].fence) != VK_SUCCESS)
+			throw std::runtime_error("Error creating an upload fence");
+	}
+}
+
+void UploadBatch::destroy()
+{
+	waitAll();
+	for (Batch& batch : mBatches)
+		vkDestroyFence(mDevice, batch.fence, nullptr);
+	vkDestroyCommandPool(mDevice, mCommandPool, nullptr);
+	mCommandPool = VK_NULL_HANDLE;
+}
+
+void UploadBatch::retire(Batch& batch)
+{
+	if (!batch.serial)
+		return;
+	// the fence gets reset on the next submit, so the ring shouldn't ask about it after this.
+	mStaging->fenceSignalled(batch.fence);
+	for (auto& released : batch.released)
+	{
+		vkDestroyBuffer(mDevice, released.first, nullptr);
+		mAllocator->free(released.second);
+	}
+	batch.released.clear();
+	batch.serial = 0;
+}
+
+VkCommandBuffer UploadBatch::record()
+{
+	Batch& batch = mBatches[mCurrent];
+	if (mRecording)
+		return batch.commandBuffer;
+
+	// still on the GPU from UPLOAD_BATCH_COUNT submits ago.
+	if (batch.serial)
+	{
+		vkWaitForFences(mDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+		retire(batch);
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+	mRecording = true;
+	return batch.commandBuffer;
+}
+
+void UploadBatch::release(VkBuffer buffer, MemoryAllocation& allocation)
+{
+	mBatches[mCurrent].released.emplace_back(buffer, allocation);
+	allocation = MemoryAllocation();
+}
+
+uint64_t UploadBatch::submit()
+{
+	if (!mRecording)
+		return mSubmitted;
+	Batch& batch = mBatches[mCurrent];
+
+	// every draw submitted after this on the queue sees what it wrote. Images get their own barriers on the way to
+	// SHADER_READ_ONLY, this is for the buffers.
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+		| VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+		| VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	vkEndCommandBuffer(batch.commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &batch.commandBuffer;
+	vkResetFences(mDevice, 1, &batch.fence);
+	if (vkQueueSubmit(mQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS)
+		throw std::runtime_error("Error submitting an upload batch.");
+	mStaging->submit(batch.fence);
+
+	batch.serial = ++mSubmitted;
+	mRecording = false;
+	mCurrent = (mCurrent + 1) % UPLOAD_BATCH_COUNT;
+	return batch.serial;
+}
+
+bool UploadBatch::finished(uint64_t serial)
+{
+	if (serial > mSubmitted)
+		return false;
+	for (Batch& batch : mBatches)
+	{
+		if (batch.serial != serial)
+			continue;
+		if (vkGetFenceStatus(mDevice, batch.fence) != VK_SUCCESS)
+			return false;
+		retire(batch);
+	}
+	// otherwise its batch has been retired (or reused) since.
+	return true;
+}
+
+void UploadBatch::wait(uint64_t serial)
+{
+	for (Batch& batch : mBatches)
+	{
+		if (!batch.serial || batch.serial > serial)
+			continue;
+		vkWaitForFences(mDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+		retire(batch);
+	}
+}
+
+void UploadBatch::waitAll()
+{
+	submit();
+	wait(mSubmitted);
+}
@@ -0,0 +1,73 @@
+#ifndef UPLOAD_BATCH_H
+#define UPLOAD_BATCH_H
+
+#include "MemoryAllocator.h"
+#include "StagingRing.h"
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Load time copies, layout transitions and mip blits all go in one command buffer, submitted once with a fence,
+// instead of a command buffer + vkQueueWaitIdle each. Nothing waits for the GPU unless it asks to: wait() blocks on
+// a submit, finished() polls it.
+//
+// Submitting also hands the staging ring everything allocated from it since its last submit, with the batch's fence.
+// So ring pieces a recording copies out of have to be allocated while it's recording, and the batch submitted before
+// anything else submits the ring (the per frame pumps).
+//
+// A couple of batches take turns, so the next one records while the last is still on the GPU. Everything submitted
+// ends with a barrier making its writes visible to every draw submitted after it.
+//
+// Main thread only, like the rest of the vulkan objects.
+
+const uint32_t UPLOAD_BATCH_COUNT = 2;
+
+class UploadBatch
+{
+public:
+	void create(VkDevice device, VkQueue queue, uint32_t queueFamily, StagingRing& staging, MemoryAllocator& allocator);
+	// submits anything recorded and waits for all of it first.
+	void destroy();
+
+	// the command buffer to record into, begun if it isn't already. Only waits when every batch is still on the GPU.
+	VkCommandBuffer record();
+	bool recording() const { return mRecording; }
+	// a buffer the current recording copies out of (a staging buffer of its own, say), destroyed once it's done.
+	void release(VkBuffer buffer, MemoryAllocation& allocation);
+
+	// ends and submits the recording. Returns its serial, for finished() / wait(). Nothing recorded submits nothing,
+	// and returns the last submit's.
+	uint64_t submit();
+	// polls, true once submit serial is done on the GPU.
+	bool finished(uint64_t serial);
+	// blocks until submit serial, and every one before it, is done.
+	void wait(uint64_t serial);
+	// submits anything recorded and waits for everything.
+	void waitAll();
+	uint64_t lastSubmitted() const { return mSubmitted; }
+
+private:
+	struct Batch
+	{
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		uint64_t serial = 0; // of its last submit, 0 when it isn't on the GPU
+		std::vector<std::pair<VkBuffer, MemoryAllocation>> released;
+	};
+
+	// batch's fence has signalled: give back what it held.
+	void retire(Batch& batch);
+
+	VkDevice mDevice = VK_NULL_HANDLE;
+	VkQueue mQueue = VK_NULL_HANDLE;
+	StagingRing* mStaging = nullptr;
+	MemoryAllocator* mAllocator = nullptr;
+	VkCommandPool mCommandPool = VK_NULL_HANDLE;
+	Batch mBatches[UPLOAD_BATCH_COUNT];
+	uint32_t mCurrent = 0; // the one recording, or recording next
+	bool mRecording = false;
+	uint64_t mSubmitted = 0; // serial of the last submit, they count up from 1
+};
+
+#endif // !UPLOAD_BATCH_H
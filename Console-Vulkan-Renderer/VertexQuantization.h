@@ -0,0 +1,65 @@
+#ifndef VERTEX_QUANTIZATION_H
+#define VERTEX_QUANTIZATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Small helpers for packing vertex attributes into normalized integers. The decode side of these lives in
+// shader.vert (the fixed function unorm / snorm conversion does most of it).
+
+// v in [0, 1]
+inline uint16_t quantizeUnorm16(float v)
+{
+	v = std::min(std::max(v, 0.0f), 1.0f);
+	return static_cast<uint16_t>(v * 65535.0f + 0.5f);
+}
+
+// v in [-1, 1]
+inline int16_t quantizeSnorm16(float v)
+{
+	v = std::min(std::max(v, -1.0f), 1.0f);
+	return static_cast<int16_t>(std::lround(v * 32767.0f));
+}
+
+// Octahedral normal encoding: project onto the octahedron |x| + |y| + |z| = 1 and fold the bottom half over the top.
+// Two snorm values, much better spread than storing xyz at the same size.
+inline void encodeOctahedral(float x, float y, float z, float out[2])
+{
+	float length = std::fabs(x) + std::fabs(y) + std::fabs(z);
+	if (length == 0.0f)
+	{
+		out[0] = 0.0f;
+		out[1] = 0.0f;
+		return;
+	}
+
+	x /= length;
+	y /= length;
+	if (z < 0.0f)
+	{
+		float foldedX = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	out[0] = x;
+	out[1] = y;
+}
+
+// same as octDecode in shader.vert, for checking the round trip on the CPU.
+inline void decodeOctahedral(float ex, float ey, float out[3])
+{
+	float x = ex, y = ey, z = 1.0f - std::fabs(ex) - std::fabs(ey);
+	float t = std::max(-z, 0.0f);
+	x += x >= 0.0f ? -t : t;
+	y += y >= 0.0f ? -t : t;
+
+	float length = std::sqrt(x * x + y * y + z * z);
+	out[0] = x / length;
+	out[1] = y / length;
+	out[2] = z / length;
+}
+
+#endif // !VERTEX_QUANTIZATION_H
@@ -0,0 +1,447 @@
+#include "VirtualTexture.h"
+#include "Tracer.h"
+#include <stb_image.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+static uint32_t nextPowerOfTwo(uint32_t value)
+{
+	uint32_t power = 1;
+	while (power < value)
+		power <<= 1;
+	return power;
+}
+
+static uint32_t entryMip(uint32_t entry)
+{
+	return (entry >> 16) & 0xFF;
+}
+
+static bool entryValid(uint32_t entry)
+{
+	return (entry >> 24) != 0;
+}
+
+VirtualTextureLayout layoutVirtualTexture(uint32_t width, uint32_t height)
+{
+	VirtualTextureLayout layout;
+	layout.width = width;
+	layout.height = height;
+	layout.pagesX = nextPowerOfTwo((width + VT_PAGE_SIZE - 1) / VT_PAGE_SIZE);
+	layout.pagesY = nextPowerOfTwo((height + VT_PAGE_SIZE - 1) / VT_PAGE_SIZE);
+	// page ids only have 10 bits for x and y.
+	if (layout.pagesX > 1024 || layout.pagesY > 1024)
+		throw std::runtime_error("virtual texture: " + std::to_string(width) + "x" + std::to_string(height) + " is too big");
+
+	layout.mipCount = 1;
+	while ((layout.pagesX | layout.pagesY) >> (layout.mipCount - 1) > 1)
+		++layout.mipCount;
+	return layout;
+}
+
+// the whole image at the padded virtual size, with every mip, the way the pages get cut from it.
+static void decodeSource(const std::string& path, const VirtualTextureLayout& layout, std::vector<unsigned char>& chain, std::vector<MipLevel>& levels)
+{
+	TRACE_FUNCTION();
+	// texcoords get flipped when the model loads, so images never are.
+	stbi_set_flip_vertically_on_load_thread(0);
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels)
+		throw std::runtime_error(path + ": " + stbi_failure_reason());
+	if (static_cast<uint32_t>(width) != layout.width || static_cast<uint32_t>(height) != layout.height)
+	{
+		stbi_image_free(pixels);
+		throw std::runtime_error(path + ": changed size since it was opened");
+	}
+
+	uint32_t virtualWidth = layout.virtualWidth(), virtualHeight = layout.virtualHeight();
+	chain.resize(layoutMipChain(virtualWidth, virtualHeight, levels));
+
+	// the padding repeats the last column and row, same as clamping to the edge.
+	size_t rowBytes = size_t(width) * 4;
+	for (uint32_t y = 0; y < virtualHeight; ++y)
+	{
+		unsigned char* row = chain.data() + size_t(y) * virtualWidth * 4;
+		memcpy(row, pixels + std::min<size_t>(y, height - 1) * rowBytes, rowBytes);
+		for (uint32_t x = width; x < virtualWidth; ++x)
+			memcpy(row + size_t(x) * 4, row + rowBytes - 4, 4);
+	}
+	stbi_image_free(pixels);
+
+	generateMipChain(chain.data(), levels, 1);
+}
+
+// page (mip, pageX, pageY) and its border into a VT_SLOT_SIZE square. The border clamps at the image's edges.
+static void copyPage(unsigned char* out, const std::vector<unsigned char>& chain, const MipLevel& level, uint32_t pageX, uint32_t pageY)
+{
+	int32_t firstX = static_cast<int32_t>(pageX * VT_PAGE_SIZE) - static_cast<int32_t>(VT_PAGE_BORDER);
+	int32_t firstY = static_cast<int32_t>(pageY * VT_PAGE_SIZE) - static_cast<int32_t>(VT_PAGE_BORDER);
+	int32_t lastX = static_cast<int32_t>(level.width) - 1, lastY = static_cast<int32_t>(level.height) - 1;
+
+	uint32_t columns[VT_SLOT_SIZE];
+	for (uint32_t x = 0; x < VT_SLOT_SIZE; ++x)
+		columns[x] = static_cast<uint32_t>(std::clamp(firstX + static_cast<int32_t>(x), 0, lastX));
+
+	const uint32_t* texels = reinterpret_cast<const uint32_t*>(chain.data() + level.offset);
+	uint32_t* slot = reinterpret_cast<uint32_t*>(out);
+	for (uint32_t y = 0; y < VT_SLOT_SIZE; ++y)
+	{
+		const uint32_t* row = texels + size_t(std::clamp(firstY + static_cast<int32_t>(y), 0, lastY)) * level.width;
+		for (uint32_t x = 0; x < VT_SLOT_SIZE; ++x)
+			slot[size_t(y) * VT_SLOT_SIZE + x] = row[columns[x]];
+	}
+}
+
+VirtualTextureStreamer::~VirtualTextureStreamer()
+{
+	stop();
+}
+
+uint32_t VirtualTextureStreamer::addTexture(const std::string& path, uint32_t width, uint32_t height)
+{
+	if (mTextures.size() == VT_MAX_TEXTURES)
+		throw std::runtime_error("virtual texture: more than " + std::to_string(VT_MAX_TEXTURES) + " textures");
+	// every texture's last mip gets pinned, and there has to be room left over to stream into.
+	if (mTextures.size() + 1 > VT_ATLAS_SLOTS * VT_ATLAS_SLOTS / 2)
+		throw std::runtime_error("virtual texture: too many textures for the page atlas");
+
+	Texture texture;
+	texture.path = path;
+	texture.layout = layoutVirtualTexture(width, height);
+	for (uint32_t mip = 0; mip < texture.layout.mipCount; ++mip)
+		texture.pageTable.emplace_back(size_t(texture.layout.tableWidth(mip)) * texture.layout.tableHeight(mip), 0);
+	// everything starts out empty, which still has to go up once.
+	texture.dirty.assign(texture.layout.mipCount, true);
+	mTextures.push_back(std::move(texture));
+	return static_cast<uint32_t>(mTextures.size() - 1);
+}
+
+void VirtualTextureStreamer::start(unsigned threadCount)
+{
+	mSlots.assign(VT_ATLAS_SLOTS * VT_ATLAS_SLOTS, Slot());
+	mSources.assign(mTextures.size(), nullptr);
+	mLoading.assign(mTextures.size(), false);
+	mFailedSources.assign(mTextures.size(), false);
+
+	// every texture's single last page first, that's the fallback for all the others.
+	for (uint32_t t = 0; t < mTextures.size(); ++t)
+		mQueue.push_back(packPageId(t, mTextures[t].layout.mipCount - 1, 0, 0));
+
+	mStop = false;
+	for (unsigned i = 0; i < std::max(1u, threadCount); ++i)
+		mThreads.emplace_back(&VirtualTextureStreamer::worker, this);
+}
+
+void VirtualTextureStreamer::stop()
+{
+	{
+		// under the lock, or a worker could miss the wake up between checking and sleeping.
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStop = true;
+	}
+	mWork.notify_all();
+	for (std::thread& thread : mThreads)
+		thread.join();
+	mThreads.clear();
+}
+
+void VirtualTextureStreamer::processFeedback(const uint32_t* requests, size_t count, uint64_t frameNumber)
+{
+	TRACE_FUNCTION();
+	// most of the tiles ask for the same few pages.
+	std::unordered_map<uint32_t, uint32_t> hits;
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (requests[i] != VT_FEEDBACK_EMPTY)
+			++hits[requests[i]];
+	}
+
+	std::unordered_map<uint32_t, uint32_t> wanted;
+	for (const auto& request : hits)
+	{
+		PageId page = unpackPageId(request.first);
+		if (page.texture >= mTextures.size())
+			continue;
+		Texture& texture = mTextures[page.texture];
+		const VirtualTextureLayout& layout = texture.layout;
+		if (texture.failed || page.mip >= layout.mipCount || page.x >= layout.tableWidth(page.mip) || page.y >= layout.tableHeight(page.mip))
+			continue;
+
+		// whatever's drawn for it now is in use, whether it's the page itself or one standing in.
+		uint32_t entry = texture.pageTable[page.mip][size_t(page.y) * layout.tableWidth(page.mip) + page.x];
+		if (entryValid(entry))
+			mSlots[(entry & 0xFF) + ((entry >> 8) & 0xFF) * VT_ATLAS_SLOTS].lastUsed = frameNumber;
+		if (entryValid(entry) && entryMip(entry) == page.mip)
+			continue;
+
+		// the next mip down from what's standing in gets the page's hits as well, so it sharpens a step at a time
+		// even when the page itself is far down the queue.
+		uint32_t from = entryValid(entry) ? entryMip(entry) : layout.mipCount;
+		uint32_t step = from - 1;
+		wanted[packPageId(page.texture, step, page.x >> (step - page.mip), page.y >> (step - page.mip))] += request.second;
+		if (step != page.mip)
+			wanted[request.first] += request.second;
+	}
+
+	std::vector<std::pair<uint32_t, uint32_t>> ordered(wanted.begin(), wanted.end());
+	std::sort(ordered.begin(), ordered.end(), [](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b)
+	{
+		uint32_t mipA = unpackPageId(a.first).mip, mipB = unpackPageId(b.first).mip;
+		if (mipA != mipB)
+			return mipA > mipB;
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	});
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mQueue.clear();
+	for (const auto& request : ordered)
+	{
+		if (!mPending.count(request.first))
+			mQueue.push_back(request.first);
+	}
+	mWork.notify_all();
+}
+
+void VirtualTextureStreamer::takePages(std::vector<VirtualPage>& pages, size_t maxPages, uint64_t frameNumber)
+{
+	TRACE_FUNCTION();
+	pages.clear();
+	std::vector<ReadyPage> ready;
+	std::vector<std::pair<uint32_t, std::string>> errors;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		while (ready.size() < maxPages && !mReady.empty())
+		{
+			ready.push_back(std::move(mReady.front()));
+			mReady.pop_front();
+		}
+		errors.swap(mErrors);
+	}
+
+	for (const auto& error : errors)
+	{
+		std::cerr << "virtual texture " << error.second << ", it won't stream" << std::endl;
+		mTextures[error.first].failed = true;
+	}
+
+	size_t placed = 0;
+	for (; placed < ready.size(); ++placed)
+	{
+		uint32_t slot = allocateSlot(frameNumber);
+		if (slot == UINT32_MAX)
+			break;
+
+		PageId page = unpackPageId(ready[placed].id);
+		Texture& texture = mTextures[page.texture];
+		mSlots[slot].id = ready[placed].id;
+		mSlots[slot].lastUsed = frameNumber;
+		mSlots[slot].pinned = page.mip == texture.layout.mipCount - 1;
+		updateSubtree(texture, page.mip, page.x, page.y, true, packPageEntry(slot % VT_ATLAS_SLOTS, slot / VT_ATLAS_SLOTS, page.mip));
+
+		VirtualPage out;
+		out.id = ready[placed].id;
+		out.slot = slot;
+		out.texels = std::move(ready[placed].texels);
+		pages.push_back(std::move(out));
+		++mUploaded;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (size_t i = 0; i < placed; ++i)
+		mPending.erase(ready[i].id);
+	// no room this frame, they go back to the front for the next one.
+	for (size_t i = ready.size(); i > placed; --i)
+		mReady.push_front(std::move(ready[i - 1]));
+	mWork.notify_all();
+}
+
+bool VirtualTextureStreamer::takeDirty(uint32_t texture, uint32_t mip)
+{
+	bool dirty = mTextures[texture].dirty[mip];
+	mTextures[texture].dirty[mip] = false;
+	return dirty;
+}
+
+VirtualTextureStats VirtualTextureStreamer::stats() const
+{
+	VirtualTextureStats stats;
+	stats.uploaded = mUploaded;
+	stats.evicted = mEvicted;
+	for (const Slot& slot : mSlots)
+		stats.resident += slot.id != VT_FEEDBACK_EMPTY;
+	std::lock_guard<std::mutex> lock(mMutex);
+	stats.sourcesDecoded = mSourcesDecoded;
+	return stats;
+}
+
+uint32_t VirtualTextureStreamer::allocateSlot(uint64_t frameNumber)
+{
+	// an empty slot if there is one, otherwise the page that's gone longest without being sampled. Anything sampled
+	// in the latest feedback stays, pages just placed count as sampled too.
+	uint32_t oldest = UINT32_MAX;
+	for (uint32_t slot = 0; slot < mSlots.size(); ++slot)
+	{
+		if (mSlots[slot].id == VT_FEEDBACK_EMPTY)
+			return slot;
+		if (!mSlots[slot].pinned && mSlots[slot].lastUsed < frameNumber && (oldest == UINT32_MAX || mSlots[slot].lastUsed < mSlots[oldest].lastUsed))
+			oldest = slot;
+	}
+	if (oldest != UINT32_MAX)
+		evict(oldest);
+	return oldest;
+}
+
+void VirtualTextureStreamer::evict(uint32_t slot)
+{
+	PageId page = unpackPageId(mSlots[slot].id);
+	Texture& texture = mTextures[page.texture];
+	// whatever stands in for the parent stands in for this page now. The last mip is pinned, so there's a parent.
+	uint32_t parentMip = page.mip + 1;
+	uint32_t parent = texture.pageTable[parentMip][size_t(page.y >> 1) * texture.layout.tableWidth(parentMip) + (page.x >> 1)];
+	updateSubtree(texture, page.mip, page.x, page.y, false, parent);
+	mSlots[slot] = Slot();
+	++mEvicted;
+}
+
+void VirtualTextureStreamer::updateSubtree(Texture& texture, uint32_t mip, uint32_t x, uint32_t y, bool resident, uint32_t entry)
+{
+	const VirtualTextureLayout& layout = texture.layout;
+	for (uint32_t level = mip + 1; level-- > 0;)
+	{
+		uint32_t shift = mip - level;
+		uint32_t tableWidth = layout.tableWidth(level), tableHeight = layout.tableHeight(level);
+		uint32_t endX = std::min(tableWidth, (x + 1) << shift), endY = std::min(tableHeight, (y + 1) << shift);
+		std::vector<uint32_t>& table = texture.pageTable[level];
+		for (uint32_t ty = y << shift; ty < endY; ++ty)
+		{
+			for (uint32_t tx = x << shift; tx < endX; ++tx)
+			{
+				uint32_t& current = table[size_t(ty) * tableWidth + tx];
+				// placing: anything showing a coarser page (or nothing) gets this one. Evicting: anything showing
+				// this one falls back.
+				bool replace = resident ? !entryValid(current) || entryMip(current) > mip : entryValid(current) && entryMip(current) == mip;
+				if (replace)
+				{
+					current = entry;
+					texture.dirty[level] = true;
+				}
+			}
+		}
+	}
+}
+
+size_t VirtualTextureStreamer::findWork() const
+{
+	// a texture that's being decoded is waited for by the worker decoding it, not by a second one.
+	for (size_t i = 0; i < mQueue.size(); ++i)
+	{
+		uint32_t texture = unpackPageId(mQueue[i]).texture;
+		if (!mLoading[texture] && !mFailedSources[texture])
+			return i;
+	}
+	return SIZE_MAX;
+}
+
+void VirtualTextureStreamer::trimSources(uint32_t keep)
+{
+	while (mSourceBytes > VT_SOURCE_BUDGET)
+	{
+		uint32_t oldest = UINT32_MAX;
+		for (uint32_t t = 0; t < mSources.size(); ++t)
+		{
+			if (t != keep && mSources[t] && (oldest == UINT32_MAX || mSources[t]->lastUsed < mSources[oldest]->lastUsed))
+				oldest = t;
+		}
+		if (oldest == UINT32_MAX)
+			return; // just the one, however big it is
+		// a worker that's still cutting a page out of it holds its own reference.
+		mSourceBytes -= mSources[oldest]->chain.size();
+		mSources[oldest] = nullptr;
+	}
+}
+
+void VirtualTextureStreamer::worker()
+{
+	if (Tracer::get().isEnabled())
+		Tracer::get().setThreadName("virtual texture stream");
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true)
+	{
+		size_t next = SIZE_MAX;
+		mWork.wait(lock, [&]()
+		{
+			if (mStop)
+				return true;
+			if (mReady.size() + mDecoding >= VT_READY_DEPTH)
+				return false;
+			next = findWork();
+			return next != SIZE_MAX;
+		});
+		if (mStop)
+			return;
+
+		uint32_t id = mQueue[next];
+		mQueue.erase(mQueue.begin() + next);
+		mPending.insert(id);
+		++mDecoding;
+
+		PageId page = unpackPageId(id);
+		std::shared_ptr<Source> source = mSources[page.texture];
+		bool decode = !source;
+		if (decode)
+			mLoading[page.texture] = true;
+		else
+			source->lastUsed = ++mSourceClock;
+		lock.unlock();
+
+		ReadyPage ready;
+		ready.id = id;
+		std::string error;
+		try
+		{
+			TRACE_ZONE("virtualTexturePage");
+			if (decode)
+			{
+				source = std::make_shared<Source>();
+				decodeSource(mTextures[page.texture].path, mTextures[page.texture].layout, source->chain, source->levels);
+			}
+			ready.texels.resize(VT_SLOT_BYTES);
+			copyPage(ready.texels.data(), source->chain, source->levels[page.mip], page.x, page.y);
+		}
+		catch (const std::exception& e)
+		{
+			error = e.what();
+		}
+
+		lock.lock();
+		--mDecoding;
+		if (decode)
+		{
+			mLoading[page.texture] = false;
+			if (error.empty())
+			{
+				source->lastUsed = ++mSourceClock;
+				mSources[page.texture] = source;
+				mSourceBytes += source->chain.size();
+				++mSourcesDecoded;
+				trimSources(page.texture);
+			}
+		}
+
+		if (error.empty())
+			mReady.push_back(std::move(ready));
+		else
+		{
+			mPending.erase(id);
+			mFailedSources[page.texture] = true;
+			mErrors.push_back({ page.texture, error });
+		}
+		// the texture isn't loading any more, so its requests are up for grabs.
+		mWork.notify_all();
+	}
+}
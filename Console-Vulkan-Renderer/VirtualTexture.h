@@ -0,0 +1,193 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include "Mipmaps.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Software virtual texturing (--virtual-textures). No sparse residency, just plain images:
+// - every texture is cut into VT_PAGE_SIZE pages at every mip, and only the pages something has actually sampled
+//   live on the GPU, in slots of one fixed size atlas (the physical page cache).
+// - each texture has a page table image, one texel per page per mip, saying which slot the page is in. A page that
+//   isn't resident points at its nearest resident ancestor instead, so there's always something blurrier to draw.
+// - the fragment shader writes which page it wanted into a feedback buffer, one pixel per VT_FEEDBACK_TILE square.
+//   The CPU reads that back once the frame's fence has signalled, a couple of frames later, so nothing ever stalls.
+// - VirtualTextureStreamer turns the feedback into a prioritised list of missing pages, and its worker threads cut
+//   them out of the decoded images. The renderer takes a few ready pages a frame, copies them into the atlas
+//   (evicting the least recently used) and uploads whatever changed in the page tables.
+//
+// The streamer owns the CPU side: page tables, which page is in which slot, requests and decoding. It doesn't touch
+// vulkan, the renderer does the uploads. shader.frag built with VIRTUAL_TEXTURE is the GPU side, the constants and
+// the page table / feedback encodings below have to match it.
+
+const uint32_t VT_PAGE_SIZE = 128; // texels along a page's side
+const uint32_t VT_PAGE_BORDER = 4; // texels copied in from the neighbours on every side, so filtering never leaves the page
+const uint32_t VT_SLOT_SIZE = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER; // a page with its border, in the atlas
+const size_t VT_SLOT_BYTES = size_t(VT_SLOT_SIZE) * VT_SLOT_SIZE * 4; // RGBA8
+const uint32_t VT_ATLAS_SLOTS = 16; // along each side of the atlas, 256 pages (2176 x 2176, 18.5MB)
+const uint32_t VT_FEEDBACK_TILE = 8; // one feedback sample per 8x8 pixels, a different pixel of the tile each frame
+const uint32_t VT_FEEDBACK_EMPTY = 0xFFFFFFFF; // what the feedback buffer gets cleared to
+const uint32_t VT_FEEDBACK_HEADER = 2; // uints ahead of the requests: jitter (x | y << 8) and tiles per row
+const uint32_t VT_MAX_TEXTURES = 255; // texture 255 would look like VT_FEEDBACK_EMPTY
+const size_t VT_MAX_PAGES_PER_FRAME = 16; // pages copied into the atlas per frame at most
+const size_t VT_READY_DEPTH = 2 * VT_MAX_PAGES_PER_FRAME; // decoded pages the workers can get ahead of the uploads by
+const size_t VT_SOURCE_BUDGET = size_t(1024) * 1024 * 1024; // decoded images the workers keep around to cut pages from
+const unsigned VT_STREAM_THREADS = 2;
+
+// a page's address, packed the way the shader writes it into the feedback buffer: x and y 10 bits each, then the
+// mip (4 bits) and the texture (8 bits).
+struct PageId
+{
+	uint32_t texture, mip, x, y;
+};
+
+inline uint32_t packPageId(uint32_t texture, uint32_t mip, uint32_t x, uint32_t y)
+{
+	return x | y << 10 | mip << 20 | texture << 24;
+}
+
+inline PageId unpackPageId(uint32_t id)
+{
+	return { id >> 24, (id >> 20) & 0xF, id & 0x3FF, (id >> 10) & 0x3FF };
+}
+
+// a page table texel, R8G8B8A8_UINT: the slot's x and y in the atlas, the mip of the page that's actually in it
+// (coarser than the texel's own mip if it's standing in) and whether anything is resident at all.
+inline uint32_t packPageEntry(uint32_t slotX, uint32_t slotY, uint32_t mip)
+{
+	return slotX | slotY << 8 | mip << 16 | 1u << 24;
+}
+
+// how a texture maps onto pages. The page counts get rounded up to powers of two so every mip halves the page table
+// exactly, and the texels past the real image repeat its last row / column.
+struct VirtualTextureLayout
+{
+	uint32_t width = 0, height = 0; // of the image itself
+	uint32_t pagesX = 0, pagesY = 0; // at mip 0
+	uint32_t mipCount = 0; // page table mips. The last one is a single page covering everything.
+
+	uint32_t virtualWidth() const { return pagesX * VT_PAGE_SIZE; }
+	uint32_t virtualHeight() const { return pagesY * VT_PAGE_SIZE; }
+	uint32_t tableWidth(uint32_t mip) const { return pagesX >> mip ? pagesX >> mip : 1; }
+	uint32_t tableHeight(uint32_t mip) const { return pagesY >> mip ? pagesY >> mip : 1; }
+};
+
+VirtualTextureLayout layoutVirtualTexture(uint32_t width, uint32_t height);
+
+// one decoded page, with its border, on its way into atlas slot slot.
+struct VirtualPage
+{
+	uint32_t id;
+	uint32_t slot; // slot % VT_ATLAS_SLOTS across, slot / VT_ATLAS_SLOTS down
+	std::vector<unsigned char> texels; // VT_SLOT_SIZE square, RGBA8
+};
+
+struct VirtualTextureStats
+{
+	size_t uploaded = 0; // pages handed out by takePages
+	size_t evicted = 0;
+	size_t resident = 0;
+	size_t sourcesDecoded = 0; // whole images decoded, counting ones decoded again after being dropped for the budget
+};
+
+class VirtualTextureStreamer
+{
+public:
+	~VirtualTextureStreamer();
+
+	// before start. path is decoded with stb_image when one of its pages is first wanted. Returns its index, which
+	// is what the shader writes into the feedback.
+	uint32_t addTexture(const std::string& path, uint32_t width, uint32_t height);
+	void start(unsigned threadCount = VT_STREAM_THREADS);
+	void stop(); // joins the workers. Called by the destructor too.
+
+	size_t textureCount() const { return mTextures.size(); }
+	const VirtualTextureLayout& layout(uint32_t texture) const { return mTextures[texture].layout; }
+
+	// main thread, with a finished frame's feedback requests. Marks what was sampled as used in frameNumber and
+	// replaces the workers' queue with whatever's missing: coarsest first, so the picture sharpens a mip at a time,
+	// then by how many tiles asked for it.
+	void processFeedback(const uint32_t* requests, size_t count, uint64_t frameNumber);
+	// main thread: up to maxPages decoded pages, each given an atlas slot (evicting the least recently used page that
+	// wasn't sampled in frameNumber). The page tables are updated to match. Fewer if the atlas is all in use.
+	void takePages(std::vector<VirtualPage>& pages, size_t maxPages, uint64_t frameNumber);
+
+	// the page table at mip, tableWidth x tableHeight packPageEntry texels (0 for nothing resident).
+	const std::vector<uint32_t>& pageTable(uint32_t texture, uint32_t mip) const { return mTextures[texture].pageTable[mip]; }
+	// whether mip has changed since this was last asked, for the upload.
+	bool takeDirty(uint32_t texture, uint32_t mip);
+
+	VirtualTextureStats stats() const;
+
+private:
+	struct Texture
+	{
+		std::string path;
+		VirtualTextureLayout layout;
+		std::vector<std::vector<uint32_t>> pageTable; // per mip, row major. Main thread only.
+		std::vector<bool> dirty; // per mip
+		bool failed = false; // main thread's copy, its requests get dropped
+	};
+
+	// a decoded image, mips and all, at the padded virtual size.
+	struct Source
+	{
+		std::vector<unsigned char> chain;
+		std::vector<MipLevel> levels;
+		uint64_t lastUsed = 0;
+	};
+
+	struct Slot
+	{
+		uint32_t id = VT_FEEDBACK_EMPTY;
+		uint64_t lastUsed = 0; // frame
+		bool pinned = false; // a texture's last mip, its fallback for everything, stays once it's in
+	};
+
+	struct ReadyPage
+	{
+		uint32_t id;
+		std::vector<unsigned char> texels;
+	};
+
+	void worker();
+	size_t findWork() const; // first queued request a worker can take now, or SIZE_MAX. mMutex held.
+	void trimSources(uint32_t keep); // drop decoded images until under VT_SOURCE_BUDGET. mMutex held.
+	uint32_t allocateSlot(uint64_t frameNumber); // UINT32_MAX if everything was used this frame
+	void evict(uint32_t slot);
+	// points every texel under page (mip, x, y) that shows something coarser than mip at entry, or on eviction every
+	// one showing exactly mip at whatever stands in for the page now.
+	void updateSubtree(Texture& texture, uint32_t mip, uint32_t x, uint32_t y, bool resident, uint32_t entry);
+
+	std::vector<Texture> mTextures;
+	std::vector<Slot> mSlots;
+	size_t mUploaded = 0, mEvicted = 0;
+
+	// shared with the workers
+	mutable std::mutex mMutex;
+	std::condition_variable mWork; // workers wait on this for requests or room in mReady
+	std::vector<uint32_t> mQueue; // page ids, most wanted first
+	std::unordered_set<uint32_t> mPending; // being decoded or in mReady, so not requested again
+	std::deque<ReadyPage> mReady;
+	std::vector<std::shared_ptr<Source>> mSources; // per texture, null when it isn't decoded
+	std::vector<bool> mLoading; // per texture, a worker is decoding it
+	std::vector<bool> mFailedSources; // per texture, couldn't be decoded
+	std::vector<std::pair<uint32_t, std::string>> mErrors; // texture, why. Reported (and marked failed) by the next takePages
+	size_t mSourceBytes = 0;
+	uint64_t mSourceClock = 0;
+	size_t mSourcesDecoded = 0;
+	size_t mDecoding = 0; // pages the workers are cutting out right now, they count towards VT_READY_DEPTH
+	bool mStop = false;
+	std::vector<std::thread> mThreads;
+};
+
+#endif // !VIRTUAL_TEXTURE_H
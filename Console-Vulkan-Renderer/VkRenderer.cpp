@@ -1,6 +1,10 @@
 #include "VkRenderer.h"
 #include <set> // so that we can create sets of queueFamilyIndices.
 #include <cstdint> // gives us access to UINT32_MAX
+#include <iomanip> // mesh stats table
+#include <limits>
+#include <filesystem>
+#include <map> // submesh grouping, texture dedup
 // Used for texture loading.
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -27,17 +31,186 @@ void destroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
 		func(instance, debugMessenger, pAllocator);
 }
 
+// bytes per vertex attribute for the formats our vertices use.
+static uint32_t vertexFormatSize(VkFormat format)
+{
+	switch (format)
+	{
+	case VK_FORMAT_R32G32B32_SFLOAT: return 12;
+	case VK_FORMAT_R32G32_SFLOAT: return 8;
+	case VK_FORMAT_R16G16B16A16_UNORM: return 8;
+	case VK_FORMAT_R16G16_UNORM: return 4;
+	case VK_FORMAT_R16G16_SNORM: return 4;
+	default: throw std::runtime_error("vertexFormatSize: unhandled vertex attribute format");
+	}
+}
+
+VertexStreamLayout makeVertexStreamLayout(VertexFormat format, bool split, uint32_t streamMask)
+{
+	VertexStreamLayout layout;
+
+	std::vector<VkVertexInputAttributeDescription> interleaved;
+	VkVertexInputBindingDescription interleavedBinding;
+	if (format == VERTEX_FORMAT_COMPACT)
+	{
+		auto attributes = CompactVertex::getAttributeDescriptions();
+		interleaved.assign(attributes.begin(), attributes.end());
+		interleavedBinding = CompactVertex::getBindingDescription();
+	}
+	else
+	{
+		auto attributes = Vertex::getAttributeDescriptions();
+		interleaved.assign(attributes.begin(), attributes.end());
+		interleavedBinding = Vertex::getBindingDescription();
+	}
+
+	if (!split)
+	{
+		// one binding, and the position only case still has to step over the whole vertex.
+		layout.bindings.push_back(interleavedBinding);
+		for (const VkVertexInputAttributeDescription& attribute : interleaved)
+		{
+			if (!(streamMask & VERTEX_STREAM_ATTRIBUTES) && attribute.location != 0)
+				continue;
+			layout.attributes.push_back(attribute);
+			layout.sourceOffsets.push_back(attribute.offset);
+			layout.sizes.push_back(vertexFormatSize(attribute.format));
+		}
+		return layout;
+	}
+
+	// location 0 (position) goes in binding 0, everything else packs into binding 1 in location order.
+	VkVertexInputBindingDescription streams[2] = {};
+	for (uint32_t binding = 0; binding < 2; ++binding)
+	{
+		streams[binding].binding = binding;
+		streams[binding].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	}
+
+	for (const VkVertexInputAttributeDescription& attribute : interleaved)
+	{
+		uint32_t binding = attribute.location == 0 ? 0 : 1;
+		uint32_t size = vertexFormatSize(attribute.format);
+
+		VkVertexInputAttributeDescription packed = attribute;
+		packed.binding = binding;
+		packed.offset = streams[binding].stride;
+		streams[binding].stride += size;
+
+		uint32_t bit = binding == 0 ? VERTEX_STREAM_POSITION : VERTEX_STREAM_ATTRIBUTES;
+		if (streamMask & bit)
+		{
+			layout.attributes.push_back(packed);
+			layout.sourceOffsets.push_back(attribute.offset);
+			layout.sizes.push_back(size);
+		}
+	}
+
+	for (uint32_t binding = 0; binding < 2; ++binding)
+	{
+		uint32_t bit = binding == 0 ? VERTEX_STREAM_POSITION : VERTEX_STREAM_ATTRIBUTES;
+		if (streamMask & bit)
+			layout.bindings.push_back(streams[binding]);
+	}
+
+	return layout;
+}
+
+// one triangle corner straight out of the obj, before any welding.
+static Vertex makeCornerVertex(const ObjMesh& mesh, const ObjIndex& index)
+{
+	Vertex vertex;
+
+	// multiply by 3 to because these are floats, and will
+	// be converted to glm::vec3 things
+	vertex.mPos = {
+		mesh.positions[3 * index.vertex + 0],
+		mesh.positions[3 * index.vertex + 1],
+		mesh.positions[3 * index.vertex + 2]
+	};
+
+	// no vt on the face just means no texture coordinates.
+	if (index.texcoord >= 0)
+	{
+		vertex.mTexCoord = {
+			mesh.texcoords[2 * index.texcoord + 0],
+			1.0f - mesh.texcoords[2 * index.texcoord + 1]
+		};
+	}
+	else
+		vertex.mTexCoord = { 0.0f, 0.0f };
+
+	vertex.mNormal = {
+		mesh.normals[3 * index.normal + 0],
+		mesh.normals[3 * index.normal + 1],
+		mesh.normals[3 * index.normal + 2]
+	};
+
+	vertex.mColor = { 1.0f, 1.0f, 1.0f };
+	return vertex;
+}
+
+VulkanRenderer::VulkanRenderer(const RendererSettings& settings)
+	: mSettings(settings)
+{
+}
+
 void VulkanRenderer::run()
 {
-	initGLFWWindow();
+	if (!mSettings.tracePath.empty())
+	{
+		Tracer::get().setEnabled(true);
+		Tracer::get().setThreadName("main");
+	}
+
+	if (mSettings.kernelBenchmarkTriangles)
+	{
+		benchmarkMeshKernels(mSettings.kernelBenchmarkTriangles);
+		return;
+	}
+
+	if (mSettings.cookTextures)
+	{
+		cookTextures(TEXTURE_DIRECTORY, mSettings.cookFormat);
+		return;
+	}
+
+	// mesh stats only needs the CPU side of loading, no window or device.
+	if (mSettings.meshStats)
+	{
+		loadModel();
+		return;
+	}
+
+	// streamed chunks get welded on their own, so there's no whole mesh to quantize or split up front.
+	if (mSettings.streamMesh && (mSettings.vertexFormat != VERTEX_FORMAT_FULL || mSettings.splitVertexStreams))
+	{
+		std::cerr << "--stream-mesh uploads full interleaved vertices, ignoring --compact-vertices / --split-streams" << std::endl;
+		mSettings.vertexFormat = VERTEX_FORMAT_FULL;
+		mSettings.splitVertexStreams = false;
+	}
+
+	// headless mode never touches GLFW, so it runs on machines without a display.
+	if (!mSettings.headless)
+		initGLFWWindow();
+	StatClock::time_point startupStart = StatClock::now();
 	initVulkan();
+	std::cout << "Startup took " << elapsedMs(startupStart, StatClock::now()) << " ms ("
+		<< (mSettings.serialStartup ? "serial" : "job graph") << ")" << std::endl;
 	
 	runRenderer();
 	cleanRenderer();
+
+	if (!mSettings.tracePath.empty())
+	{
+		Tracer::get().dump(mSettings.tracePath);
+		std::cout << "Trace written to " << mSettings.tracePath << std::endl;
+	}
 }
 
 void VulkanRenderer::initGLFWWindow()
 {
+	TRACE_FUNCTION();
 	glfwInit();
 
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -49,36 +222,167 @@ void VulkanRenderer::initGLFWWindow()
 
 void VulkanRenderer::initVulkan()
 {
+	TRACE_FUNCTION();
+	if (mSettings.serialStartup)
+		initVulkanSerial();
+	else
+		initVulkanJobs();
+}
+
+void VulkanRenderer::initVulkanSerial()
+{
+	TRACE_FUNCTION();
 	createVkInstance();
 	createDebugMessenger();
-	createSurface();
+	if (!mSettings.headless)
+		createSurface();
 	findPhysicalDevice();
 	createLogicalDevice();
-	createSwapChain();
+	if (mSettings.headless)
+		createOffscreenTargets();
+	else
+		createSwapChain();
 	createImageViews();
 	createRenderPass();
+	createTextureSampler(); // before the layout, it's an immutable sampler in there
 	createDescriptorSetLayout();
+	readShaderFiles();
 	createGraphicsPipeline();
 	createCommandPool();
-	createDepthResources();
+	if (!mSettings.headless)
+		createDepthResources(); // offscreen targets bring their own depth buffers.
 	createFrameBuffers();
-	createTextureImage();
-	createTextureImageView();
-	createTextureSampler();
-	loadModel();
-	createVertexBuffer();
-	createIndexBuffer();
+	// the model comes first, its materials decide which textures get loaded.
+	if (mSettings.streamMesh)
+		beginMeshStream(); // the mesh fills in over the first frames instead.
+	else
+	{
+		loadModel();
+		createVertexBuffer();
+		createIndexBuffer();
+		mMeshCache.close(); // everything's on the GPU now, let go of the mapping if we had one.
+	}
+	openTextureImage();
+	openMaterialTextures();
+	if (mSettings.virtualTextures)
+		createVirtualTextures();
+	else
+	{
+		createTextureImage();
+		createTextureImageView();
+	}
 	createUniformBuffers();
+	createFeedbackBuffers();
+	createIndirectBuffers();
 	createDescriptorPool();
 	createDescriptorSet();
 	createCommandBuffers();
 	createSyncObjects();
+	// the uploads get going while the window comes up, the first frame doesn't need to wait for them.
+	mUploads.submit();
+}
+
+void VulkanRenderer::initVulkanJobs()
+{
+	TRACE_FUNCTION();
+	JobSystem jobs;
+
+	// asset work. None of it touches GLFW or vulkan, so it can run anywhere while the main thread builds the device.
+	Job* shaders = jobs.add("readShaderFiles", [this]() { readShaderFiles(); });
+	Job* model = mSettings.streamMesh ? nullptr : jobs.add("loadModel", [this]() { loadModel(); });
+
+	// the vulkan side stays on the main thread, in the same order as initVulkanSerial wherever one step needs another.
+	auto onMain = [&](const char* name, std::initializer_list<Job*> dependencies, std::function<void()> function)
+	{
+		return jobs.add(name, std::move(function), dependencies, JOB_MAIN_THREAD);
+	};
+
+	Job* instance = onMain("createVkInstance", {}, [this]()
+	{
+		createVkInstance();
+		createDebugMessenger();
+		if (!mSettings.headless)
+			createSurface();
+	});
+	Job* device = onMain("createLogicalDevice", { instance }, [this]()
+	{
+		findPhysicalDevice();
+		createLogicalDevice();
+	});
+	// textures only need the physical device, to turn away compressed formats it can't sample.
+	Job* texture = jobs.add("openTextureImage", [this]() { openTextureImage(); }, { device });
+	Job* swapChain = onMain("createSwapChain", { device }, [this]()
+	{
+		if (mSettings.headless)
+			createOffscreenTargets();
+		else
+			createSwapChain();
+		createImageViews();
+	});
+	Job* renderPass = onMain("createRenderPass", { swapChain }, [this]() { createRenderPass(); });
+	Job* setLayout = onMain("createDescriptorSetLayout", { device }, [this]()
+	{
+		createTextureSampler(); // immutable sampler in the layout
+		createDescriptorSetLayout();
+	});
+	Job* commandPool = onMain("createCommandPool", { device }, [this]() { createCommandPool(); });
+	Job* pipeline = onMain("createGraphicsPipeline", { renderPass, setLayout, shaders }, [this]() { createGraphicsPipeline(); });
+	Job* frameBuffers = onMain("createFrameBuffers", { renderPass }, [this]()
+	{
+		if (!mSettings.headless)
+			createDepthResources(); // offscreen targets bring their own depth buffers.
+		createFrameBuffers();
+	});
+	Job* mesh = onMain("createMeshBuffers", { device, model }, [this]()
+	{
+		if (mSettings.streamMesh)
+			beginMeshStream(); // the mesh fills in over the first frames instead.
+		else
+		{
+			createVertexBuffer();
+			createIndexBuffer();
+			mMeshCache.close(); // everything's on the GPU now, let go of the mapping if we had one.
+		}
+	});
+	// the default texture has to be in mTextures[0] before the materials' get appended. The materials come from
+	// loadModel, or from beginMeshStream (which clears them) when streaming.
+	Job* materialTextures = jobs.add("openMaterialTextures", [this]() { openMaterialTextures(); },
+		{ texture, mSettings.streamMesh ? mesh : model });
+	Job* textureImage = onMain("createTextureImage", { device, materialTextures }, [this]()
+	{
+		if (mSettings.virtualTextures)
+			createVirtualTextures();
+		else
+		{
+			createTextureImage();
+			createTextureImageView();
+		}
+	});
+	Job* uniforms = onMain("createUniformBuffers", { swapChain, mesh }, [this]()
+	{
+		createUniformBuffers();
+		createFeedbackBuffers();
+		createIndirectBuffers(); // starts out drawing LOD 0, so it needs the mesh
+	});
+	Job* descriptors = onMain("createDescriptorSet", { uniforms, setLayout, textureImage }, [this]()
+	{
+		createDescriptorPool();
+		createDescriptorSet();
+	});
+	onMain("createCommandBuffers", { descriptors, pipeline, frameBuffers, commandPool }, [this]()
+	{
+		createCommandBuffers();
+		createSyncObjects();
+		// the uploads get going while the window comes up, the first frame doesn't need to wait for them.
+		mUploads.submit();
+	});
+
+	jobs.waitAll();
 }
 
-// instance
-// create a single VkInstance
 void VulkanRenderer::createVkInstance()
 {
+	TRACE_FUNCTION();
 	if (enableValidationLayers && !checkValidationLayerSupport())
 		throw std::runtime_error("Validation layers are enabled, but none found or enabled.");
 
@@ -105,10 +409,6 @@ void VulkanRenderer::createVkInstance()
 	for (const auto& ext : extensions)
 		std::cout << ext.extensionName << std::endl;
 
-	const char** glfwExtensions;
-
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionsCount);
-
 
 	auto func_exts = getRequiredExtensions();
 	createInfo.enabledExtensionCount = static_cast<uint32_t>(func_exts.size());
@@ -148,6 +448,7 @@ void VulkanRenderer::populateDebugMessenger(VkDebugUtilsMessengerCreateInfoEXT&
 // create debug messenger that can display errors for validation layers.
 void VulkanRenderer::createDebugMessenger()
 {
+	TRACE_FUNCTION();
 	if (!enableValidationLayers)
 		return;
 
@@ -160,6 +461,7 @@ void VulkanRenderer::createDebugMessenger()
 
 void VulkanRenderer::findPhysicalDevice()
 {
+	TRACE_FUNCTION();
 	uint32_t deviceCt = 0;
 	vkEnumeratePhysicalDevices(mVkInstance, &deviceCt, nullptr);
 
@@ -195,6 +497,10 @@ bool VulkanRenderer::isDeviceSuitable(VkPhysicalDevice device)
 
 	QueueFamilyIndices ind = findQueueFamilies(device);
 
+	// no surface to present to in headless mode, so a graphics queue is all we need.
+	if (mSettings.headless)
+		return ind.isSomething();
+
 	bool extSupported = checkDeviceExtensionSupport(device);
 
 	bool goodSwapChain = false;
@@ -244,6 +550,19 @@ QueueFamilyIndices VulkanRenderer::findQueueFamilies(VkPhysicalDevice device)
 		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
 			indices.graphicsFamily = i;
 
+		// headless: nothing gets presented, so just point present at the graphics queue.
+		if (mSettings.headless)
+		{
+			if (indices.graphicsFamily.has_value())
+			{
+				indices.presentFamily = indices.graphicsFamily;
+				break;
+			}
+
+			++i;
+			continue;
+		}
+
 		// check if this device also supports presentation
 		VkBool32 presentSupport = false;
 		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, mSurface, &presentSupport);
@@ -262,6 +581,7 @@ QueueFamilyIndices VulkanRenderer::findQueueFamilies(VkPhysicalDevice device)
 
 void VulkanRenderer::createLogicalDevice()
 {
+	TRACE_FUNCTION();
 	// need to make queue info for the logical device, since it also has a lot of queues.
 	QueueFamilyIndices indices = findQueueFamilies(mPhysicalDevice);
 
@@ -289,8 +609,18 @@ void VulkanRenderer::createLogicalDevice()
 	}
 
 	// Get the features from the physical device to use from the logical device
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(mPhysicalDevice, &supportedFeatures);
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC; // for KTX2 / DDS textures
+	// virtual texturing's fragment shader writes its page requests into a storage buffer.
+	if (mSettings.virtualTextures)
+	{
+		if (!supportedFeatures.fragmentStoresAndAtomics)
+			throw std::runtime_error("--virtual-textures needs fragmentStoresAndAtomics, which this device doesn't have");
+		deviceFeatures.fragmentStoresAndAtomics = VK_TRUE;
+	}
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 
@@ -299,8 +629,12 @@ void VulkanRenderer::createLogicalDevice()
 
 	createInfo.pEnabledFeatures = &deviceFeatures;
 
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
-	createInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+	// the swap chain extension is useless (and maybe missing) without a surface.
+	if (!mSettings.headless)
+	{
+		createInfo.enabledExtensionCount = static_cast<uint32_t>(DEVICE_EXTENSIONS.size());
+		createInfo.ppEnabledExtensionNames = DEVICE_EXTENSIONS.data();
+	}
 
 	if (enableValidationLayers)
 	{
@@ -316,10 +650,17 @@ void VulkanRenderer::createLogicalDevice()
 	// get the queue now that everyone is set up.
 	vkGetDeviceQueue(mLogicalDevice, indices.graphicsFamily.value(), 0, &mGraphicsQueue);
 	vkGetDeviceQueue(mLogicalDevice, indices.presentFamily.value(), 0, &mPresentQueue);
+
+	mAllocator.create(mPhysicalDevice, mLogicalDevice);
+	// the CPU mip path reads back the levels it writes, which is painfully slow from uncached (write combined)
+	// memory, so take cached memory if the device has any.
+	mStaging.create(mLogicalDevice, mAllocator, STAGING_RING_SIZE, hostCachedMemoryProperties());
+	mUploads.create(mLogicalDevice, mGraphicsQueue, indices.graphicsFamily.value(), mStaging, mAllocator);
 }
 
 void VulkanRenderer::createSurface()
 {
+	TRACE_FUNCTION();
 	// we can let GLFW handle all the hard stuff for creating a surface, which is nice.
 	if (glfwCreateWindowSurface(mVkInstance, mWindow, nullptr, &mSurface) != VK_SUCCESS)
 		throw std::runtime_error("Couldn't create the window surface. Everything is broken.");
@@ -406,6 +747,7 @@ VkExtent2D VulkanRenderer::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capa
 // create the swap chain using everything we just did.
 void VulkanRenderer::createSwapChain()
 {
+	TRACE_FUNCTION();
 	SwapChainSupportDetails swapChainSupport = querySwapChainSupport(mPhysicalDevice);
 
 	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
@@ -459,6 +801,7 @@ void VulkanRenderer::createSwapChain()
 
 void VulkanRenderer::createImageViews()
 {
+	TRACE_FUNCTION();
 	mSwapChainImageViews.resize(mSwapChainImages.size());
 
 	for (size_t i = 0; i < mSwapChainImages.size(); ++i)
@@ -483,20 +826,24 @@ void VulkanRenderer::createImageViews()
 
 		//if (vkCreateImageView(mLogicalDevice, &createInfo, nullptr, &mSwapChainImageViews[i]) != VK_SUCCESS)
 		//	throw std::runtime_error("failed to create image views");
-		mSwapChainImageViews[i] = createImageView(mSwapChainImages[i], mSwapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+		mSwapChainImageViews[i] = createImageView(mSwapChainImages[i], mSwapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 	}
 }
 
 void VulkanRenderer::cleanupSwapChain()
 {
-	vkDestroyImageView(mLogicalDevice, mDepthImageView, nullptr);
-	vkDestroyImage(mLogicalDevice, mDepthImage, nullptr);
-	vkFreeMemory(mLogicalDevice, mDepthImageMemory, nullptr);
+	if (!mSettings.headless)
+	{
+		vkDestroyImageView(mLogicalDevice, mDepthImageView, nullptr);
+		vkDestroyImage(mLogicalDevice, mDepthImage, nullptr);
+		mAllocator.free(mDepthImageMemory);
+	}
 	for (size_t i = 0; i < mSwapChainFrameBuffers.size(); i++) {
 		vkDestroyFramebuffer(mLogicalDevice, mSwapChainFrameBuffers[i], nullptr);
 	}
 
 	vkFreeCommandBuffers(mLogicalDevice, mCommandPool, static_cast<uint32_t>(mCommandBuffers.size()), mCommandBuffers.data());
+	mGpuProfiler.destroy();
 
 	vkDestroyPipeline(mLogicalDevice, mGraphicsPipeline, nullptr);
 	vkDestroyPipelineLayout(mLogicalDevice, mPipelineLayout, nullptr);
@@ -506,11 +853,22 @@ void VulkanRenderer::cleanupSwapChain()
 		vkDestroyImageView(mLogicalDevice, mSwapChainImageViews[i], nullptr);
 	}
 
-	vkDestroySwapchainKHR(mLogicalDevice, mSwapChain, nullptr);
+	if (mSettings.headless)
+		cleanupOffscreenTargets();
+	else
+		vkDestroySwapchainKHR(mLogicalDevice, mSwapChain, nullptr);
 
+	vkDestroyBuffer(mLogicalDevice, mUniformRing, nullptr);
+	mAllocator.free(mUniformRingMemory);
 	for (size_t i = 0; i < mSwapChainImages.size(); i++) {
-		vkDestroyBuffer(mLogicalDevice, uniformBuffers[i], nullptr);
-		vkFreeMemory(mLogicalDevice, uniformBuffersMemory[i], nullptr);
+		vkDestroyBuffer(mLogicalDevice, mIndirectBuffers[i], nullptr);
+		mAllocator.free(mIndirectBuffersMemory[i]);
+	}
+	if (mFeedbackRing != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(mLogicalDevice, mFeedbackRing, nullptr);
+		mAllocator.free(mFeedbackRingMemory);
+		mFeedbackRing = VK_NULL_HANDLE;
 	}
 
 	vkDestroyDescriptorPool(mLogicalDevice, mDescriptorPool, nullptr);
@@ -518,6 +876,7 @@ void VulkanRenderer::cleanupSwapChain()
 
 void VulkanRenderer::recreateSwapChain()
 {
+	TRACE_FUNCTION();
 	int width = 0, height = 0;
 	glfwGetFramebufferSize(mWindow, &width, &height);
 	while (width == 0 || height == 0) 
@@ -537,17 +896,106 @@ void VulkanRenderer::recreateSwapChain()
 	createDepthResources();
 	createFrameBuffers();
 	createUniformBuffers();
+	createFeedbackBuffers();
+	createIndirectBuffers();
 	createDescriptorPool();
 	createDescriptorSet();
 	createCommandBuffers();
 }
 
+// headless version of createSwapChain. Makes a small ring of color images (plus depth) we can render into
+// without a surface, and puts the color images into mSwapChainImages so everything downstream just works.
+void VulkanRenderer::createOffscreenTargets()
+{
+	TRACE_FUNCTION();
+	// the swap chain would normally pick B8G8R8A8, but RGBA is easier to write out when reading back.
+	mSwapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	mSwapChainExtent = { mSettings.width, mSettings.height };
+
+	VkFormat depthFormat = findDepthFormat();
+	VkDeviceSize readbackSize = static_cast<VkDeviceSize>(mSettings.width) * mSettings.height * 4;
+
+	mSwapChainImages.resize(OFFSCREEN_IMAGE_COUNT);
+	mOffscreenTargets.resize(OFFSCREEN_IMAGE_COUNT);
+
+	for (uint32_t i = 0; i < OFFSCREEN_IMAGE_COUNT; ++i)
+	{
+		OffscreenTarget& target = mOffscreenTargets[i];
+
+		createImage(mSettings.width, mSettings.height, 1, mSwapChainImageFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			mSwapChainImages[i], target.colorMemory);
+
+		createImage(mSettings.width, mSettings.height, 1, depthFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, target.depthImage, target.depthMemory);
+		target.depthImageView = createImageView(target.depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+
+		if (mSettings.readback)
+		{
+			createBuffer(readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				target.readbackBuffer, target.readbackMemory);
+			target.readbackData = target.readbackMemory.mapped;
+		}
+	}
+}
+
+// the color images are owned by us here (not a swap chain), so they get destroyed by hand.
+void VulkanRenderer::cleanupOffscreenTargets()
+{
+	for (size_t i = 0; i < mOffscreenTargets.size(); ++i)
+	{
+		OffscreenTarget& target = mOffscreenTargets[i];
+
+		if (target.readbackBuffer != VK_NULL_HANDLE)
+		{
+			vkDestroyBuffer(mLogicalDevice, target.readbackBuffer, nullptr);
+			mAllocator.free(target.readbackMemory);
+		}
+
+		vkDestroyImageView(mLogicalDevice, target.depthImageView, nullptr);
+		vkDestroyImage(mLogicalDevice, target.depthImage, nullptr);
+		mAllocator.free(target.depthMemory);
+
+		vkDestroyImage(mLogicalDevice, mSwapChainImages[i], nullptr);
+		mAllocator.free(target.colorMemory);
+	}
+
+	mOffscreenTargets.clear();
+}
+
+// write a read back frame out as a binary PPM. Nothing fancy, but any image viewer opens it.
+void VulkanRenderer::writeReadbackImage(uint32_t imageIndex)
+{
+	const uint8_t* pixels = static_cast<const uint8_t*>(mOffscreenTargets[imageIndex].readbackData);
+
+	std::ofstream file(mSettings.readbackPath, std::ios::binary);
+	if (!file.is_open())
+		throw std::runtime_error("Failed to open the readback image for writing.");
+
+	file << "P6\n" << mSettings.width << " " << mSettings.height << "\n255\n";
+
+	std::vector<uint8_t> row(static_cast<size_t>(mSettings.width) * 3);
+	for (uint32_t y = 0; y < mSettings.height; ++y)
+	{
+		const uint8_t* src = pixels + static_cast<size_t>(y) * mSettings.width * 4;
+		for (uint32_t x = 0; x < mSettings.width; ++x)
+		{
+			row[x * 3 + 0] = src[x * 4 + 0];
+			row[x * 3 + 1] = src[x * 4 + 1];
+			row[x * 3 + 2] = src[x * 4 + 2];
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+}
+
 void VulkanRenderer::createDescriptorSetLayout()
 {
+	TRACE_FUNCTION();
 	VkDescriptorSetLayoutBinding uboLayoutBinding{};
 	uboLayoutBinding.binding = 0;
 	uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	// one set serves every swap chain image, the frame's piece of the uniform ring is picked by the dynamic offset.
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uboLayoutBinding.pImmutableSamplers = nullptr;
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
@@ -555,11 +1003,30 @@ void VulkanRenderer::createDescriptorSetLayout()
 	samplerLayoutBinding.binding = 1;
 	samplerLayoutBinding.descriptorCount = 1;
 	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
+	// every texture samples the same way, so the sampler is baked into the layout and the descriptor writes only
+	// carry image views.
+	samplerLayoutBinding.pImmutableSamplers = &mTextureSampler;
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, samplerLayoutBinding };
+	// virtual textures sample the page atlas at binding 1 instead, look pages up in 2 and write feedback into 3.
+	if (mSettings.virtualTextures)
+	{
+		bindings[1].pImmutableSamplers = &mPageAtlasSampler;
+
+		VkDescriptorSetLayoutBinding pageTableBinding = samplerLayoutBinding;
+		pageTableBinding.binding = 2;
+		pageTableBinding.pImmutableSamplers = &mPageTableSampler;
+		bindings.push_back(pageTableBinding);
+
+		VkDescriptorSetLayoutBinding feedbackBinding{};
+		feedbackBinding.binding = 3;
+		feedbackBinding.descriptorCount = 1;
+		feedbackBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		feedbackBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+		bindings.push_back(feedbackBinding);
+	}
 
-	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
 	VkDescriptorSetLayoutCreateInfo layoutInfo{};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -574,6 +1041,7 @@ void VulkanRenderer::createDescriptorSetLayout()
 // Need to create render passes for the pipeline.
 void VulkanRenderer::createRenderPass()
 {
+	TRACE_FUNCTION();
 	VkAttachmentDescription colorAttachment{};
 	colorAttachment.format = mSwapChainImageFormat;
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -582,7 +1050,8 @@ void VulkanRenderer::createRenderPass()
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// offscreen images never get presented, leave them ready to be copied out instead.
+	colorAttachment.finalLayout = mSettings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference colorAttachmentRef{};
 	colorAttachmentRef.attachment = 0;
@@ -616,6 +1085,17 @@ void VulkanRenderer::createRenderPass()
 	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+	// headless readback copies the color image right after the pass, so the copy has to wait on the writes.
+	VkSubpassDependency readbackDependency{};
+	readbackDependency.srcSubpass = 0;
+	readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+	readbackDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	std::array<VkSubpassDependency, 2> dependencies = { dependency, readbackDependency };
+
 	std::array<VkAttachmentDescription, 2> attachments = { colorAttachment, depthAttachment };
 	VkRenderPassCreateInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -623,8 +1103,8 @@ void VulkanRenderer::createRenderPass()
 	renderPassInfo.pAttachments = attachments.data();
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
+	renderPassInfo.dependencyCount = mSettings.headless ? 2 : 1;
+	renderPassInfo.pDependencies = dependencies.data();
 
 	if (vkCreateRenderPass(mLogicalDevice, &renderPassInfo, nullptr, &mRenderPass) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create render pass!");
@@ -634,13 +1114,21 @@ void VulkanRenderer::createRenderPass()
 /*
 This is a whole thing. Most of it can be found online.
 */
-void VulkanRenderer::createGraphicsPipeline()
+void VulkanRenderer::readShaderFiles()
 {
-	auto vertShaderCode = readFile("shaders/vert.spv");
-	auto fragShaderCode = readFile("shaders/frag.spv");
+	TRACE_FUNCTION();
+	// the compact format is the same shader.vert, built with COMPACT_VERTEX so it decodes the packed attributes.
+	bool compact = mSettings.vertexFormat == VERTEX_FORMAT_COMPACT;
+	mVertShaderCode = readFile(compact ? "shaders/vert_compact.spv" : "shaders/vert.spv");
+	// virtual textures are shader.frag built with VIRTUAL_TEXTURE, it looks pages up and writes the feedback.
+	mFragShaderCode = readFile(mSettings.virtualTextures ? "shaders/frag_virtual.spv" : "shaders/frag.spv");
+}
 
-	VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+void VulkanRenderer::createGraphicsPipeline()
+{
+	TRACE_FUNCTION();
+	VkShaderModule vertShaderModule = createShaderModule(mVertShaderCode);
+	VkShaderModule fragShaderModule = createShaderModule(mFragShaderCode);
 
 	VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
 	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -656,15 +1144,15 @@ void VulkanRenderer::createGraphicsPipeline()
 
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
-	auto bindingDesc = Vertex::getBindingDescription();
-	auto attributeDesc = Vertex::getAttributeDescriptions();
+	// the main pass reads every stream.
+	VertexStreamLayout vertexLayout = makeVertexStreamLayout(mSettings.vertexFormat, mSettings.splitVertexStreams, VERTEX_STREAM_ALL);
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDesc;
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDesc.size());;
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDesc.data(); // Optional
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexLayout.bindings.size());
+	vertexInputInfo.pVertexBindingDescriptions = vertexLayout.bindings.data();
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexLayout.attributes.size());
+	vertexInputInfo.pVertexAttributeDescriptions = vertexLayout.attributes.data(); // Optional
 
 	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
 	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -729,6 +1217,16 @@ void VulkanRenderer::createGraphicsPipeline()
 	pipelineLayoutInfo.setLayoutCount = 1;
 	pipelineLayoutInfo.pSetLayouts = &mDescriptorSetLayout;
 
+	std::array<VkPushConstantRange, 2> pushConstantRanges = {};
+	pushConstantRanges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRanges[0].offset = 0;
+	pushConstantRanges[0].size = sizeof(MeshDequantization);
+	pushConstantRanges[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRanges[1].offset = sizeof(MeshDequantization);
+	pushConstantRanges[1].size = sizeof(MaterialParams) + (mSettings.virtualTextures ? sizeof(VirtualTextureParams) : 0);
+	pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+	pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
 	if (vkCreatePipelineLayout(mLogicalDevice, &pipelineLayoutInfo, nullptr, &mPipelineLayout) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create pipeline layout!");
 	}
@@ -785,12 +1283,13 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
 
 void VulkanRenderer::createFrameBuffers()
 {
+	TRACE_FUNCTION();
 	mSwapChainFrameBuffers.resize(mSwapChainImageViews.size());
 
 	for (size_t i = 0; i < mSwapChainImageViews.size(); i++) {
 		std::array<VkImageView, 2> attachments = {
 			mSwapChainImageViews[i],
-			mDepthImageView
+			mSettings.headless ? mOffscreenTargets[i].depthImageView : mDepthImageView
 		};
 
 		VkFramebufferCreateInfo framebufferInfo{};
@@ -811,6 +1310,7 @@ void VulkanRenderer::createFrameBuffers()
 
 void VulkanRenderer::createCommandPool()
 {
+	TRACE_FUNCTION();
 	QueueFamilyIndices queueFamilyIndices = findQueueFamilies(mPhysicalDevice);
 	// create command pool per queue family index. I.e, in this case we want graphics
 	VkCommandPoolCreateInfo poolInfo = {};
@@ -821,7 +1321,7 @@ void VulkanRenderer::createCommandPool()
 		throw std::runtime_error("Error creating command pool");
 }
 
-void VulkanRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+void VulkanRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory)
 {
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -836,55 +1336,279 @@ void VulkanRenderer::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, V
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(mLogicalDevice, buffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+	// a piece of one of the allocator's blocks, bound at its offset.
+	bufferMemory = mAllocator.allocate(memRequirements, properties, true);
+	vkBindBufferMemory(mLogicalDevice, buffer, bufferMemory.memory, bufferMemory.offset);
+
+}
+
+bool VulkanRenderer::hashTexture(Texture& texture)
+{
+	// a cooked copy of the texture wins over the source.
+	std::string cookedPath = findCookedTexture(texture.path);
+	texture.loadPath = cookedPath.empty() ? texture.path : cookedPath;
+
+	std::error_code error;
+	if (!std::filesystem::is_regular_file(texture.loadPath, error))
+		return false;
+	MappedFile file(texture.loadPath);
+	texture.key.contentHash = hashContent(file.data(), file.size());
+	texture.key.format = VK_FORMAT_R8G8B8A8_SRGB; // every texture we load is a colour map
+	return true;
+}
 
-	if (vkAllocateMemory(mLogicalDevice, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate memory for buffer!");
+bool VulkanRenderer::openTexture(Texture& texture)
+{
+	// pre-compressed files keep their format and mips, and are used straight out of the mapping. Anything else just
+	// needs its size for now, createTextureImage decodes it.
+	if (loadTextureFile(texture.loadPath, texture.compressed))
+	{
+		// no CPU decoder to fall back on, so a device that can't sample the format can't have the texture.
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(mPhysicalDevice, texture.compressed.format, &properties);
+		if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+		{
+			std::cerr << texture.path << ": the device can't sample its format (" << texture.compressed.format << ")" << std::endl;
+			texture.compressed = TextureFile();
+			return false;
+		}
+		texture.format = texture.compressed.format;
+		texture.width = static_cast<int>(texture.compressed.width);
+		texture.height = static_cast<int>(texture.compressed.height);
+		return true;
 	}
 
-	vkBindBufferMemory(mLogicalDevice, buffer, bufferMemory, 0);
+	int texChannels;
+	return stbi_info(texture.loadPath.c_str(), &texture.width, &texture.height, &texChannels) != 0;
+}
 
+void VulkanRenderer::openTextureImage()
+{
+	TRACE_FUNCTION();
+	if (mTextures.empty())
+		mTextures.resize(1);
+
+	Texture& texture = mTextures[0];
+	texture.path = TEXTURE;
+	// nothing to fall back on for this one.
+	if (!hashTexture(texture) || !openTexture(texture))
+		throw std::runtime_error("failed to load " + TEXTURE);
 }
 
-void VulkanRenderer::createTextureImage()
+void VulkanRenderer::openMaterialTextures()
+{
+	TRACE_FUNCTION();
+
+	// one texture per distinct map_Kd, so materials that share a file share a descriptor set too. Different paths
+	// to the same bytes count as the same file. A texture that won't load isn't worth failing over, the material
+	// just falls back to TEXTURE.
+	std::map<std::string, uint32_t> textureIndex;
+	std::map<TextureKey, uint32_t> contentIndex = { { mTextures[0].key, 0 } };
+	mMaterialTextures.assign(mMaterials.size(), 0);
+	for (size_t m = 0; m < mMaterials.size(); ++m)
+	{
+		std::string path = mMaterials[m].mDiffuseTexture;
+		if (path.empty())
+			continue;
+
+		auto inserted = textureIndex.insert({ path, 0 });
+		if (inserted.second)
+		{
+			Texture texture;
+			texture.path = path;
+			bool loaded = false;
+			auto same = contentIndex.end();
+			try
+			{
+				if (hashTexture(texture))
+				{
+					same = contentIndex.find(texture.key);
+					loaded = same != contentIndex.end() || openTexture(texture);
+				}
+			}
+			catch (const std::runtime_error& e)
+			{
+				std::cerr << e.what() << std::endl;
+			}
+
+			if (same != contentIndex.end())
+				inserted.first->second = same->second;
+			else if (loaded)
+			{
+				inserted.first->second = static_cast<uint32_t>(mTextures.size());
+				contentIndex[texture.key] = inserted.first->second;
+				mTextures.push_back(std::move(texture));
+			}
+			else
+				std::cerr << "failed to load " << path << ", using " << TEXTURE << std::endl;
+		}
+		mMaterialTextures[m] = inserted.first->second;
+	}
+}
+
+VkMemoryPropertyFlags VulkanRenderer::hostCachedMemoryProperties()
 {
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(TEXTURE.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	VkDeviceSize imageSz = texWidth * texHeight * 4;
+	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+	{
+		VkMemoryPropertyFlags cached = properties | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		if ((memProperties.memoryTypes[i].propertyFlags & cached) == cached)
+			return cached;
+	}
+	return properties;
+}
 
-	if (!pixels)
-		throw std::runtime_error("failed to load");
+TextureUpload VulkanRenderer::planTextureUpload(Texture& texture, bool blitMipmaps)
+{
+	TextureUpload upload;
+	upload.texture = &texture;
+	if (texture.compressed.file)
+	{
+		// openTexture already turned away formats the device can't sample.
+		upload.levels = texture.compressed.levels;
+		upload.size = texture.compressed.size;
+		upload.mipLevels = static_cast<uint32_t>(upload.levels.size());
+		return upload;
+	}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	upload.size = layoutMipChain(static_cast<uint32_t>(texture.width), static_cast<uint32_t>(texture.height), upload.levels);
+	upload.mipLevels = static_cast<uint32_t>(upload.levels.size());
+	upload.blitMipmaps = blitMipmaps;
+	if (blitMipmaps)
+	{
+		upload.levels.resize(1); // just level 0 goes up
+		upload.size = VkDeviceSize(texture.width) * texture.height * 4;
+	}
+	return upload;
+}
 
-	createBuffer(imageSz, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		stagingBuffer, stagingBufferMemory);
+void VulkanRenderer::decodeTexture(TextureUpload& upload, unsigned mipThreads)
+{
+	TRACE_FUNCTION();
+	const Texture& texture = *upload.texture;
+	if (texture.compressed.file)
+	{
+		const TextureFile& file = texture.compressed;
+		for (size_t i = 0; i < file.levels.size(); ++i)
+			memcpy(upload.mapped + file.levels[i].offset, file.levelData[i], textureLevelSize(file.format, file.levels[i].width, file.levels[i].height));
+		return;
+	}
 
-	void* data;
-	vkMapMemory(mLogicalDevice, stagingBufferMemory, 0, imageSz, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSz));
-	vkUnmapMemory(mLogicalDevice, stagingBufferMemory);
+	// texcoords get flipped when the model loads, so images never are. Set per thread so nothing else's setting matters.
+	stbi_set_flip_vertically_on_load_thread(0);
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(texture.loadPath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels || width != texture.width || height != texture.height)
+	{
+		upload.error = texture.loadPath + ": " + (pixels ? "changed size since it was opened" : stbi_failure_reason());
+		stbi_image_free(pixels);
+		return;
+	}
 
+	// stb_image only decodes into memory of its own, so this is the one copy. The mips get built in place after it.
+	memcpy(upload.mapped, pixels, size_t(width) * height * 4);
 	stbi_image_free(pixels);
+	if (!upload.blitMipmaps)
+		generateMipChain(upload.mapped, upload.levels, mipThreads);
+}
 
-	createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mTextureImage, mTextureImageMemory);
+void VulkanRenderer::createTextureImage()
+{
+	TRACE_FUNCTION();
+	// the GPU builds the mips when it can filter the format, otherwise they're built in staging and uploaded with level 0.
+	bool blitMipmaps = canBlitMipmaps(VK_FORMAT_R8G8B8A8_SRGB);
 
-	transitionImageLayout(mTextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	copyBufferToImage(stagingBuffer, mTextureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-	transitionImageLayout(mTextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-	
-	vkDestroyBuffer(mLogicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(mLogicalDevice, stagingBufferMemory, nullptr);
+	// already up there for someone else, just take another reference.
+	std::vector<Texture*> pending;
+	for (Texture& texture : mTextures)
+	{
+		texture.handle = mTextureCache.acquire(texture.key);
+		if (texture.handle == INVALID_TEXTURE_HANDLE)
+			pending.push_back(&texture);
+		else
+			texture.compressed = TextureFile();
+	}
+
+	// as many textures as fit in the staging ring get decoded straight into it, one per worker, then go up
+	// together. One that's too big for the whole ring gets a staging buffer of its own.
+	unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+	for (size_t next = 0; next < pending.size();)
+	{
+		std::vector<TextureUpload> batch;
+		while (next < pending.size())
+		{
+			TextureUpload upload = planTextureUpload(*pending[next], blitMipmaps);
+			StagingRegion region;
+			if (mStaging.allocate(upload.size, TEXTURE_STAGING_ALIGNMENT, region))
+			{
+				upload.buffer = region.buffer;
+				upload.offset = region.offset;
+				upload.mapped = region.mapped;
+			}
+			else if (batch.empty() && makeStagingRoom())
+				continue; // earlier uploads were still holding some of the ring, try again
+			else if (batch.empty())
+			{
+				createBuffer(upload.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					upload.buffer, upload.allocation);
+				upload.mapped = upload.allocation.mapped;
+			}
+			else
+				break;
+
+			batch.push_back(std::move(upload));
+			++next;
+			if (batch.back().allocation.memory != VK_NULL_HANDLE)
+				break;
+		}
+
+		// a batch of one gets every thread for its mips instead.
+		unsigned mipThreads = batch.size() == 1 ? threadCount : 1;
+		parallelFor(batch.size(), threadCount, "texture decode", [&](size_t i) { decodeTexture(batch[i], mipThreads); });
 
+		for (TextureUpload& upload : batch)
+		{
+			if (!upload.error.empty())
+				throw std::runtime_error("failed to decode " + upload.error);
+
+			Texture& texture = *upload.texture;
+			uint32_t texWidth = static_cast<uint32_t>(texture.width), texHeight = static_cast<uint32_t>(texture.height);
+			CachedTexture cached;
+			cached.format = texture.format;
+			cached.mipLevels = upload.mipLevels;
+
+			// blit sources need TRANSFER_SRC on top of the usual.
+			VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+			if (upload.blitMipmaps)
+				usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			createImage(texWidth, texHeight, cached.mipLevels, cached.format, VK_IMAGE_TILING_OPTIMAL, usage,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cached.image, cached.memory);
+
+			std::vector<MipLevel> regions = upload.levels;
+			for (MipLevel& level : regions)
+				level.offset += static_cast<size_t>(upload.offset);
+
+			transitionImageLayout(cached.image, cached.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, cached.mipLevels);
+			copyBufferToImage(upload.buffer, cached.image, regions);
+			if (upload.blitMipmaps)
+				generateMipmaps(cached.image, texWidth, texHeight, cached.mipLevels);
+			else
+				transitionImageLayout(cached.image, cached.format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, cached.mipLevels);
+
+			texture.handle = mTextureCache.insert(texture.key, cached);
+			texture.compressed = TextureFile();
+			if (upload.allocation.memory != VK_NULL_HANDLE)
+				mUploads.release(upload.buffer, upload.allocation);
+		}
+		// up it goes, and the next batch decodes while the GPU copies this one.
+		mUploads.submit();
+	}
 }
 
-void VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, 
-	VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+void VulkanRenderer::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, 
+	VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory)
 {
 	VkImageCreateInfo imageInfo{};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -892,7 +1616,7 @@ void VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat forma
 	imageInfo.extent.width = width;
 	imageInfo.extent.height = height;
 	imageInfo.extent.depth = 1;
-	imageInfo.mipLevels = 1;
+	imageInfo.mipLevels = mipLevels;
 	imageInfo.arrayLayers = 1;
 	imageInfo.format = format;
 	imageInfo.tiling = tiling;
@@ -908,71 +1632,26 @@ void VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat forma
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(mLogicalDevice, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(mLogicalDevice, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
-
-	vkBindImageMemory(mLogicalDevice, image, imageMemory, 0);
+	imageMemory = mAllocator.allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR);
+	vkBindImageMemory(mLogicalDevice, image, imageMemory.memory, imageMemory.offset);
 
 }
 
-VkCommandBuffer VulkanRenderer::beginSingleTimeCommands()
+void VulkanRenderer::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
 {
-	VkCommandBufferAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = mCommandPool;
-	allocInfo.commandBufferCount = 1;
-
-	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(mLogicalDevice, &allocInfo, &commandBuffer);
-
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-	return commandBuffer;
-
-}
-
-void VulkanRenderer::endSingleTimeCommands(VkCommandBuffer commandBuffer)
-{
-	vkEndCommandBuffer(commandBuffer);
-
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(mGraphicsQueue);
-
-	vkFreeCommandBuffers(mLogicalDevice, mCommandPool, 1, &commandBuffer);
-
-}
-
-void VulkanRenderer::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
-{
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = image;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
+	VkCommandBuffer commandBuffer = mUploads.record();
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
 
 	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) 
 	{
@@ -1026,47 +1705,140 @@ void VulkanRenderer::transitionImageLayout(VkImage image, VkFormat format, VkIma
 		0, nullptr,
 		1, &barrier
 	);
-	endSingleTimeCommands(commandBuffer);
-
 }
 
-void VulkanRenderer::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+void VulkanRenderer::copyBufferToImage(VkBuffer buffer, VkImage image, const std::vector<MipLevel>& levels)
 {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0;
-	region.bufferImageHeight = 0;
-
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = {
-		width,
-		height,
-		1
-	};
+	VkCommandBuffer commandBuffer = mUploads.record();
+	std::vector<VkBufferImageCopy> regions(levels.size());
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		VkBufferImageCopy& region = regions[i];
+		region.bufferOffset = levels[i].offset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = static_cast<uint32_t>(i);
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = {
+			levels[i].width,
+			levels[i].height,
+			1
+		};
+	}
 	vkCmdCopyBufferToImage(
 		commandBuffer,
 		buffer,
 		image,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		1,
-		&region
+		static_cast<uint32_t>(regions.size()),
+		regions.data()
 	);
-	endSingleTimeCommands(commandBuffer);
+}
+
+bool VulkanRenderer::canBlitMipmaps(VkFormat format)
+{
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(mPhysicalDevice, format, &properties);
+	VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return (properties.optimalTilingFeatures & needed) == needed;
+}
+
+void VulkanRenderer::generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	TRACE_FUNCTION();
+	VkCommandBuffer commandBuffer = mUploads.record();
+
+	// every level starts out as a copy destination. Each one in turn becomes the source for the next, then gets
+	// handed to the fragment shader once nothing else needs to read it.
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = image;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.subresourceRange.levelCount = 1;
+
+	int32_t mipWidth = static_cast<int32_t>(width), mipHeight = static_cast<int32_t>(height);
+	for (uint32_t i = 1; i < mipLevels; ++i)
+	{
+		barrier.subresourceRange.baseMipLevel = i - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+
+		int32_t nextWidth = std::max(mipWidth / 2, 1), nextHeight = std::max(mipHeight / 2, 1);
+		VkImageBlit blit{};
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = i - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = 1;
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = i;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount = 1;
+		vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &blit, VK_FILTER_LINEAR);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+			0, nullptr, 0, nullptr, 1, &barrier);
+
+		mipWidth = nextWidth;
+		mipHeight = nextHeight;
+	}
+
+	// the last level was only ever written to.
+	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, 1, &barrier);
 
 }
 
 void VulkanRenderer::createTextureImageView()
 {
-	mTextureimageView = createImageView(mTextureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+	TRACE_FUNCTION();
+	for (Texture& texture : mTextures)
+	{
+		CachedTexture& cached = mTextureCache.get(texture.handle);
+		if (cached.view == VK_NULL_HANDLE)
+			cached.view = createImageView(cached.image, cached.format, VK_IMAGE_ASPECT_COLOR_BIT, cached.mipLevels);
+	}
+}
+
+void VulkanRenderer::releaseTextures()
+{
+	// the frame being recorded is the last that could sample them, collect() takes it from there.
+	for (Texture& texture : mTextures)
+	{
+		if (texture.handle == INVALID_TEXTURE_HANDLE)
+			continue;
+		mTextureCache.release(texture.handle, mFrameNumber);
+		texture.handle = INVALID_TEXTURE_HANDLE;
+	}
 }
 
-VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags)
+VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
 {
 	VkImageViewCreateInfo viewInfo{};
 	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1075,7 +1847,7 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
 	viewInfo.format = format;
 	viewInfo.subresourceRange.aspectMask = aspectFlags;
 	viewInfo.subresourceRange.baseMipLevel = 0;
-	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.levelCount = mipLevels;
 	viewInfo.subresourceRange.baseArrayLayer = 0;
 	viewInfo.subresourceRange.layerCount = 1;
 
@@ -1089,6 +1861,7 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
 
 void VulkanRenderer::createTextureSampler()
 {
+	TRACE_FUNCTION();
 	VkSamplerCreateInfo samplerInfo{};
 	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 	samplerInfo.magFilter = VK_FILTER_LINEAR;
@@ -1111,21 +1884,40 @@ void VulkanRenderer::createTextureSampler()
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	samplerInfo.mipLodBias = 0.0f;
 	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = 0.0f;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE; // one sampler for every texture, each image view stops at its own last mip
 
-	if (vkCreateSampler(mLogicalDevice, &samplerInfo, nullptr, &mTextureSampler) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create texture sampler!");
+	mTextureSampler = mSamplerCache.get(mLogicalDevice, samplerInfo);
+
+	if (mSettings.virtualTextures)
+	{
+		// the atlas only has the one mip, the shader picks and blends mips itself. Clamped, and no anisotropy, so
+		// the filter stays inside a page's border.
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		samplerInfo.anisotropyEnable = VK_FALSE;
+		samplerInfo.maxAnisotropy = 1;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		samplerInfo.maxLod = 0.0f;
+		mPageAtlasSampler = mSamplerCache.get(mLogicalDevice, samplerInfo);
+
+		// integer texels can't be filtered.
+		samplerInfo.magFilter = VK_FILTER_NEAREST;
+		samplerInfo.minFilter = VK_FILTER_NEAREST;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+		mPageTableSampler = mSamplerCache.get(mLogicalDevice, samplerInfo);
 	}
 }
 
 void VulkanRenderer::createDepthResources()
 {
+	TRACE_FUNCTION();
 	VkFormat depthFormat = findDepthFormat();
-	createImage(mSwapChainExtent.width, mSwapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, 
+	createImage(mSwapChainExtent.width, mSwapChainExtent.height, 1, depthFormat, VK_IMAGE_TILING_OPTIMAL, 
 		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mDepthImage, mDepthImageMemory);
-	mDepthImageView = createImageView(mDepthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+	mDepthImageView = createImageView(mDepthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
 	
-	transitionImageLayout(mDepthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+	transitionImageLayout(mDepthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
 
 
 }
@@ -1164,133 +1956,1198 @@ bool VulkanRenderer::hasStencilCompoonent(VkFormat format)
 
 void VulkanRenderer::loadModel()
 {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t > materials;
-	std::string warn, err;
+	TRACE_FUNCTION();
 
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL.c_str())) 
+	// the cache holds the finished mesh, so stats (which want to watch the passes) and tinyobj skip it.
+	bool useCache = mSettings.meshCache && !mSettings.meshStats && !mSettings.tinyObjLoader;
+	bool compact = mSettings.vertexFormat == VERTEX_FORMAT_COMPACT;
+	mVertexStride = compact ? sizeof(CompactVertex) : sizeof(Vertex);
+
+	// the vertex size is part of the cache key, so a full and a compact cache never get mixed up.
+	if (useCache && mMeshCache.open(MODEL, static_cast<uint32_t>(mVertexStride)) && unpackMeshInfo(mMeshCache.extra(), mMeshCache.extraSize()))
 	{
-		throw std::runtime_error(warn + err);
+		// the cache always has the whole chain (see below), the extra LODs just sit unused in the index buffer.
+		if (!mSettings.generateLods)
+			for (Submesh& submesh : mSubmeshes)
+				submesh.mLodCount = 1;
+		mVertexData = mMeshCache.vertices();
+		mVertexCount = mMeshCache.vertexCount();
+		mIndexData = mMeshCache.indices();
+		mIndexCount = mMeshCache.indexCount();
+		return;
 	}
 
-	for (const auto& shape : shapes)
+	ObjMesh mesh;
+	StatClock::time_point loadStart = StatClock::now();
+
+	if (mSettings.tinyObjLoader)
+	{
+		// the old serial path, kept around to check the parallel loader against.
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		std::vector<tinyobj::material_t > materials;
+		std::string warn, err;
+
+		{
+			TRACE_ZONE("tinyobj::LoadObj");
+			// mtllib files are relative to the obj, same as the parallel loader.
+			std::string modelDirectory = MODEL.substr(0, MODEL.find_last_of("/\\") + 1);
+			if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL.c_str(), modelDirectory.c_str())) 
+			{
+				throw std::runtime_error(warn + err);
+			}
+
+			for (const tinyobj::material_t& material : materials)
+			{
+				ObjMaterial converted;
+				converted.name = material.name;
+				std::copy(material.diffuse, material.diffuse + 3, converted.diffuse);
+				if (!material.diffuse_texname.empty())
+					converted.diffuseTexture = modelDirectory + material.diffuse_texname;
+				mesh.materials.push_back(converted);
+			}
+		}
+
+		mesh.positions.swap(attrib.vertices);
+		mesh.texcoords.swap(attrib.texcoords);
+		mesh.normals.swap(attrib.normals);
+		for (const auto& shape : shapes)
+		{
+			// tinyobj triangulated, so there's one material id per 3 indices.
+			for (size_t i = 0; i < shape.mesh.indices.size(); ++i)
+			{
+				if (i % 3 == 0)
+				{
+					int material = shape.mesh.material_ids[i / 3];
+					ObjGroup* last = mesh.groups.empty() ? nullptr : &mesh.groups.back();
+					if (last && last->shape == shape.name && last->material == material)
+						last->indexCount += 3;
+					else
+						mesh.groups.push_back({ shape.name, material, mesh.indices.size(), 3 });
+				}
+
+				const tinyobj::index_t& index = shape.mesh.indices[i];
+				mesh.indices.push_back({ index.vertex_index, index.texcoord_index, index.normal_index });
+			}
+		}
+	}
+	else
 	{
-		for (const auto& index : shape.mesh.indices)
+		ObjLoadStats loadStats;
+		loadObjParallel(MODEL, mesh, 0, &loadStats);
+
+		if (mSettings.meshStats)
 		{
-			Vertex vertex{};
+			std::cout << MODEL << ": " << loadStats.bytes / (1024.0 * 1024.0) << " MB in " << loadStats.chunks << " chunks on "
+				<< loadStats.threads << " threads, parse " << loadStats.parseMs << " ms, merge " << loadStats.mergeMs << " ms, "
+				<< loadStats.bytes / (loadStats.totalMs * 1000.0) << " MB/s" << std::endl;
+		}
+	}
 
-			// multiply by 3 to because these are floats, and will
-			// be converted to glm::vec3 things
-			vertex.mPos = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
+	if (mSettings.meshStats)
+		std::cout << (mSettings.tinyObjLoader ? "tinyobj" : "parallel") << " load took " << elapsedMs(loadStart, StatClock::now()) << " ms" << std::endl;
 
-			vertex.mTexCoord = {
-				attrib.texcoords[2 * index.texcoord_index + 0],
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-			};
+	// plenty of exporters leave vn out. Those corners get smooth normals from the faces around them.
+	{
+		size_t fileNormals = mesh.normals.size();
+		std::vector<uint32_t> positionRemap;
+		generateMissingNormals(mesh, positionRemap);
+		if (mSettings.meshStats && mesh.normals.size() != fileNormals)
+			std::cout << "generated " << (mesh.normals.size() - fileNormals) / 3 << " normals for faces without vn" << std::endl;
+	}
 
-			vertex.mNormal = {
-				attrib.normals[3 * index.normal_index + 0],
-				attrib.normals[3 * index.normal_index + 1],
-				attrib.normals[3 * index.normal_index + 2]
-			};
+	// materials that don't fit in a MeshMaterial just lose their name / texture, it's not worth failing the load over.
+	mMaterials.assign(mesh.materials.size(), MeshMaterial());
+	for (size_t m = 0; m < mesh.materials.size(); ++m)
+	{
+		const ObjMaterial& source = mesh.materials[m];
+		MeshMaterial& material = mMaterials[m];
+		memset(&material, 0, sizeof(material));
+		if (source.name.size() < MAX_MATERIAL_NAME)
+			memcpy(material.mName, source.name.c_str(), source.name.size());
+		if (source.diffuseTexture.size() < MAX_MATERIAL_PATH)
+			memcpy(material.mDiffuseTexture, source.diffuseTexture.c_str(), source.diffuseTexture.size());
+		else
+			std::cerr << "Texture path too long, using the default texture: " << source.diffuseTexture << std::endl;
+		material.mDiffuse = glm::vec4(source.diffuse[0], source.diffuse[1], source.diffuse[2], 1.0f);
+	}
 
-			vertex.mColor = { 1.0f, 1.0f, 1.0f };
+	// one submesh per shape / material pair, however many runs of the file it's spread over.
+	struct SubmeshSource
+	{
+		const std::string* shape;
+		int material;
+		std::vector<const ObjGroup*> groups;
+		size_t cornerCount = 0;
+	};
+	std::vector<SubmeshSource> sources;
+	{
+		std::map<std::pair<std::string, int>, size_t> sourceIndex;
+		for (const ObjGroup& group : mesh.groups)
+		{
+			auto inserted = sourceIndex.insert({ { group.shape, group.material }, sources.size() });
+			if (inserted.second)
+				sources.push_back({ &group.shape, group.material, {}, 0 });
+			SubmeshSource& source = sources[inserted.first->second];
+			source.groups.push_back(&group);
+			source.cornerCount += group.indexCount;
+		}
+	}
 
+	// draw order: everything sampling the same texture back to back, so the draw loop only rebinds descriptors when
+	// the texture actually changes. Then by material, and file order after that.
+	auto textureKey = [&](int material) { return material < 0 ? std::string() : std::string(mMaterials[material].mDiffuseTexture); };
+	std::stable_sort(sources.begin(), sources.end(), [&](const SubmeshSource& a, const SubmeshSource& b)
+	{
+		std::string keyA = textureKey(a.material), keyB = textureKey(b.material);
+		return keyA != keyB ? keyA < keyB : a.material < b.material;
+	});
+
+	// one vertex per triangle corner, straight out of the obj and grouped by submesh. buildIndexedMesh welds and
+	// reorders these. The vertex color stays white, the material's Kd gets pushed per submesh instead.
+	std::vector<Vertex> corners(mesh.indices.size());
+	std::vector<size_t> submeshCorners;
+	mSubmeshes.assign(sources.size(), Submesh());
+	{
+		TRACE_ZONE("buildVertices");
+		size_t corner = 0;
+		for (size_t i = 0; i < sources.size(); ++i)
+		{
+			const SubmeshSource& source = sources[i];
+			for (const ObjGroup* group : source.groups)
+			{
+				for (size_t index = group->firstIndex; index < group->firstIndex + group->indexCount; ++index)
+					corners[corner++] = makeCornerVertex(mesh, mesh.indices[index]);
+			}
 
-			mVertices.push_back(vertex);
-			mIndices.push_back(mIndices.size());
+			memset(&mSubmeshes[i], 0, sizeof(Submesh));
+			mSubmeshes[i].mMaterial = source.material;
+			submeshCorners.push_back(source.cornerCount);
 		}
 	}
+
+	if (mSettings.meshStats)
+	{
+		std::cout << sources.size() << " submeshes, " << mMaterials.size() << " materials:" << std::endl;
+		for (const SubmeshSource& source : sources)
+			std::cout << "  shape '" << *source.shape << "' material '" << (source.material < 0 ? "default" : mMaterials[source.material].mName)
+				<< "' texture '" << (textureKey(source.material).empty() ? TEXTURE : textureKey(source.material)) << "': "
+				<< source.cornerCount / 3 << " triangles" << std::endl;
+	}
+
+	buildIndexedMesh(corners, submeshCorners);
+	// runs with and without LODs share the cache, so whatever goes in it gets the whole chain.
+	buildLodChain(mSettings.generateLods || useCache);
+
+	if (compact || mSettings.meshStats)
+		buildCompactVertices();
+
+	if (mSettings.meshStats)
+	{
+		size_t fullBytes = mVertices.size() * sizeof(Vertex);
+		size_t compactBytes = mCompactVertices.size() * sizeof(CompactVertex);
+		const glm::vec4& posScale = mMeshInfo.mDequantization.mPosScale;
+		float step = std::max({ posScale.x, posScale.y, posScale.z }) / 65535.0f;
+		std::cout << "vertex buffer: full " << fullBytes << " bytes (" << sizeof(Vertex) << " per vertex), compact " << compactBytes
+			<< " bytes (" << sizeof(CompactVertex) << " per vertex), " << 100.0 * compactBytes / fullBytes << "% of full. "
+			<< "Position step " << step << std::endl;
+	}
+
+	mVertexData = compact ? static_cast<const void*>(mCompactVertices.data()) : static_cast<const void*>(mVertices.data());
+	mVertexCount = mVertices.size();
+	mIndexData = mIndices.data();
+	mIndexCount = mIndices.size();
+
+	// a failed write just means we parse again next time.
+	std::vector<char> meshInfo = packMeshInfo();
+	if (useCache && !mMeshCache.write(mVertexData, mVertexCount, mIndexData, mIndexCount, meshInfo.data(), meshInfo.size()))
+		std::cerr << "Failed to write mesh cache " << mMeshCache.cachePath() << std::endl;
+
+	if (!mSettings.generateLods)
+		for (Submesh& submesh : mSubmeshes)
+			submesh.mLodCount = 1;
 }
 
-void VulkanRenderer::createVertexBuffer()
+void VulkanRenderer::buildLodChain(bool generate)
 {
-	VkDeviceSize bufferSize = sizeof(mVertices[0]) * mVertices.size();
+	TRACE_FUNCTION();
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	// bounding sphere: AABB center, radius out to the furthest vertex.
+	MeshBounds bounds;
+	if (!mVertices.empty())
+		computeBounds(bounds, &mVertices[0].mPos.x, mVertices.size(), sizeof(Vertex));
+	float radius = bounds.radius;
+	mMeshInfo.mBoundingSphere = glm::vec4(bounds.center[0], bounds.center[1], bounds.center[2], radius);
 
-	/*
-	Create the "source" buffer
-	VK_BUFFER_USAGE_TRANSFER_SRC_BIT: Buffer can be used as source in a memory transfer operation.
+	if (mSettings.meshStats)
+	{
+		std::cout << "bounds (" << bounds.min[0] << ", " << bounds.min[1] << ", " << bounds.min[2] << ") to ("
+			<< bounds.max[0] << ", " << bounds.max[1] << ", " << bounds.max[2] << ")" << std::endl;
+		std::cout << "LODs (bounding radius " << radius << "):" << std::endl;
+	}
 
-	VK_BUFFER_USAGE_TRANSFER_DST_BIT: Buffer can be used as destination in a memory transfer operation.
-	*/
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+	for (size_t s = 0; s < mSubmeshes.size(); ++s)
+	{
+		Submesh& submesh = mSubmeshes[s];
+		if (generate)
+		{
+			// each LOD aims for half the triangles of the one before. Stop when simplifying stops paying off, or when
+			// the surface would have to move more than LOD_MAX_ERROR of the whole mesh's radius.
+			const float LOD_MAX_ERROR = 0.05f;
+			const size_t LOD_MIN_TRIANGLES = 64;
+
+			const Vertex* vertices = &mVertices[submesh.mVertexOffset];
+			std::vector<uint32_t> previous(mIndices.begin() + submesh.mLods[0].mFirstIndex,
+				mIndices.begin() + submesh.mLods[0].mFirstIndex + submesh.mLods[0].mIndexCount);
+			std::vector<uint32_t> simplified(previous.size());
+			float error = 0.0f;
+
+			while (submesh.mLodCount < MAX_MESH_LODS && previous.size() / 3 > LOD_MIN_TRIANGLES)
+			{
+				float lodError = 0.0f;
+				size_t target = previous.size() / 6 * 3;
+				size_t count = simplifyMesh(simplified.data(), previous.data(), previous.size(), &vertices[0].mPos.x, submesh.mVertexCount,
+					sizeof(Vertex), target, radius * LOD_MAX_ERROR, &lodError);
 
-	void* data;
-	vkMapMemory(mLogicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, mVertices.data(), (size_t)bufferSize);
-	vkUnmapMemory(mLogicalDevice, stagingBufferMemory);
+				// less than 20% fewer triangles isn't worth a LOD.
+				if (count > previous.size() * 4 / 5)
+					break;
 
-	//Create the "destination" buffer
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mVertexBuffer, mVertexBufferDeviceMemory);
+				// simplifying from the previous LOD, so errors stack. Keep the biggest so they stay in order.
+				error = std::max(error, lodError);
+				previous.assign(simplified.begin(), simplified.begin() + count);
+
+				std::vector<uint32_t> ordered(count);
+				optimizeVertexCache(ordered.data(), previous.data(), count, submesh.mVertexCount);
+
+				submesh.mLods[submesh.mLodCount++] = { static_cast<uint32_t>(mIndices.size()), static_cast<uint32_t>(count), error, 0 };
+				mIndices.insert(mIndices.end(), ordered.begin(), ordered.end());
+			}
+		}
+
+		if (mSettings.meshStats)
+		{
+			std::cout << "  submesh " << s << ":";
+			for (uint32_t lod = 0; lod < submesh.mLodCount; ++lod)
+			{
+				const MeshLod& range = submesh.mLods[lod];
+				std::cout << " " << range.mIndexCount / 3 << " (" << 100.0f * range.mError / radius << "%)";
+			}
+			std::cout << " triangles (error % of radius)" << std::endl;
+		}
+	}
+}
 
-	copyBuffer(stagingBuffer, mVertexBuffer, bufferSize);
+std::vector<char> VulkanRenderer::packMeshInfo() const
+{
+	MeshInfo info = mMeshInfo;
+	info.mSubmeshCount = static_cast<uint32_t>(mSubmeshes.size());
+	info.mMaterialCount = static_cast<uint32_t>(mMaterials.size());
+
+	std::vector<char> packed(sizeof(MeshInfo) + sizeof(Submesh) * mSubmeshes.size() + sizeof(MeshMaterial) * mMaterials.size());
+	char* out = packed.data();
+	memcpy(out, &info, sizeof(MeshInfo));
+	out += sizeof(MeshInfo);
+	if (!mSubmeshes.empty())
+		memcpy(out, mSubmeshes.data(), sizeof(Submesh) * mSubmeshes.size());
+	out += sizeof(Submesh) * mSubmeshes.size();
+	if (!mMaterials.empty())
+		memcpy(out, mMaterials.data(), sizeof(MeshMaterial) * mMaterials.size());
+	return packed;
+}
 
-	vkDestroyBuffer(mLogicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(mLogicalDevice, stagingBufferMemory, nullptr);
+bool VulkanRenderer::unpackMeshInfo(const void* data, size_t size)
+{
+	if (size < sizeof(MeshInfo))
+		return false;
+
+	MeshInfo info;
+	memcpy(&info, data, sizeof(MeshInfo));
+	if (size != sizeof(MeshInfo) + sizeof(Submesh) * size_t(info.mSubmeshCount) + sizeof(MeshMaterial) * size_t(info.mMaterialCount))
+		return false;
+
+	const char* in = static_cast<const char*>(data) + sizeof(MeshInfo);
+	mMeshInfo = info;
+	mSubmeshes.resize(info.mSubmeshCount);
+	if (info.mSubmeshCount)
+		memcpy(mSubmeshes.data(), in, sizeof(Submesh) * info.mSubmeshCount);
+	in += sizeof(Submesh) * info.mSubmeshCount;
+	mMaterials.resize(info.mMaterialCount);
+	if (info.mMaterialCount)
+		memcpy(mMaterials.data(), in, sizeof(MeshMaterial) * info.mMaterialCount);
+	return true;
+}
 
+uint32_t VulkanRenderer::submeshTexture(const Submesh& submesh) const
+{
+	return submesh.mMaterial < 0 ? 0 : mMaterialTextures[submesh.mMaterial];
 }
 
-void VulkanRenderer::createIndexBuffer()
+void VulkanRenderer::buildCompactVertices()
+{
+	TRACE_FUNCTION();
+
+	MeshBounds bounds;
+	if (!mVertices.empty())
+		computeBounds(bounds, &mVertices[0].mPos.x, mVertices.size(), sizeof(Vertex));
+	glm::vec3 posMin(bounds.min[0], bounds.min[1], bounds.min[2]), posMax(bounds.max[0], bounds.max[1], bounds.max[2]);
+
+	glm::vec2 uvMin(std::numeric_limits<float>::max()), uvMax(-std::numeric_limits<float>::max());
+	for (const Vertex& vertex : mVertices)
+	{
+		uvMin = glm::min(uvMin, vertex.mTexCoord);
+		uvMax = glm::max(uvMax, vertex.mTexCoord);
+	}
+
+	glm::vec3 posScale = posMax - posMin;
+	glm::vec2 uvScale = uvMax - uvMin;
+	mMeshInfo.mDequantization.mPosOffset = glm::vec4(posMin, 0.0f);
+	mMeshInfo.mDequantization.mPosScale = glm::vec4(posScale, 0.0f);
+	mMeshInfo.mDequantization.mTexCoordOffsetScale = glm::vec4(uvMin, uvScale);
+
+	// flat axes (a plane, or every uv the same) just quantize to 0.
+	auto normalize = [](float value, float offset, float scale) { return scale > 0.0f ? (value - offset) / scale : 0.0f; };
+
+	mCompactVertices.resize(mVertices.size());
+	for (size_t i = 0; i < mVertices.size(); ++i)
+	{
+		const Vertex& vertex = mVertices[i];
+		CompactVertex& packed = mCompactVertices[i];
+
+		for (int c = 0; c < 3; ++c)
+			packed.mPos[c] = quantizeUnorm16(normalize(vertex.mPos[c], posMin[c], posScale[c]));
+		packed.mPos[3] = 0;
+
+		float octahedral[2];
+		encodeOctahedral(vertex.mNormal.x, vertex.mNormal.y, vertex.mNormal.z, octahedral);
+		packed.mNormal[0] = quantizeSnorm16(octahedral[0]);
+		packed.mNormal[1] = quantizeSnorm16(octahedral[1]);
+
+		for (int c = 0; c < 2; ++c)
+			packed.mTexCoord[c] = quantizeUnorm16(normalize(vertex.mTexCoord[c], uvMin[c], uvScale[c]));
+	}
+}
+
+void VulkanRenderer::buildIndexedMesh(const std::vector<Vertex>& corners, const std::vector<size_t>& submeshCorners)
+{
+	TRACE_FUNCTION();
+
+	// per pass stats for --mesh-stats, summed over the submeshes. Each entry is measured after that pass ran.
+	struct PassStats
+	{
+		const char* name;
+		VertexCacheStats cache;
+		double ms;
+	};
+	std::vector<PassStats> passes;
+	size_t passIndex = 0;
+	StatClock::time_point passStart = StatClock::now();
+	auto endPass = [&](const char* name, const std::vector<uint32_t>& indices, size_t vertexCount)
+	{
+		StatClock::time_point now = StatClock::now();
+		if (mSettings.meshStats)
+		{
+			if (passIndex == passes.size())
+				passes.push_back({ name, VertexCacheStats(), 0.0 });
+			VertexCacheStats cache = analyzeVertexCache(indices.data(), indices.size(), vertexCount);
+			PassStats& pass = passes[passIndex];
+			pass.cache.vertexCount += cache.vertexCount;
+			pass.cache.indexCount += cache.indexCount;
+			pass.cache.transformedVertices += cache.transformedVertices;
+			pass.ms += elapsedMs(passStart, now);
+		}
+		++passIndex;
+		passStart = StatClock::now();
+	};
+
+	mVertices.clear();
+	mIndices.clear();
+
+	// every submesh is welded and optimized on its own, with indices relative to its own first vertex. The draw adds
+	// mVertexOffset back on, so a submesh never shares vertices with its neighbours.
+	size_t firstCorner = 0;
+	for (size_t s = 0; s < mSubmeshes.size(); ++s)
+	{
+		const Vertex* submeshStart = corners.data() + firstCorner;
+		size_t cornerCount = submeshCorners[s];
+		firstCorner += cornerCount;
+		passIndex = 0;
+
+		// what we used to upload: every corner is its own vertex and the index buffer is 0, 1, 2, ...
+		std::vector<uint32_t> indices(cornerCount);
+		for (size_t i = 0; i < indices.size(); ++i)
+			indices[i] = static_cast<uint32_t>(i);
+		endPass("unindexed", indices, cornerCount);
+
+		// weld identical corners together.
+		std::vector<uint32_t> remap;
+		size_t uniqueCount;
+		std::vector<Vertex> welded;
+		{
+			TRACE_ZONE("weld");
+			uniqueCount = generateVertexRemap(remap, submeshStart, cornerCount, sizeof(Vertex));
+			welded.resize(uniqueCount);
+			remapVertexBuffer(welded.data(), submeshStart, cornerCount, sizeof(Vertex), remap);
+			remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap);
+		}
+		endPass("weld", indices, uniqueCount);
+
+		{
+			TRACE_ZONE("optimizeVertexCache");
+			std::vector<uint32_t> ordered(indices.size());
+			optimizeVertexCache(ordered.data(), indices.data(), indices.size(), uniqueCount);
+			indices.swap(ordered);
+		}
+		endPass("vertex cache", indices, uniqueCount);
+
+		if (uniqueCount)
+		{
+			TRACE_ZONE("optimizeOverdraw");
+			optimizeOverdraw(indices.data(), indices.data(), indices.size(), &welded[0].mPos.x, uniqueCount, sizeof(Vertex));
+		}
+		endPass("overdraw", indices, uniqueCount);
+
+		std::vector<Vertex> fetched(uniqueCount);
+		{
+			TRACE_ZONE("optimizeVertexFetch");
+			fetched.resize(optimizeVertexFetch(fetched.data(), indices.data(), indices.size(), welded.data(), uniqueCount, sizeof(Vertex)));
+		}
+		endPass("vertex fetch", indices, fetched.size());
+
+		Submesh& submesh = mSubmeshes[s];
+		submesh.mVertexOffset = static_cast<int32_t>(mVertices.size());
+		submesh.mVertexCount = static_cast<uint32_t>(fetched.size());
+		submesh.mLodCount = 1;
+		submesh.mLods[0] = { static_cast<uint32_t>(mIndices.size()), static_cast<uint32_t>(indices.size()), 0.0f, 0 };
+		mVertices.insert(mVertices.end(), fetched.begin(), fetched.end());
+		mIndices.insert(mIndices.end(), indices.begin(), indices.end());
+	}
+
+	if (mSettings.meshStats)
+	{
+		std::cout << MODEL << ": " << corners.size() / 3 << " triangles, cache size " << VERTEX_CACHE_SIZE << std::endl;
+		std::cout << std::left << std::setw(14) << "pass" << std::right
+			<< std::setw(10) << "vertices" << std::setw(10) << "indices"
+			<< std::setw(8) << "acmr" << std::setw(8) << "atvr" << std::setw(10) << "ms" << std::endl;
+		std::cout << std::fixed << std::setprecision(3);
+		for (PassStats& pass : passes)
+		{
+			size_t triangleCount = pass.cache.indexCount / 3;
+			pass.cache.acmr = triangleCount ? double(pass.cache.transformedVertices) / triangleCount : 0.0;
+			pass.cache.atvr = pass.cache.vertexCount ? double(pass.cache.transformedVertices) / pass.cache.vertexCount : 0.0;
+			std::cout << std::left << std::setw(14) << pass.name << std::right
+				<< std::setw(10) << pass.cache.vertexCount << std::setw(10) << pass.cache.indexCount
+				<< std::setw(8) << pass.cache.acmr << std::setw(8) << pass.cache.atvr << std::setw(10) << pass.ms << std::endl;
+		}
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6);
+	}
+}
+
+void VulkanRenderer::createVertexBuffer()
 {
-	VkDeviceSize bufferSize = sizeof(mIndices[0]) * mIndices.size();
+	TRACE_FUNCTION();
+	VertexStreamLayout layout = makeVertexStreamLayout(mSettings.vertexFormat, mSettings.splitVertexStreams);
+
+	// streams go back to back in one buffer, each starting on a 16 byte boundary.
+	mVertexStreamOffsets.clear();
+	VkDeviceSize bufferSize = 0;
+	for (const VkVertexInputBindingDescription& binding : layout.bindings)
+	{
+		bufferSize = (bufferSize + 15) & ~VkDeviceSize(15);
+		mVertexStreamOffsets.push_back(bufferSize);
+		bufferSize += VkDeviceSize(binding.stride) * mVertexCount;
+	}
+
+	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mVertexBuffer, mVertexBufferDeviceMemory);
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+	const unsigned char* source = static_cast<const unsigned char*>(mVertexData);
+	if (!mSettings.splitVertexStreams)
+	{
+		uploadToBuffer(mVertexBuffer, 0, mVertexStride, mVertexCount, [&](unsigned char* out, size_t first, size_t count)
+		{
+			memcpy(out, source + first * mVertexStride, count * mVertexStride);
+		});
+		return;
+	}
 
-	void* data;
-	vkMapMemory(mLogicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, mIndices.data(), (size_t)bufferSize);
-	vkUnmapMemory(mLogicalDevice, stagingBufferMemory);
+	// deinterleave each attribute into its stream, a stream at a time.
+	for (uint32_t b = 0; b < layout.bindings.size(); ++b)
+	{
+		uint32_t streamStride = layout.bindings[b].stride;
+		uploadToBuffer(mVertexBuffer, mVertexStreamOffsets[b], streamStride, mVertexCount, [&](unsigned char* out, size_t first, size_t count)
+		{
+			for (size_t a = 0; a < layout.attributes.size(); ++a)
+			{
+				const VkVertexInputAttributeDescription& attribute = layout.attributes[a];
+				if (attribute.binding != b)
+					continue;
+				unsigned char* stream = out + attribute.offset;
+				const unsigned char* in = source + first * mVertexStride + layout.sourceOffsets[a];
+				for (size_t v = 0; v < count; ++v)
+					memcpy(stream + v * streamStride, in + v * mVertexStride, layout.sizes[a]);
+			}
+		});
+	}
+}
 
+void VulkanRenderer::createIndexBuffer()
+{
+	TRACE_FUNCTION();
+	VkDeviceSize bufferSize = sizeof(uint32_t) * mIndexCount;
 	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mIndexBuffer, mIndexBufferMemory);
 
-	copyBuffer(stagingBuffer, mIndexBuffer, bufferSize);
+	uploadToBuffer(mIndexBuffer, 0, sizeof(uint32_t), mIndexCount, [&](unsigned char* out, size_t first, size_t count)
+	{
+		memcpy(out, mIndexData + first, count * sizeof(uint32_t));
+	});
+}
+
+void VulkanRenderer::beginMeshStream()
+{
+	TRACE_FUNCTION();
+	mStreamStart = StatClock::now();
+
+	// the face count gives the exact index count. Welding happens per chunk, so the vertices can't be known until
+	// the end. One per corner is the most there can be.
+	mStreamReader.open(MODEL);
+	size_t maxIndexCount = mStreamReader.indexCount();
+	if (maxIndexCount == 0)
+		throw std::runtime_error("No faces to stream in " + MODEL);
+
+	mVertexStride = sizeof(Vertex);
+	mVertexCount = maxIndexCount;
+	mIndexCount = 0;
+	mVertexStreamOffsets.assign(1, 0);
+	createBuffer(VkDeviceSize(sizeof(Vertex)) * maxIndexCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mVertexBuffer, mVertexBufferDeviceMemory);
+	createBuffer(VkDeviceSize(sizeof(uint32_t)) * maxIndexCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mIndexBuffer, mIndexBufferMemory);
+
+	// nothing to draw until the first chunk lands. No LOD chain either, that needs the whole mesh.
+	// the stream reader doesn't track groups either, so it's one submesh on the default material.
+	mMeshInfo = {};
+	mMaterials.clear();
+	mSubmeshes.assign(1, Submesh());
+	memset(&mSubmeshes[0], 0, sizeof(Submesh));
+	mSubmeshes[0].mMaterial = -1;
+	mSubmeshes[0].mLodCount = 1;
+	mMeshInfo.mSubmeshCount = 1;
+
+	// the slots get re-recorded every time they come round, so they need a pool that lets us reset them.
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = findQueueFamilies(mPhysicalDevice).graphicsFamily.value();
+	if (vkCreateCommandPool(mLogicalDevice, &poolInfo, nullptr, &mStreamCommandPool) != VK_SUCCESS)
+		throw std::runtime_error("Error creating the mesh stream command pool");
+
+	std::vector<VkCommandBuffer> commandBuffers(STREAM_UPLOAD_SLOT_COUNT);
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = mStreamCommandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = STREAM_UPLOAD_SLOT_COUNT;
+	if (vkAllocateCommandBuffers(mLogicalDevice, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+		throw std::runtime_error("Unable to allocate mesh stream command buffers!");
 
-	vkDestroyBuffer(mLogicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(mLogicalDevice, stagingBufferMemory, nullptr);
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
+	mStreamSlots.resize(STREAM_UPLOAD_SLOT_COUNT);
+	for (uint32_t i = 0; i < STREAM_UPLOAD_SLOT_COUNT; ++i)
+	{
+		mStreamSlots[i].commandBuffer = commandBuffers[i];
+		if (vkCreateFence(mLogicalDevice, &fenceInfo, nullptr, &mStreamSlots[i].fence) != VK_SUCCESS)
+			throw std::runtime_error("Error creating a mesh stream fence");
+	}
+	mStreamNextSlot = 0;
+
+	mStreamCancel = false;
+	mStreamWorkerDone = false;
+	mStreamChunkPending = false;
+	mStreamFirstGeometryMs = -1.0;
+	mStreaming = true;
+	mStreamThread = std::thread(&VulkanRenderer::streamMeshWorker, this);
 }
 
-void VulkanRenderer::createUniformBuffers()
+void VulkanRenderer::streamMeshWorker()
 {
-	VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+	if (Tracer::get().isEnabled())
+		Tracer::get().setThreadName("mesh stream");
 
-	uniformBuffers.resize(mSwapChainImages.size());
-	uniformBuffersMemory.resize(mSwapChainImages.size());
+	try
+	{
+		ObjMesh mesh;
+		size_t vertexCount = 0, indexCount = 0;
+		std::vector<Vertex> corners;
+		std::vector<uint32_t> remap, positionRemap;
 
-	for (size_t i = 0; i < mSwapChainImages.size(); i++) {
-		createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-			uniformBuffers[i], uniformBuffersMemory[i]);
+		while (!mStreamCancel && mStreamReader.next(mesh))
+		{
+			// chunks with only attributes in them have nothing to draw yet.
+			if (mesh.indices.empty())
+				continue;
+
+			TRACE_ZONE("streamChunk");
+			MeshStreamChunk chunk;
+
+			// same as buildIndexedMesh, but only within the chunk. Welding across chunks would need every vertex
+			// before this one, and overdraw / fetch ordering want the whole mesh.
+			// faces without vn only get smoothed against the rest of their chunk. The generated normals come back off
+			// the end afterwards, the reader counts the file's vn by mesh.normals.
+			size_t fileNormals = mesh.normals.size();
+			generateMissingNormals(mesh, positionRemap);
+			corners.resize(mesh.indices.size());
+			for (size_t i = 0; i < mesh.indices.size(); ++i)
+				corners[i] = makeCornerVertex(mesh, mesh.indices[i]);
+			mesh.normals.resize(fileNormals);
+
+			std::vector<uint32_t> indices(corners.size());
+			for (size_t i = 0; i < indices.size(); ++i)
+				indices[i] = static_cast<uint32_t>(i);
+
+			size_t uniqueCount = generateVertexRemap(remap, corners.data(), corners.size(), sizeof(Vertex));
+			chunk.vertices.resize(uniqueCount);
+			remapVertexBuffer(chunk.vertices.data(), corners.data(), corners.size(), sizeof(Vertex), remap);
+			remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap);
+
+			chunk.indices.resize(indices.size());
+			optimizeVertexCache(chunk.indices.data(), indices.data(), indices.size(), uniqueCount);
+			for (uint32_t& index : chunk.indices)
+				index += static_cast<uint32_t>(vertexCount);
+
+			chunk.firstVertex = vertexCount;
+			chunk.firstIndex = indexCount;
+			vertexCount += chunk.vertices.size();
+			indexCount += chunk.indices.size();
+
+			std::unique_lock<std::mutex> lock(mStreamMutex);
+			mStreamQueueSpace.wait(lock, [&]() { return mStreamQueue.size() < STREAM_QUEUE_DEPTH || mStreamCancel; });
+			mStreamQueue.push_back(std::move(chunk));
+		}
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(mStreamMutex);
+		mStreamError = std::current_exception();
 	}
 
+	std::lock_guard<std::mutex> lock(mStreamMutex);
+	mStreamWorkerDone = true;
+}
+
+void VulkanRenderer::pumpMeshStream()
+{
+	if (!mStreaming)
+		return;
+	TRACE_FUNCTION();
+
+	bool workerDone;
+	{
+		std::lock_guard<std::mutex> lock(mStreamMutex);
+		if (mStreamError)
+			std::rethrow_exception(mStreamError);
+		workerDone = mStreamWorkerDone;
+	}
+
+	// fill every free slot we can without waiting, oldest first. A slot the GPU hasn't finished with yet means the
+	// ones after it are busy too, so that's as far as we get this frame.
+	while (true)
+	{
+		if (!mStreamChunkPending)
+		{
+			std::lock_guard<std::mutex> lock(mStreamMutex);
+			if (mStreamQueue.empty())
+				break;
+			mStreamChunk = std::move(mStreamQueue.front());
+			mStreamQueue.pop_front();
+			mStreamQueueSpace.notify_one();
+			mStreamVertexBytesDone = 0;
+			mStreamIndexBytesDone = 0;
+			mStreamChunkPending = true;
+		}
+
+		UploadSlot& slot = mStreamSlots[mStreamNextSlot];
+		if (vkGetFenceStatus(mLogicalDevice, slot.fence) != VK_SUCCESS)
+			break;
+		mStaging.fenceSignalled(slot.fence);
+
+		// vertices first, so the indices never go out ahead of what they point at.
+		size_t vertexBytes = mStreamChunk.vertices.size() * sizeof(Vertex);
+		size_t indexBytes = mStreamChunk.indices.size() * sizeof(uint32_t);
+		size_t vertexPiece = std::min<size_t>(vertexBytes - mStreamVertexBytesDone, STREAM_UPLOAD_SIZE);
+		size_t indexPiece = std::min<size_t>(indexBytes - mStreamIndexBytesDone, STREAM_UPLOAD_SIZE - vertexPiece);
+		// keep index copies 4 byte aligned.
+		indexPiece &= ~size_t(3);
+
+		// the ring's full of uploads still in flight, try again next frame.
+		StagingRegion staging;
+		if (!mStaging.allocate(vertexPiece + indexPiece, sizeof(uint32_t), staging))
+			break;
+		memcpy(staging.mapped, reinterpret_cast<const char*>(mStreamChunk.vertices.data()) + mStreamVertexBytesDone, vertexPiece);
+		memcpy(staging.mapped + vertexPiece, reinterpret_cast<const char*>(mStreamChunk.indices.data()) + mStreamIndexBytesDone, indexPiece);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		vkBeginCommandBuffer(slot.commandBuffer, &beginInfo);
+
+		if (vertexPiece)
+		{
+			VkBufferCopy copyRegion{};
+			copyRegion.srcOffset = staging.offset;
+			copyRegion.dstOffset = mStreamChunk.firstVertex * sizeof(Vertex) + mStreamVertexBytesDone;
+			copyRegion.size = vertexPiece;
+			vkCmdCopyBuffer(slot.commandBuffer, staging.buffer, mVertexBuffer, 1, &copyRegion);
+		}
+		if (indexPiece)
+		{
+			VkBufferCopy copyRegion{};
+			copyRegion.srcOffset = staging.offset + vertexPiece;
+			copyRegion.dstOffset = mStreamChunk.firstIndex * sizeof(uint32_t) + mStreamIndexBytesDone;
+			copyRegion.size = indexPiece;
+			vkCmdCopyBuffer(slot.commandBuffer, staging.buffer, mIndexBuffer, 1, &copyRegion);
+		}
+
+		// every draw submitted after this on the queue sees the copy.
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+		vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+			1, &barrier, 0, nullptr, 0, nullptr);
+		vkEndCommandBuffer(slot.commandBuffer);
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &slot.commandBuffer;
+		vkResetFences(mLogicalDevice, 1, &slot.fence);
+		if (vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, slot.fence) != VK_SUCCESS)
+			throw std::runtime_error("Error submitting a mesh stream upload.");
+		mStaging.submit(slot.fence);
+		mStreamNextSlot = (mStreamNextSlot + 1) % STREAM_UPLOAD_SLOT_COUNT;
+
+		mStreamVertexBytesDone += vertexPiece;
+		mStreamIndexBytesDone += indexPiece;
+		if (mStreamVertexBytesDone == vertexBytes && mStreamIndexBytesDone == indexBytes)
+		{
+			// the whole chunk is on the queue, so draw up to the end of it. selectLod copies this into the
+			// indirect buffer for this frame.
+			mStreamChunkPending = false;
+			mIndexCount = mStreamChunk.firstIndex + mStreamChunk.indices.size();
+			mSubmeshes[0].mLods[0].mIndexCount = static_cast<uint32_t>(mIndexCount);
+			if (mStreamFirstGeometryMs < 0.0)
+				mStreamFirstGeometryMs = elapsedMs(mStreamStart, StatClock::now());
+		}
+	}
+
+	if (workerDone && !mStreamChunkPending)
+	{
+		bool queueEmpty;
+		{
+			std::lock_guard<std::mutex> lock(mStreamMutex);
+			queueEmpty = mStreamQueue.empty();
+		}
+		if (queueEmpty)
+		{
+			endMeshStream();
+			std::cout << "Streamed " << MODEL << ": " << mIndexCount / 3 << " triangles, first geometry after " << mStreamFirstGeometryMs
+				<< " ms, done after " << elapsedMs(mStreamStart, StatClock::now()) << " ms" << std::endl;
+		}
+	}
+}
+
+void VulkanRenderer::endMeshStream()
+{
+	TRACE_FUNCTION();
+	{
+		// under the lock, or the worker could miss the wake up between checking and sleeping.
+		std::lock_guard<std::mutex> lock(mStreamMutex);
+		mStreamCancel = true;
+	}
+	mStreamQueueSpace.notify_all();
+	if (mStreamThread.joinable())
+		mStreamThread.join();
+	mStreamReader.close();
+	mStreamQueue.clear();
+	mStreamChunk = MeshStreamChunk();
+
+	for (UploadSlot& slot : mStreamSlots)
+	{
+		vkWaitForFences(mLogicalDevice, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+		mStaging.fenceSignalled(slot.fence);
+		vkDestroyFence(mLogicalDevice, slot.fence, nullptr);
+	}
+	mStreamSlots.clear();
+	vkDestroyCommandPool(mLogicalDevice, mStreamCommandPool, nullptr);
+	mStreaming = false;
+}
+
+// clears a feedback buffer to VT_FEEDBACK_EMPTY and picks which pixel of each tile writes into it next time. The
+// pixel steps through the whole tile over VT_FEEDBACK_TILE^2 frames (37 is coprime to 64), so small or thin things
+// get seen sooner or later.
+static void resetFeedback(uint32_t* feedback, size_t count, uint32_t tilesX, uint64_t frameNumber)
+{
+	uint32_t jitter = static_cast<uint32_t>((frameNumber * 37) % (VT_FEEDBACK_TILE * VT_FEEDBACK_TILE));
+	feedback[0] = jitter % VT_FEEDBACK_TILE | (jitter / VT_FEEDBACK_TILE) << 8;
+	feedback[1] = tilesX;
+	memset(feedback + VT_FEEDBACK_HEADER, 0xFF, count * sizeof(uint32_t));
+}
+
+void VulkanRenderer::createVirtualTextures()
+{
+	TRACE_FUNCTION();
+	// pages get cut out of the decoded source, so a cooked KTX2 / DDS copy is no use here.
+	for (Texture& texture : mTextures)
+	{
+		texture.compressed = TextureFile();
+		mVirtualTextures.addTexture(texture.path, static_cast<uint32_t>(texture.width), static_cast<uint32_t>(texture.height));
+	}
+
+	uint32_t atlasSize = VT_ATLAS_SLOTS * VT_SLOT_SIZE;
+	createImage(atlasSize, atlasSize, 1, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mPageAtlas, mPageAtlasMemory);
+	mPageAtlasView = createImageView(mPageAtlas, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+	// every upload after this moves it from shader read to transfer and back. Nothing samples a slot before it's filled.
+	transitionImageLayout(mPageAtlas, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
+	transitionImageLayout(mPageAtlas, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
+
+	// the page tables start out empty. The streamer has them all marked dirty, so the first pump (before the first
+	// frame is submitted) fills them in.
+	VkDeviceSize pageTableBytes = 0;
+	mPageTables.resize(mTextures.size());
+	for (uint32_t t = 0; t < mTextures.size(); ++t)
+	{
+		const VirtualTextureLayout& layout = mVirtualTextures.layout(t);
+		VirtualPageTable& table = mPageTables[t];
+		createImage(layout.pagesX, layout.pagesY, layout.mipCount, VK_FORMAT_R8G8B8A8_UINT, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, table.image, table.memory);
+		table.view = createImageView(table.image, VK_FORMAT_R8G8B8A8_UINT, VK_IMAGE_ASPECT_COLOR_BIT, layout.mipCount);
+		transitionImageLayout(table.image, VK_FORMAT_R8G8B8A8_UINT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout.mipCount);
+		transitionImageLayout(table.image, VK_FORMAT_R8G8B8A8_UINT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, layout.mipCount);
+
+		for (uint32_t mip = 0; mip < layout.mipCount; ++mip)
+			pageTableBytes += VkDeviceSize(layout.tableWidth(mip)) * layout.tableHeight(mip) * 4;
+	}
+
+	// same setup as the mesh stream's slots: each one's re-recorded when it comes round, if its fence says it's free.
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = findQueueFamilies(mPhysicalDevice).graphicsFamily.value();
+	if (vkCreateCommandPool(mLogicalDevice, &poolInfo, nullptr, &mVirtualCommandPool) != VK_SUCCESS)
+		throw std::runtime_error("Error creating the virtual texture command pool");
+
+	// room for a full frame of pages plus every page table, in case they all changed.
+	mVirtualUploadSize = VT_MAX_PAGES_PER_FRAME * VT_SLOT_BYTES + pageTableBytes;
+	if (mVirtualUploadSize > mStaging.size() / 2)
+		throw std::runtime_error("virtual texture page tables too big for the staging ring");
+
+	std::vector<VkCommandBuffer> commandBuffers(VIRTUAL_UPLOAD_SLOT_COUNT);
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = mVirtualCommandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = VIRTUAL_UPLOAD_SLOT_COUNT;
+	if (vkAllocateCommandBuffers(mLogicalDevice, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+		throw std::runtime_error("Unable to allocate virtual texture command buffers!");
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	mVirtualSlots.resize(VIRTUAL_UPLOAD_SLOT_COUNT);
+	for (uint32_t i = 0; i < VIRTUAL_UPLOAD_SLOT_COUNT; ++i)
+	{
+		mVirtualSlots[i].commandBuffer = commandBuffers[i];
+		if (vkCreateFence(mLogicalDevice, &fenceInfo, nullptr, &mVirtualSlots[i].fence) != VK_SUCCESS)
+			throw std::runtime_error("Error creating a virtual texture fence");
+	}
+	mVirtualNextSlot = 0;
+
+	mVirtualTextures.start();
+}
+
+void VulkanRenderer::createFeedbackBuffers()
+{
+	if (!mSettings.virtualTextures)
+		return;
+	TRACE_FUNCTION();
+	mFeedbackTilesX = (mSwapChainExtent.width + VT_FEEDBACK_TILE - 1) / VT_FEEDBACK_TILE;
+	mFeedbackTilesY = (mSwapChainExtent.height + VT_FEEDBACK_TILE - 1) / VT_FEEDBACK_TILE;
+	size_t count = size_t(mFeedbackTilesX) * mFeedbackTilesY;
+	mFeedbackSize = (VT_FEEDBACK_HEADER + count) * sizeof(uint32_t);
+
+	// one buffer, each image's piece bound with a dynamic offset like the uniforms.
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(mPhysicalDevice, &properties);
+	VkDeviceSize alignment = properties.limits.minStorageBufferOffsetAlignment;
+	mFeedbackStride = (mFeedbackSize + alignment - 1) / alignment * alignment;
+
+	// the CPU reads every request back, so cached memory if there is any.
+	createBuffer(mFeedbackStride * mSwapChainImages.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostCachedMemoryProperties(),
+		mFeedbackRing, mFeedbackRingMemory);
+	mFeedbackBuffersMapped.resize(mSwapChainImages.size());
+	for (size_t i = 0; i < mSwapChainImages.size(); ++i)
+	{
+		mFeedbackBuffersMapped[i] = reinterpret_cast<uint32_t*>(mFeedbackRingMemory.mapped + mFeedbackStride * i);
+		resetFeedback(mFeedbackBuffersMapped[i], count, mFeedbackTilesX, mFrameNumber + i);
+	}
+}
+
+void VulkanRenderer::readVirtualTextureFeedback(uint32_t imageIndex)
+{
+	if (!mSettings.virtualTextures)
+		return;
+	TRACE_FUNCTION();
+	// the image's last submit is done and its fence makes the shader writes visible, so this is whatever that frame
+	// asked for. Clearing it here is seen by the next submit without a flush, the memory's coherent.
+	size_t count = size_t(mFeedbackTilesX) * mFeedbackTilesY;
+	uint32_t* feedback = mFeedbackBuffersMapped[imageIndex];
+	mVirtualTextures.processFeedback(feedback + VT_FEEDBACK_HEADER, count, mFrameNumber);
+	resetFeedback(feedback, count, mFeedbackTilesX, mFrameNumber);
+}
+
+void VulkanRenderer::pumpVirtualTextures()
+{
+	if (!mSettings.virtualTextures)
+		return;
+	TRACE_FUNCTION();
+
+	// the GPU is still busy with the slot, or the staging ring's full of uploads still in flight: the pages can wait
+	// a frame. The worst case gets taken up front, pages and page tables can't be put back once they're taken.
+	UploadSlot& slot = mVirtualSlots[mVirtualNextSlot];
+	if (vkGetFenceStatus(mLogicalDevice, slot.fence) != VK_SUCCESS)
+		return;
+	mStaging.fenceSignalled(slot.fence);
+	StagingRegion staging;
+	if (!mStaging.allocate(mVirtualUploadSize, sizeof(uint32_t), staging))
+		return;
+
+	mVirtualTextures.takePages(mVirtualPages, VT_MAX_PAGES_PER_FRAME, mFrameNumber);
+
+	VkDeviceSize used = 0;
+	std::vector<VkBufferImageCopy> pageCopies;
+	for (const VirtualPage& page : mVirtualPages)
+	{
+		memcpy(staging.mapped + used, page.texels.data(), VT_SLOT_BYTES);
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = staging.offset + used;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { static_cast<int32_t>(page.slot % VT_ATLAS_SLOTS * VT_SLOT_SIZE), static_cast<int32_t>(page.slot / VT_ATLAS_SLOTS * VT_SLOT_SIZE), 0 };
+		region.imageExtent = { VT_SLOT_SIZE, VT_SLOT_SIZE, 1 };
+		pageCopies.push_back(region);
+		used += VT_SLOT_BYTES;
+	}
+
+	// then whichever page table mips changed, whole mips at a time. They're tiny.
+	std::vector<uint32_t> tableTextures;
+	std::vector<VkBufferImageCopy> tableCopies;
+	for (uint32_t t = 0; t < mPageTables.size(); ++t)
+	{
+		const VirtualTextureLayout& layout = mVirtualTextures.layout(t);
+		for (uint32_t mip = 0; mip < layout.mipCount; ++mip)
+		{
+			if (!mVirtualTextures.takeDirty(t, mip))
+				continue;
+			const std::vector<uint32_t>& table = mVirtualTextures.pageTable(t, mip);
+			memcpy(staging.mapped + used, table.data(), table.size() * sizeof(uint32_t));
+
+			VkBufferImageCopy region{};
+			region.bufferOffset = staging.offset + used;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = mip;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent = { layout.tableWidth(mip), layout.tableHeight(mip), 1 };
+			tableTextures.push_back(t);
+			tableCopies.push_back(region);
+			used += table.size() * sizeof(uint32_t);
+		}
+	}
+
+	// nothing copies out of the piece, so it can go straight back.
+	if (pageCopies.empty() && tableCopies.empty())
+	{
+		mStaging.submit(VK_NULL_HANDLE);
+		return;
+	}
+
+	// frames already on the queue may still be sampling the slots being replaced and the old page tables. The
+	// barriers' first scope covers every earlier submit, so the copies wait for those fragment shaders, and frames
+	// submitted after this see the new contents.
+	std::vector<VkImageMemoryBarrier> toTransfer, toShader;
+	auto addImage = [&](VkImage image, uint32_t mipLevels)
+	{
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcAccessMask = 0; // only reads to wait for
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		toTransfer.push_back(barrier);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		toShader.push_back(barrier);
+	};
+	if (!pageCopies.empty())
+		addImage(mPageAtlas, 1);
+	for (size_t i = 0; i < tableTextures.size(); ++i)
+	{
+		if (i == 0 || tableTextures[i] != tableTextures[i - 1])
+			addImage(mPageTables[tableTextures[i]].image, mVirtualTextures.layout(tableTextures[i]).mipCount);
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(slot.commandBuffer, &beginInfo);
+
+	vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		0, nullptr, 0, nullptr, static_cast<uint32_t>(toTransfer.size()), toTransfer.data());
+	if (!pageCopies.empty())
+	{
+		vkCmdCopyBufferToImage(slot.commandBuffer, staging.buffer, mPageAtlas, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(pageCopies.size()), pageCopies.data());
+	}
+	for (size_t i = 0; i < tableCopies.size(); ++i)
+	{
+		vkCmdCopyBufferToImage(slot.commandBuffer, staging.buffer, mPageTables[tableTextures[i]].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &tableCopies[i]);
+	}
+	vkCmdPipelineBarrier(slot.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+		0, nullptr, 0, nullptr, static_cast<uint32_t>(toShader.size()), toShader.data());
+	vkEndCommandBuffer(slot.commandBuffer);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &slot.commandBuffer;
+	vkResetFences(mLogicalDevice, 1, &slot.fence);
+	if (vkQueueSubmit(mGraphicsQueue, 1, &submitInfo, slot.fence) != VK_SUCCESS)
+		throw std::runtime_error("Error submitting a virtual texture upload.");
+	mStaging.submit(slot.fence);
+	mVirtualNextSlot = (mVirtualNextSlot + 1) % VIRTUAL_UPLOAD_SLOT_COUNT;
+}
+
+void VulkanRenderer::destroyVirtualTextures()
+{
+	TRACE_FUNCTION();
+	mVirtualTextures.stop();
+	VirtualTextureStats stats = mVirtualTextures.stats();
+	std::cout << "Virtual textures: " << stats.uploaded << " pages uploaded, " << stats.evicted << " evicted, " << stats.resident
+		<< " resident at the end, " << stats.sourcesDecoded << " images decoded" << std::endl;
+
+	for (UploadSlot& slot : mVirtualSlots)
+	{
+		vkWaitForFences(mLogicalDevice, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+		mStaging.fenceSignalled(slot.fence);
+		vkDestroyFence(mLogicalDevice, slot.fence, nullptr);
+	}
+	mVirtualSlots.clear();
+	vkDestroyCommandPool(mLogicalDevice, mVirtualCommandPool, nullptr);
+
+	for (VirtualPageTable& table : mPageTables)
+	{
+		vkDestroyImageView(mLogicalDevice, table.view, nullptr);
+		vkDestroyImage(mLogicalDevice, table.image, nullptr);
+		mAllocator.free(table.memory);
+	}
+	mPageTables.clear();
+
+	vkDestroyImageView(mLogicalDevice, mPageAtlasView, nullptr);
+	vkDestroyImage(mLogicalDevice, mPageAtlas, nullptr);
+	mAllocator.free(mPageAtlasMemory);
+}
+
+void VulkanRenderer::createUniformBuffers()
+{
+	TRACE_FUNCTION();
+	// one ring with a slot per swap chain image rather than a buffer each. It stays mapped, updateUniformBuffer just
+	// writes the frame's slot, and the slots are aligned so any of them can be a dynamic offset.
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(mPhysicalDevice, &properties);
+	VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+	mUniformStride = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+
+	createBuffer(mUniformStride * mSwapChainImages.size(), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, mUniformRing, mUniformRingMemory);
+}
+
+void VulkanRenderer::createIndirectBuffers()
+{
+	TRACE_FUNCTION();
+	// one command per submesh, in draw order.
+	VkDeviceSize bufferSize = sizeof(VkDrawIndexedIndirectCommand) * mSubmeshes.size();
+
+	mIndirectBuffers.resize(mSwapChainImages.size());
+	mIndirectBuffersMemory.resize(mSwapChainImages.size());
+	mIndirectBuffersMapped.resize(mSwapChainImages.size());
+
+	for (size_t i = 0; i < mSwapChainImages.size(); ++i)
+	{
+		createBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			mIndirectBuffers[i], mIndirectBuffersMemory[i]);
+		mIndirectBuffersMapped[i] = mIndirectBuffersMemory[i].mapped;
+
+		// start on LOD 0 until the first selectLod.
+		VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(mIndirectBuffersMapped[i]);
+		for (size_t s = 0; s < mSubmeshes.size(); ++s)
+		{
+			VkDrawIndexedIndirectCommand command = {};
+			command.indexCount = mSubmeshes[s].mLods[0].mIndexCount;
+			command.instanceCount = 1;
+			command.firstIndex = mSubmeshes[s].mLods[0].mFirstIndex;
+			command.vertexOffset = mSubmeshes[s].mVertexOffset;
+			commands[s] = command;
+		}
+	}
 }
 
 void VulkanRenderer::createDescriptorPool()
 {
-	std::array<VkDescriptorPoolSize, 2> poolSizes{};
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = static_cast<uint32_t>(mSwapChainImages.size());
+	TRACE_FUNCTION();
+	// a set per texture.
+	uint32_t setCount = static_cast<uint32_t>(mTextures.size());
+	std::vector<VkDescriptorPoolSize> poolSizes(2);
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[0].descriptorCount = setCount;
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = static_cast<uint32_t>(mSwapChainImages.size());
+	poolSizes[1].descriptorCount = setCount;
+	// virtual textures: the page table as well as the atlas, and the feedback buffer.
+	if (mSettings.virtualTextures)
+	{
+		poolSizes[1].descriptorCount = setCount * 2;
+		poolSizes.push_back({ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, setCount });
+	}
 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = static_cast<uint32_t>(mSwapChainImages.size());
+	poolInfo.maxSets = setCount;
 
 	if (vkCreateDescriptorPool(mLogicalDevice, &poolInfo, nullptr, &mDescriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create descriptor pool!");
@@ -1299,65 +3156,133 @@ void VulkanRenderer::createDescriptorPool()
 
 void VulkanRenderer::createDescriptorSet()
 {
-	std::vector<VkDescriptorSetLayout> layouts(mSwapChainImages.size(), mDescriptorSetLayout);
+	TRACE_FUNCTION();
+	size_t setCount = mTextures.size();
+	std::vector<VkDescriptorSetLayout> layouts(setCount, mDescriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = mDescriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(mSwapChainImages.size());
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(setCount);
 	allocInfo.pSetLayouts = layouts.data();
 
-	mDescriptorSets.resize(mSwapChainImages.size());
+	mDescriptorSets.resize(setCount);
 	if (vkAllocateDescriptorSets(mLogicalDevice, &allocInfo, mDescriptorSets.data()) != VK_SUCCESS) 
 		throw std::runtime_error("failed to allocate descriptor sets!");
 	
 
-	for (size_t i = 0; i < mSwapChainImages.size(); i++) 
+	for (size_t set = 0; set < setCount; set++) 
 	{
+		// the offset gets added to by the image's dynamic offset when it's bound.
 		VkDescriptorBufferInfo bufferInfo{};
-		bufferInfo.buffer = uniformBuffers[i];
+		bufferInfo.buffer = mUniformRing;
 		bufferInfo.offset = 0;
 		bufferInfo.range = sizeof(UniformBufferObject);
 
 		VkDescriptorImageInfo imageInfo{};
 		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = mTextureimageView;
-		imageInfo.sampler = mTextureSampler;
+		imageInfo.sampler = VK_NULL_HANDLE; // immutable, see createDescriptorSetLayout
+
+		// a virtual texture's set gets the shared atlas, its own page table and the feedback ring.
+		VkDescriptorImageInfo pageTableInfo = imageInfo;
+		VkDescriptorBufferInfo feedbackInfo{};
+		if (mSettings.virtualTextures)
+		{
+			imageInfo.imageView = mPageAtlasView;
+			pageTableInfo.imageView = mPageTables[set].view;
+			feedbackInfo.buffer = mFeedbackRing;
+			feedbackInfo.offset = 0;
+			feedbackInfo.range = mFeedbackSize;
+		}
+		else
+			imageInfo.imageView = mTextureCache.get(mTextures[set].handle).view;
 
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+		std::vector<VkWriteDescriptorSet> descriptorWrites(mSettings.virtualTextures ? 4 : 2);
 
 		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = mDescriptorSets[i];
+		descriptorWrites[0].dstSet = mDescriptorSets[set];
 		descriptorWrites[0].dstBinding = 0;
 		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 		descriptorWrites[0].descriptorCount = 1;
 		descriptorWrites[0].pBufferInfo = &bufferInfo;
 
 		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = mDescriptorSets[i];
+		descriptorWrites[1].dstSet = mDescriptorSets[set];
 		descriptorWrites[1].dstBinding = 1;
 		descriptorWrites[1].dstArrayElement = 0;
 		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		descriptorWrites[1].descriptorCount = 1;
 		descriptorWrites[1].pImageInfo = &imageInfo;
 
+		if (mSettings.virtualTextures)
+		{
+			descriptorWrites[2] = descriptorWrites[1];
+			descriptorWrites[2].dstBinding = 2;
+			descriptorWrites[2].pImageInfo = &pageTableInfo;
+
+			descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[3].dstSet = mDescriptorSets[set];
+			descriptorWrites[3].dstBinding = 3;
+			descriptorWrites[3].dstArrayElement = 0;
+			descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+			descriptorWrites[3].descriptorCount = 1;
+			descriptorWrites[3].pBufferInfo = &feedbackInfo;
+		}
+
 		vkUpdateDescriptorSets(mLogicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 	}
 }
 
-void VulkanRenderer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+void VulkanRenderer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset, VkDeviceSize dstOffset)
 {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	VkCommandBuffer commandBuffer = mUploads.record();
 
 	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset = srcOffset;
+	copyRegion.dstOffset = dstOffset;
 	copyRegion.size = size;
 	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
-	endSingleTimeCommands(commandBuffer);
+}
+
+bool VulkanRenderer::makeStagingRoom()
+{
+	if (mUploads.recording())
+	{
+		mUploads.submit();
+		return true;
+	}
+	return mStaging.waitOldest();
+}
+
+StagingRegion VulkanRenderer::waitForStaging(VkDeviceSize size, VkDeviceSize alignment)
+{
+	StagingRegion region;
+	while (!mStaging.allocate(size, alignment, region))
+	{
+		if (!makeStagingRoom())
+			throw std::runtime_error("an upload of " + std::to_string(size) + " bytes doesn't fit in the staging ring");
+	}
+	return region;
+}
+
+void VulkanRenderer::uploadToBuffer(VkBuffer dst, VkDeviceSize dstOffset, size_t elementSize, size_t count,
+	const std::function<void(unsigned char* out, size_t first, size_t count)>& fill)
+{
+	// a quarter at a time, so a piece always fits however the ring's being used.
+	size_t perPiece = std::max<size_t>(1, static_cast<size_t>(mStaging.size() / 4) / elementSize);
+	for (size_t first = 0; first < count; first += perPiece)
+	{
+		size_t pieceCount = std::min(perPiece, count - first);
+		StagingRegion region = waitForStaging(pieceCount * elementSize, TEXTURE_STAGING_ALIGNMENT);
+		fill(region.mapped, first, pieceCount);
+		copyBuffer(region.buffer, dst, pieceCount * elementSize, region.offset, dstOffset + first * elementSize);
+	}
 }
 
 void VulkanRenderer::createCommandBuffers()
 {
+	TRACE_FUNCTION();
 	mCommandBuffers.resize(mSwapChainFrameBuffers.size());
 
 	VkCommandBufferAllocateInfo allocInfo = {};
@@ -1369,6 +3294,10 @@ void VulkanRenderer::createCommandBuffers()
 	if (vkAllocateCommandBuffers(mLogicalDevice, &allocInfo, mCommandBuffers.data()) != VK_SUCCESS) 
 		throw std::runtime_error("Unable to allocate command buffers!");
 
+	// one slot of timestamp queries per command buffer.
+	mGpuProfiler.create(mLogicalDevice, mPhysicalDevice, findQueueFamilies(mPhysicalDevice).graphicsFamily.value(),
+		static_cast<uint32_t>(mCommandBuffers.size()));
+
 	for (size_t i = 0; i < mCommandBuffers.size(); i++) {
 		VkCommandBufferBeginInfo beginInfo = {};
 		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -1379,6 +3308,9 @@ void VulkanRenderer::createCommandBuffers()
 			throw std::runtime_error("failed to begin recording command buffer!");
 		}
 
+		uint32_t slot = static_cast<uint32_t>(i);
+		mGpuProfiler.beginFrame(mCommandBuffers[i], slot);
+
 		// record commands into the current command buffer
 		VkRenderPassBeginInfo renderPassInfo = {};
 		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -1394,20 +3326,108 @@ void VulkanRenderer::createCommandBuffers()
 		renderPassInfo.pClearValues = clearValues.data();
 
 		// actually record the commands
+		mGpuProfiler.beginZone(mCommandBuffers[i], slot, GPU_ZONE_MAIN_PASS);
 		vkCmdBeginRenderPass(mCommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 		vkCmdBindPipeline(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, mGraphicsPipeline);
 		// send vertex buffer
-		VkBuffer vertexBuffers[] = { mVertexBuffer };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(mCommandBuffers[i], 0, 1, vertexBuffers, offsets);
+		// one binding per stream, all in the same buffer.
+		std::vector<VkBuffer> vertexBuffers(mVertexStreamOffsets.size(), mVertexBuffer);
+		vkCmdBindVertexBuffers(mCommandBuffers[i], 0, static_cast<uint32_t>(vertexBuffers.size()), vertexBuffers.data(), mVertexStreamOffsets.data());
 		vkCmdBindIndexBuffer(mCommandBuffers[i], mIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
 
-		vkCmdBindDescriptorSets(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, 1, &mDescriptorSets[i], 0, nullptr);
+		vkCmdPushConstants(mCommandBuffers[i], mPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshDequantization), &mMeshInfo.mDequantization);
 		//vkCmdDraw(mCommandBuffers[i], 3, 1, 0, 0);
-		vkCmdDrawIndexed(mCommandBuffers[i], static_cast<uint32_t>(mIndices.size()), 1, 0, 0, 0);
+		mGpuProfiler.beginZone(mCommandBuffers[i], slot, GPU_ZONE_MESH_DRAW);
+		// submeshes are sorted by texture, so this only rebinds descriptors when the texture changes. Each LOD's index
+		// range comes from the indirect buffer, selectLod rewrites it every frame.
+		uint32_t boundTexture = UINT32_MAX;
+		int32_t pushedMaterial = -1;
+		for (size_t s = 0; s < mSubmeshes.size(); ++s)
+		{
+			uint32_t texture = submeshTexture(mSubmeshes[s]);
+			if (texture != boundTexture)
+			{
+				// this image's uniforms (and feedback), in binding order.
+				uint32_t dynamicOffsets[2] = { static_cast<uint32_t>(mUniformStride * i), static_cast<uint32_t>(mFeedbackStride * i) };
+				vkCmdBindDescriptorSets(mCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, mPipelineLayout, 0, 1,
+					&mDescriptorSets[texture], mSettings.virtualTextures ? 2 : 1, dynamicOffsets);
+				if (mSettings.virtualTextures)
+				{
+					const VirtualTextureLayout& layout = mVirtualTextures.layout(texture);
+					VirtualTextureParams params;
+					params.mSize = glm::vec2(layout.virtualWidth(), layout.virtualHeight());
+					params.mMipCount = layout.mipCount;
+					params.mTexture = texture;
+					vkCmdPushConstants(mCommandBuffers[i], mPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT,
+						sizeof(MeshDequantization) + sizeof(MaterialParams), sizeof(VirtualTextureParams), &params);
+				}
+				boundTexture = texture;
+			}
+			int32_t material = mSubmeshes[s].mMaterial;
+			if (s == 0 || material != pushedMaterial)
+			{
+				MaterialParams params;
+				params.mDiffuse = material < 0 ? glm::vec4(1.0f) : mMaterials[material].mDiffuse;
+				vkCmdPushConstants(mCommandBuffers[i], mPipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(MeshDequantization),
+					sizeof(MaterialParams), &params);
+				pushedMaterial = material;
+			}
+			vkCmdDrawIndexedIndirect(mCommandBuffers[i], mIndirectBuffers[i], s * sizeof(VkDrawIndexedIndirectCommand), 1,
+				sizeof(VkDrawIndexedIndirectCommand));
+		}
+		mGpuProfiler.endZone(mCommandBuffers[i], slot, GPU_ZONE_MESH_DRAW);
 		//vkCmdDrawIndexed(mCommandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
 		// stop recording
 		vkCmdEndRenderPass(mCommandBuffers[i]);
+		mGpuProfiler.endZone(mCommandBuffers[i], slot, GPU_ZONE_MAIN_PASS);
+
+		// the page requests get read once the fence says this submit is done.
+		if (mSettings.virtualTextures)
+		{
+			VkBufferMemoryBarrier feedbackBarrier{};
+			feedbackBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			feedbackBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			feedbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			feedbackBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			feedbackBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			feedbackBarrier.buffer = mFeedbackRing;
+			feedbackBarrier.offset = mFeedbackStride * i;
+			feedbackBarrier.size = mFeedbackSize;
+			vkCmdPipelineBarrier(mCommandBuffers[i], VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+				0, nullptr, 1, &feedbackBarrier, 0, nullptr);
+		}
+
+		// headless readback: copy the finished image into the host visible buffer for this slot.
+		if (mSettings.headless && mSettings.readback)
+		{
+			mGpuProfiler.beginZone(mCommandBuffers[i], slot, GPU_ZONE_READBACK);
+
+			VkBufferImageCopy region{};
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = 0;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageExtent = { mSwapChainExtent.width, mSwapChainExtent.height, 1 };
+			vkCmdCopyImageToBuffer(mCommandBuffers[i], mSwapChainImages[i], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				mOffscreenTargets[i].readbackBuffer, 1, &region);
+
+			// make the copy visible to the host once the fence says we're done.
+			VkBufferMemoryBarrier hostBarrier{};
+			hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			hostBarrier.buffer = mOffscreenTargets[i].readbackBuffer;
+			hostBarrier.offset = 0;
+			hostBarrier.size = VK_WHOLE_SIZE;
+			vkCmdPipelineBarrier(mCommandBuffers[i], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+				0, nullptr, 1, &hostBarrier, 0, nullptr);
+
+			mGpuProfiler.endZone(mCommandBuffers[i], slot, GPU_ZONE_READBACK);
+		}
+
+		mGpuProfiler.endFrame(mCommandBuffers[i], slot);
 		if (vkEndCommandBuffer(mCommandBuffers[i]) != VK_SUCCESS) {
 			throw std::runtime_error("Unable to record commands into command buffer");
 		}
@@ -1416,6 +3436,7 @@ void VulkanRenderer::createCommandBuffers()
 
 void VulkanRenderer::createSyncObjects()
 {
+	TRACE_FUNCTION();
 	mImageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
 	mRenderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
 	mInFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
@@ -1440,39 +3461,104 @@ void VulkanRenderer::createSyncObjects()
 
 }
 
-uint32_t VulkanRenderer::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+void VulkanRenderer::runRenderer()
 {
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(mPhysicalDevice, &memProperties);
+	if (mSettings.benchmark)
+	{
+		mFrameStats.start(mSettings.frameCount);
+		mGpuProfiler.startRecording(mSettings.frameCount);
+	}
 
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) 
+	auto startTime = StatClock::now();
+	mLastTitleUpdate = startTime;
+
+	if (mSettings.headless)
+	{
+		// no window to close, so render a fixed number of frames and report how fast that went.
+		while (mFrameNumber < mSettings.frameCount)
+			drawOffscreenFrame();
+	}
+	else
 	{
-		if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) 
-			return i;
+		// benchmark runs stop after frameCount frames, otherwise we go until the window closes.
+		while (!glfwWindowShouldClose(mWindow) && (!mSettings.benchmark || mFrameNumber < mSettings.frameCount))
+		{
+			glfwPollEvents();
+			drawFrame();
+			updateWindowTitle();
+		}
 	}
 
-	throw std::runtime_error("failed to find suitable memory type!");
+	vkDeviceWaitIdle(mLogicalDevice);
+	mGpuProfiler.collectAll();
 
-}
+	double seconds = std::chrono::duration<double>(StatClock::now() - startTime).count();
 
-void VulkanRenderer::runRenderer()
-{
-	while (!glfwWindowShouldClose(mWindow))
+	if (mSettings.headless)
 	{
-		glfwPollEvents();
-		drawFrame();
+		std::cout << "Headless: rendered " << mFrameNumber << " frames (" << mSettings.width << "x" << mSettings.height
+			<< ") in " << seconds << " s, " << mFrameNumber / seconds << " fps, "
+			<< seconds * 1000.0 / mFrameNumber << " ms/frame" << std::endl;
+
+		if (mGpuProfiler.isSupported())
+			std::cout << "Headless: GPU frame time (last " << mGpuProfiler.rolling(GPU_ZONE_FRAME).size() << " frames) mean "
+				<< mGpuProfiler.rolling(GPU_ZONE_FRAME).mean() << " ms, max " << mGpuProfiler.rolling(GPU_ZONE_FRAME).max() << " ms" << std::endl;
+
+		if (mSettings.readback && mFrameNumber > 0)
+			writeReadbackImage((mFrameNumber - 1) % OFFSCREEN_IMAGE_COUNT);
 	}
 
-	vkDeviceWaitIdle(mLogicalDevice);
+	if (mSettings.benchmark)
+		reportBenchmark(seconds);
+}
+
+void VulkanRenderer::reportBenchmark(double wallSeconds)
+{
+	mFrameStats.finish(mFrameNumber, mSettings.fixedTimestep, wallSeconds);
+	mFrameStats.printReport(std::cout, mGpuProfiler.series());
+	mFrameStats.writeJson(mSettings.benchmarkJsonPath, mGpuProfiler.series());
+
+	std::cout << "Benchmark results written to " << mSettings.benchmarkJsonPath << std::endl;
+}
+
+void VulkanRenderer::updateWindowTitle()
+{
+	auto now = StatClock::now();
+	if (elapsedMs(mLastTitleUpdate, now) < 1000.0)
+		return;
+	mLastTitleUpdate = now;
+
+	std::string title = "Sick Vulkan Window | cpu " + std::to_string(mFrameStats.rollingFrame().mean()) + " ms";
+	if (mGpuProfiler.isSupported())
+		title += " | gpu " + std::to_string(mGpuProfiler.rolling(GPU_ZONE_FRAME).mean()) + " ms";
+	title += " | lod " + std::to_string(mCurrentLod);
+
+	glfwSetWindowTitle(mWindow, title.c_str());
 }
 
 void VulkanRenderer::drawFrame()
 {
-	vkWaitForFences(mLogicalDevice, 1, &mInFlightFences[mCurrentFrame], VK_TRUE, UINT64_MAX);
+	TRACE_FUNCTION();
+	auto frameStart = StatClock::now();
+
+	{
+		TRACE_ZONE("waitInFlightFence");
+		vkWaitForFences(mLogicalDevice, 1, &mInFlightFences[mCurrentFrame], VK_TRUE, UINT64_MAX);
+	}
+	// that fence was frame mFrameNumber - MAX_FRAMES_IN_FLIGHT, so nothing released before it can still be in use.
+	mTextureCache.collect(mLogicalDevice, mAllocator, mFrameNumber, MAX_FRAMES_IN_FLIGHT);
 	//vkResetFences(mLogicalDevice, 1, &mInFlightFences[mCurrentFrame]);
+	auto waitEnd = StatClock::now();
+	double waitMs = elapsedMs(frameStart, waitEnd);
+
 	// acquire an image from the swap chain
 	uint32_t imageIndex;
-	auto result = vkAcquireNextImageKHR(mLogicalDevice, mSwapChain, UINT64_MAX, mImageAvailableSemaphores[mCurrentFrame], VK_NULL_HANDLE, &imageIndex);
+	VkResult result;
+	{
+		TRACE_ZONE("acquireNextImage");
+		result = vkAcquireNextImageKHR(mLogicalDevice, mSwapChain, UINT64_MAX, mImageAvailableSemaphores[mCurrentFrame], VK_NULL_HANDLE, &imageIndex);
+	}
+	auto acquireEnd = StatClock::now();
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR)
 	{
@@ -1484,12 +3570,32 @@ void VulkanRenderer::drawFrame()
 
 	// check to see if a previous frame is using this frame we're drawing to.
 	if (mImagesInFlight[imageIndex] != VK_NULL_HANDLE)
+	{
+		TRACE_ZONE("waitImageInFlight");
 		vkWaitForFences(mLogicalDevice, 1, &mImagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+	}
+	auto imageWaitEnd = StatClock::now();
+	waitMs += elapsedMs(acquireEnd, imageWaitEnd);
+
+	// the last submit of this command buffer is done now, so its timestamps are ready to read.
+	mGpuProfiler.collect(imageIndex);
 
 	// mark this frame in use
 	mImagesInFlight[imageIndex] = mInFlightFences[mCurrentFrame];
 
-	updateUniformBuffer(imageIndex);
+	// uploads go on the queue ahead of this frame's submit, so anything that lands here gets drawn this frame. Load
+	// time ones (a resize's depth buffer) first, the pumps submit the staging ring too and must not take their pieces.
+	mUploads.submit();
+	pumpMeshStream();
+	readVirtualTextureFeedback(imageIndex);
+	pumpVirtualTextures();
+	auto streamEnd = StatClock::now();
+
+	{
+		TRACE_ZONE("updateUniformBuffer");
+		updateUniformBuffer(imageIndex);
+	}
+	auto updateEnd = StatClock::now();
 
 	// execute command buffer w/ image
 	VkSubmitInfo commandSubmitInfo = {};
@@ -1511,8 +3617,13 @@ void VulkanRenderer::drawFrame()
 
 	vkResetFences(mLogicalDevice, 1, &mInFlightFences[mCurrentFrame]);
 
-	if (vkQueueSubmit(mGraphicsQueue, 1, &commandSubmitInfo, mInFlightFences[mCurrentFrame]) != VK_SUCCESS)
-		throw std::runtime_error("Error submitting a draw command buffer.");	
+	{
+		TRACE_ZONE("queueSubmit");
+		if (vkQueueSubmit(mGraphicsQueue, 1, &commandSubmitInfo, mInFlightFences[mCurrentFrame]) != VK_SUCCESS)
+			throw std::runtime_error("Error submitting a draw command buffer.");	
+	}
+	mGpuProfiler.markSubmitted(imageIndex);
+	auto submitEnd = StatClock::now();
 
 	// return image to present it
 
@@ -1526,7 +3637,20 @@ void VulkanRenderer::drawFrame()
 	presentInfo.pSwapchains = swapChains;
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = nullptr;
-	result = vkQueuePresentKHR(mPresentQueue, &presentInfo);
+	{
+		TRACE_ZONE("queuePresent");
+		result = vkQueuePresentKHR(mPresentQueue, &presentInfo);
+	}
+	auto presentEnd = StatClock::now();
+
+	mFrameStats.record(FRAME_PHASE_WAIT, waitMs);
+	mFrameStats.record(FRAME_PHASE_ACQUIRE, waitEnd, acquireEnd);
+	mFrameStats.record(FRAME_PHASE_STREAM, imageWaitEnd, streamEnd);
+	mFrameStats.record(FRAME_PHASE_UPDATE, streamEnd, updateEnd);
+	mFrameStats.record(FRAME_PHASE_SUBMIT, updateEnd, submitEnd);
+	mFrameStats.record(FRAME_PHASE_PRESENT, submitEnd, presentEnd);
+	mFrameStats.record(FRAME_PHASE_TOTAL, frameStart, presentEnd);
+
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || frameBufferResized)
 	{
 		recreateSwapChain();
@@ -1535,6 +3659,73 @@ void VulkanRenderer::drawFrame()
 	else if (result != VK_SUCCESS)
 		throw std::runtime_error("failed to present swapchain");
 
+	++mFrameNumber;
+	mCurrentFrame = (mCurrentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+}
+
+// same as drawFrame, but there's nothing to acquire or present. We just walk the offscreen ring in order.
+void VulkanRenderer::drawOffscreenFrame()
+{
+	TRACE_FUNCTION();
+	auto frameStart = StatClock::now();
+
+	{
+		TRACE_ZONE("waitInFlightFence");
+		vkWaitForFences(mLogicalDevice, 1, &mInFlightFences[mCurrentFrame], VK_TRUE, UINT64_MAX);
+	}
+	mTextureCache.collect(mLogicalDevice, mAllocator, mFrameNumber, MAX_FRAMES_IN_FLIGHT);
+
+	uint32_t imageIndex = mFrameNumber % OFFSCREEN_IMAGE_COUNT;
+
+	// check to see if a previous frame is still using this image.
+	if (mImagesInFlight[imageIndex] != VK_NULL_HANDLE)
+	{
+		TRACE_ZONE("waitImageInFlight");
+		vkWaitForFences(mLogicalDevice, 1, &mImagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+	}
+	auto waitEnd = StatClock::now();
+
+	mGpuProfiler.collect(imageIndex);
+
+	mImagesInFlight[imageIndex] = mInFlightFences[mCurrentFrame];
+
+	// uploads go on the queue ahead of this frame's submit, so anything that lands here gets drawn this frame. Load
+	// time ones (a resize's depth buffer) first, the pumps submit the staging ring too and must not take their pieces.
+	mUploads.submit();
+	pumpMeshStream();
+	readVirtualTextureFeedback(imageIndex);
+	pumpVirtualTextures();
+	auto streamEnd = StatClock::now();
+
+	{
+		TRACE_ZONE("updateUniformBuffer");
+		updateUniformBuffer(imageIndex);
+	}
+	auto updateEnd = StatClock::now();
+
+	VkSubmitInfo commandSubmitInfo = {};
+	commandSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	commandSubmitInfo.commandBufferCount = 1;
+	commandSubmitInfo.pCommandBuffers = &mCommandBuffers[imageIndex];
+
+	vkResetFences(mLogicalDevice, 1, &mInFlightFences[mCurrentFrame]);
+
+	{
+		TRACE_ZONE("queueSubmit");
+		if (vkQueueSubmit(mGraphicsQueue, 1, &commandSubmitInfo, mInFlightFences[mCurrentFrame]) != VK_SUCCESS)
+			throw std::runtime_error("Error submitting an offscreen command buffer.");
+	}
+	mGpuProfiler.markSubmitted(imageIndex);
+	auto submitEnd = StatClock::now();
+
+	// nothing to acquire or present here, so those phases just don't get samples.
+	mFrameStats.record(FRAME_PHASE_WAIT, frameStart, waitEnd);
+	mFrameStats.record(FRAME_PHASE_STREAM, waitEnd, streamEnd);
+	mFrameStats.record(FRAME_PHASE_UPDATE, streamEnd, updateEnd);
+	mFrameStats.record(FRAME_PHASE_SUBMIT, updateEnd, submitEnd);
+	mFrameStats.record(FRAME_PHASE_TOTAL, frameStart, submitEnd);
+
+	++mFrameNumber;
 	mCurrentFrame = (mCurrentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
@@ -1545,19 +3736,70 @@ void VulkanRenderer::updateUniformBuffer(uint32_t imageIndex)
 	auto currentTime = std::chrono::high_resolution_clock::now();
 	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
+	// benchmark runs step a simulated clock instead, so frame N always looks the same.
+	if (mSettings.benchmark)
+		time = static_cast<float>(mFrameNumber * mSettings.fixedTimestep);
+
 	UniformBufferObject ubo{};
 	ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 	ubo.proj = glm::perspective(glm::radians(45.0f), mSwapChainExtent.width / (float)mSwapChainExtent.height, 0.1f, 100.0f);
 	ubo.proj[1][1] *= -1; // thank mr openGL
 
-	void* data;
-	vkMapMemory(mLogicalDevice, uniformBuffersMemory[imageIndex], 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(mLogicalDevice, uniformBuffersMemory[imageIndex]);
+	// the ring stays mapped and it's coherent, so this is all it takes. The image's fence has been waited on, so the
+	// GPU is done with its slot.
+	memcpy(mUniformRingMemory.mapped + mUniformStride * imageIndex, &ubo, sizeof(ubo));
+
+	selectLod(imageIndex, ubo);
 
 }
 
+void VulkanRenderer::selectLod(uint32_t imageIndex, const UniformBufferObject& ubo)
+{
+	// projected radius in pixels of the whole mesh's bounding sphere. Every submesh's LOD errors are measured against
+	// that same radius, so one projection does for all of them.
+	const glm::vec4& sphere = mMeshInfo.mBoundingSphere;
+	float projectedRadius = 0.0f;
+	if (mSettings.forceLod < 0)
+	{
+		// bounding sphere into view space. Scaling in the model matrix scales the radius by its biggest axis.
+		glm::vec4 center = ubo.view * ubo.model * glm::vec4(glm::vec3(sphere), 1.0f);
+		float scale = std::max({ glm::length(glm::vec3(ubo.model[0])), glm::length(glm::vec3(ubo.model[1])), glm::length(glm::vec3(ubo.model[2])) });
+
+		// the camera looks down -z, and proj[1][1] got flipped for vulkan so abs it.
+		float distance = std::max(-center.z, 0.0001f);
+		float pixelsPerUnit = std::fabs(ubo.proj[1][1]) * mSwapChainExtent.height * 0.5f / distance;
+		projectedRadius = sphere.w * scale * pixelsPerUnit;
+	}
+
+	mCurrentLod = 0;
+	VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(mIndirectBuffersMapped[imageIndex]);
+	for (size_t s = 0; s < mSubmeshes.size(); ++s)
+	{
+		const Submesh& submesh = mSubmeshes[s];
+		uint32_t lod = 0;
+		if (mSettings.forceLod >= 0)
+			lod = std::min(static_cast<uint32_t>(mSettings.forceLod), submesh.mLodCount - 1);
+		else
+		{
+			// errors only grow down the chain, so the last LOD that fits is the coarsest that fits.
+			for (uint32_t i = 1; i < submesh.mLodCount; ++i)
+			{
+				if (sphere.w > 0.0f && submesh.mLods[i].mError / sphere.w * projectedRadius <= mSettings.lodPixelError)
+					lod = i;
+			}
+		}
+		mCurrentLod = std::max(mCurrentLod, lod);
+
+		VkDrawIndexedIndirectCommand command = {};
+		command.indexCount = submesh.mLods[lod].mIndexCount;
+		command.instanceCount = 1;
+		command.firstIndex = submesh.mLods[lod].mFirstIndex;
+		command.vertexOffset = submesh.mVertexOffset;
+		commands[s] = command;
+	}
+}
+
 bool VulkanRenderer::checkValidationLayerSupport()
 {
 	uint32_t layerCount;
@@ -1590,11 +3832,17 @@ bool VulkanRenderer::checkValidationLayerSupport()
 
 std::vector<const char*> VulkanRenderer::getRequiredExtensions()
 {
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	std::vector<const char*> extensions;
 
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	// surface extensions only matter when there's a window. GLFW isn't even initialized in headless mode.
+	if (!mSettings.headless)
+	{
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
 	if (enableValidationLayers)
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -1604,19 +3852,30 @@ std::vector<const char*> VulkanRenderer::getRequiredExtensions()
 
 void VulkanRenderer::cleanRenderer()
 {
+	TRACE_FUNCTION();
+	// closed the window before the mesh finished streaming in.
+	if (mStreaming)
+		endMeshStream();
+	// anything still recorded (a resize's depth buffer, say) goes up and finishes before what it touches is destroyed.
+	mUploads.destroy();
+	// what the run ended up holding, before it all gets freed.
+	mAllocator.printStats(std::cout);
 	cleanupSwapChain();
 	vkDestroyBuffer(mLogicalDevice, mIndexBuffer, nullptr);
-	vkFreeMemory(mLogicalDevice, mIndexBufferMemory, nullptr);
-
-	vkDestroySampler(mLogicalDevice, mTextureSampler, nullptr);
-	vkDestroyImageView(mLogicalDevice, mTextureimageView, nullptr);
+	mAllocator.free(mIndexBufferMemory);
+
+	mSamplerCache.destroyAll(mLogicalDevice);
+	// the device is idle, so there are no frames in flight left to wait for. Anything still referenced after the
+	// materials let go is destroyed regardless.
+	releaseTextures();
+	mTextureCache.collect(mLogicalDevice, mAllocator, mFrameNumber + MAX_FRAMES_IN_FLIGHT, MAX_FRAMES_IN_FLIGHT);
+	mTextureCache.destroyAll(mLogicalDevice, mAllocator);
+	if (mSettings.virtualTextures)
+		destroyVirtualTextures();
+	mStaging.destroy(mAllocator);
 
 	vkDestroyBuffer(mLogicalDevice, mVertexBuffer, nullptr);
-	vkFreeMemory(mLogicalDevice, mVertexBufferDeviceMemory, nullptr);
-
-
-	vkDestroyImage(mLogicalDevice, mTextureImage, nullptr);
-	vkFreeMemory(mLogicalDevice, mTextureImageMemory, nullptr);
+	mAllocator.free(mVertexBufferDeviceMemory);
 
 
 	vkDestroyDescriptorSetLayout(mLogicalDevice, mDescriptorSetLayout, nullptr);
@@ -1636,11 +3895,16 @@ void VulkanRenderer::cleanRenderer()
 	//for (auto imageView : mSwapChainImageViews)
 	//	vkDestroyImageView(mLogicalDevice, imageView, nullptr);
 	//vkDestroySwapchainKHR(mLogicalDevice, mSwapChain, nullptr);
+	mAllocator.destroy();
 	vkDestroyDevice(mLogicalDevice, nullptr);
 	if (enableValidationLayers)
 		destroyDebugUtilsMessengerEXT(mVkInstance, mDebugMessenger, nullptr);
-	vkDestroySurfaceKHR(mVkInstance, mSurface, nullptr);
+	if (!mSettings.headless)
+		vkDestroySurfaceKHR(mVkInstance, mSurface, nullptr);
 	vkDestroyInstance(mVkInstance, nullptr);
-	glfwDestroyWindow(mWindow);
-	glfwTerminate();
+	if (!mSettings.headless)
+	{
+		glfwDestroyWindow(mWindow);
+		glfwTerminate();
+	}
 }
\ No newline at end of file
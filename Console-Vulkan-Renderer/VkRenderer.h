@@ -18,6 +18,32 @@
 #include <cstdlib>
 #include <fstream>
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "FrameStats.h"
+#include "GpuProfiler.h"
+#include "Tracer.h"
+#include "MeshOptimizer.h"
+#include "MeshKernels.h"
+#include "Mipmaps.h"
+#include "TextureFile.h"
+#include "TextureCooker.h"
+#include "MemoryAllocator.h"
+#include "StagingRing.h"
+#include "UploadBatch.h"
+#include "TextureCache.h"
+#include "SamplerCache.h"
+#include "VirtualTexture.h"
+#include "ObjLoader.h"
+#include "ParallelFor.h"
+#include "MeshCache.h"
+#include "VertexQuantization.h"
+#include "JobSystem.h"
 const int WINDOW_WIDTH = 800, WINDOW_HEIGHT = 600;
 
 const std::string MODEL = "Models/utah_teapot.obj";
@@ -33,6 +59,44 @@ const std::vector<const char*> DEVICE_EXTENSIONS =
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+// number of offscreen images we cycle through in headless mode (stands in for the swap chain images).
+const uint32_t OFFSCREEN_IMAGE_COUNT = 3;
+
+// which layout the mesh gets uploaded in, picked at startup.
+enum VertexFormat
+{
+	VERTEX_FORMAT_FULL, // Vertex, 44 bytes of floats.
+	VERTEX_FORMAT_COMPACT // CompactVertex, 16 bytes. Needs vert_compact.spv (shader.vert built with COMPACT_VERTEX).
+};
+
+// settings the renderer gets started with. Filled in from the command line in Main.cpp.
+struct RendererSettings
+{
+	bool headless = false; // no window, surface or swap chain. Render into a ring of offscreen images instead.
+	bool readback = false; // headless only: copy every frame back into host memory, and dump the last one on exit.
+	bool benchmark = false; // render exactly frameCount frames on a fixed timestep and report frame time stats.
+	uint32_t frameCount = 1000; // headless / benchmark: how many frames to render before we quit.
+	double fixedTimestep = 1.0 / 60.0; // benchmark: simulated seconds per frame, so every run draws the same frames.
+	std::string benchmarkJsonPath = "benchmark.json"; // benchmark: where the stats get written.
+	std::string tracePath; // if set, record CPU trace zones and write them here as Chrome trace JSON on exit.
+	uint32_t width = WINDOW_WIDTH, height = WINDOW_HEIGHT; // size of the offscreen images.
+	std::string readbackPath = "headless_frame.ppm"; // where the last read back frame gets written.
+	bool tinyObjLoader = false; // load the model through tinyobj instead of the parallel loader, to compare the two.
+	VertexFormat vertexFormat = VERTEX_FORMAT_FULL;
+	bool splitVertexStreams = false; // upload positions and the other attributes as separate vertex buffer bindings.
+	bool generateLods = true; // build a simplified LOD chain at load time and pick one per frame by screen size.
+	int forceLod = -1; // >= 0 always draws that LOD (clamped to the chain).
+	float lodPixelError = 1.0f; // use the coarsest LOD whose error projects to at most this many pixels.
+	bool streamMesh = false; // parse and upload the model a chunk at a time while rendering, instead of before the first frame.
+	bool serialStartup = false; // run the startup steps one after another on the main thread, instead of as a job graph.
+	bool meshCache = true; // load the built mesh from / save it to the binary mesh cache. Ignored by meshStats and tinyObjLoader.
+	bool meshStats = false; // just load the model, print what each mesh optimization pass did to it, and quit.
+	size_t kernelBenchmarkTriangles = 0; // if set, time the SIMD mesh kernels against scalar on a generated mesh this big, and quit.
+	bool cookTextures = false; // block compress everything in TEXTURE_DIRECTORY to cookFormat KTX2s, and quit.
+	BlockFormat cookFormat = BLOCK_FORMAT_BC7;
+	bool virtualTextures = false; // stream textures a page at a time into a fixed size atlas, as the frames ask for them. Needs frag_virtual.spv.
+};
+
 // structure to hold vertex data (2d rn)
 struct Vertex
 {
@@ -80,6 +144,207 @@ struct Vertex
 
 };
 
+// mesh optimization hashes and compares vertices byte by byte, so there can't be any padding in here.
+static_assert(sizeof(Vertex) == sizeof(float) * 11, "Vertex must be tightly packed");
+
+// Quantized vertex. Position is unorm16 inside the mesh AABB, the normal is octahedral encoded snorm16 and the texcoord
+// is unorm16 inside the mesh's UV bounds. No color, it was always white. MeshDequantization turns it back.
+struct CompactVertex
+{
+	uint16_t mPos[4]; // w is padding, 3 x 16 bit formats often aren't supported for vertex input
+	int16_t mNormal[2];
+	uint16_t mTexCoord[2];
+
+	static VkVertexInputBindingDescription getBindingDescription()
+	{
+		VkVertexInputBindingDescription bindingDesc = {};
+		bindingDesc.binding = 0;
+		bindingDesc.stride = sizeof(CompactVertex);
+		bindingDesc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDesc;
+	}
+
+	// same locations as Vertex, minus color (location 1).
+	static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+	{
+		std::array<VkVertexInputAttributeDescription, 3> attributeDescs = {};
+		attributeDescs[0].binding = 0;
+		attributeDescs[0].location = 0;
+		attributeDescs[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+		attributeDescs[0].offset = offsetof(CompactVertex, mPos);
+
+		attributeDescs[1].binding = 0;
+		attributeDescs[1].location = 2;
+		attributeDescs[1].format = VK_FORMAT_R16G16_UNORM;
+		attributeDescs[1].offset = offsetof(CompactVertex, mTexCoord);
+
+		attributeDescs[2].binding = 0;
+		attributeDescs[2].location = 3;
+		attributeDescs[2].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescs[2].offset = offsetof(CompactVertex, mNormal);
+
+		return attributeDescs;
+	}
+};
+
+static_assert(sizeof(CompactVertex) == 16, "CompactVertex must be tightly packed");
+
+// Which vertex streams a pipeline reads. With split streams on, positions and everything else live in separate
+// bindings, so something like a depth only pass can bind just the position stream and fetch a fraction of the bytes.
+enum VertexStreamBits
+{
+	VERTEX_STREAM_POSITION = 1 << 0,
+	VERTEX_STREAM_ATTRIBUTES = 1 << 1, // color, texcoord, normal
+	VERTEX_STREAM_ALL = VERTEX_STREAM_POSITION | VERTEX_STREAM_ATTRIBUTES
+};
+
+// Vertex input state for a pipeline, plus how to pull each attribute out of the interleaved vertex when uploading.
+// Interleaved: one binding with every attribute. Split: binding 0 is positions, binding 1 the rest, each tightly packed.
+struct VertexStreamLayout
+{
+	std::vector<VkVertexInputBindingDescription> bindings;
+	std::vector<VkVertexInputAttributeDescription> attributes; // offsets are within the attribute's own binding
+	std::vector<uint32_t> sourceOffsets; // per attribute: where it sits in the interleaved Vertex / CompactVertex
+	std::vector<uint32_t> sizes; // per attribute, in bytes
+};
+
+// streamMask only matters when split. Bindings keep their numbers whatever the mask, so buffers bind the same way.
+VertexStreamLayout makeVertexStreamLayout(VertexFormat format, bool split, uint32_t streamMask = VERTEX_STREAM_ALL);
+
+// Push constants that decode CompactVertex in shader.vert: position = offset + unorm * scale, same for texcoords.
+// Always pushed, the full format shader just doesn't declare them.
+struct MeshDequantization
+{
+	glm::vec4 mPosOffset; // xyz: AABB min
+	glm::vec4 mPosScale; // xyz: AABB size
+	glm::vec4 mTexCoordOffsetScale; // xy: min uv, zw: uv range
+};
+
+// fragment push constants, straight after MeshDequantization. Pushed per submesh, so the material's color doesn't
+// depend on the vertex format having one.
+struct MaterialParams
+{
+	glm::vec4 mDiffuse; // Kd, white for the default material
+};
+
+// more fragment push constants with --virtual-textures, straight after MaterialParams. Pushed along with each
+// texture's descriptor set.
+struct VirtualTextureParams
+{
+	glm::vec2 mSize; // virtual texels at mip 0, a whole number of pages
+	uint32_t mMipCount; // page table mips
+	uint32_t mTexture; // the streamer's index, which goes into the feedback
+};
+
+const uint32_t MAX_MESH_LODS = 8;
+
+// one level of detail: a range of the shared index buffer.
+struct MeshLod
+{
+	uint32_t mFirstIndex;
+	uint32_t mIndexCount;
+	float mError; // how far (object space) the surface may have moved from LOD 0
+	uint32_t mPad;
+};
+
+// one shape / material pair out of the obj. Its vertices are a range of the shared vertex buffer and its indices
+// are local to that range, so every LOD draws with the same vertex offset.
+struct Submesh
+{
+	int32_t mMaterial; // index into mMaterials, -1 for the default material
+	int32_t mVertexOffset;
+	uint32_t mVertexCount;
+	uint32_t mLodCount;
+	MeshLod mLods[MAX_MESH_LODS]; // LOD 0 is the full submesh, each one after has roughly half the triangles
+};
+
+const size_t MAX_MATERIAL_NAME = 64;
+const size_t MAX_MATERIAL_PATH = 256;
+
+// what we keep of an .mtl material. Fixed size so the mesh cache can store it as is.
+struct MeshMaterial
+{
+	char mName[MAX_MATERIAL_NAME];
+	char mDiffuseTexture[MAX_MATERIAL_PATH]; // map_Kd relative to the working directory, empty for TEXTURE
+	glm::vec4 mDiffuse; // Kd, pushed with each submesh's draw
+};
+
+// Everything about the loaded mesh that isn't vertex / index payload. Plain old data, the mesh cache stores it with
+// mSubmeshCount Submesh and mMaterialCount MeshMaterial right after it.
+struct MeshInfo
+{
+	MeshDequantization mDequantization; // only meaningful for VERTEX_FORMAT_COMPACT
+	glm::vec4 mBoundingSphere; // xyz: center, w: radius, object space
+	uint32_t mSubmeshCount;
+	uint32_t mMaterialCount;
+	uint32_t mPad[2];
+};
+
+// a sampled 2D texture. Opened (hashed, header read) on the job workers, decoded and uploaded by createTextureImage.
+struct Texture
+{
+	std::string path;
+	std::string loadPath; // path, or its cooked copy if there's an up to date one
+	TextureKey key; // what mTextureCache knows it by
+	TextureFile compressed; // a KTX2 / DDS texture's own levels, mapped and uploaded as they are
+	VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+	int width = 0, height = 0; // from the file's header, it isn't decoded until createTextureImage
+	TextureHandle handle = INVALID_TEXTURE_HANDLE; // its image and view in mTextureCache, once it's uploaded
+};
+
+// texture uploads decode straight into the staging ring, as many textures at a time as fit.
+const VkDeviceSize TEXTURE_STAGING_ALIGNMENT = 16; // covers both texel and compressed block sizes
+
+// one texture on its way up: where it sits in staging and what's in there.
+struct TextureUpload
+{
+	Texture* texture = nullptr;
+	std::vector<MipLevel> levels; // in staging, offsets from offset: every level, or just level 0 if the GPU blits the rest
+	uint32_t mipLevels = 1; // the image's
+	bool blitMipmaps = false;
+	VkDeviceSize size = 0;
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	unsigned char* mapped = nullptr; // buffer's memory at offset
+	MemoryAllocation allocation; // only allocated for a texture too big for the staging ring
+	std::string error; // why decoding failed
+};
+
+// progressive mesh streaming (--stream-mesh). Chunks go up through the staging ring a piece at a time, each piece
+// its own submit on one of a ring of upload slots.
+const uint32_t STREAM_UPLOAD_SLOT_COUNT = 4;
+const VkDeviceSize STREAM_UPLOAD_SIZE = 4 * 1024 * 1024; // most bytes per submit
+const size_t STREAM_QUEUE_DEPTH = 8; // parsed chunks the worker can get ahead of the uploads by
+
+// one parsed chunk of the streamed mesh, welded and ready to copy. The indices already point at the right spot in
+// the full vertex buffer.
+struct MeshStreamChunk
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	size_t firstVertex = 0;
+	size_t firstIndex = 0;
+};
+
+// a command buffer that's re-recorded every time it comes round, for runtime uploads. The staging comes from the ring.
+struct UploadSlot
+{
+	VkCommandBuffer commandBuffer;
+	VkFence fence; // created signalled, so a slot that's never been used counts as free
+};
+
+// --virtual-textures page uploads get their own upload slots, one submit a frame at most.
+const uint32_t VIRTUAL_UPLOAD_SLOT_COUNT = 2;
+
+// a virtual texture's page table image, R8G8B8A8_UINT with a mip per page table mip.
+struct VirtualPageTable
+{
+	VkImage image = VK_NULL_HANDLE;
+	MemoryAllocation memory;
+	VkImageView view = VK_NULL_HANDLE;
+};
+
 //const std::vector<Vertex> vertices = {
 //	{{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
 //	{{0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
@@ -134,6 +399,19 @@ struct QueueFamilyIndices
 	}
 };
 
+// one slot of the offscreen ring used in headless mode. The color image itself lives in mSwapChainImages,
+// so the image views, framebuffers and command buffers get built the same way as with a real swap chain.
+struct OffscreenTarget
+{
+	MemoryAllocation colorMemory;
+	VkImage depthImage; // each slot gets its own depth buffer.
+	MemoryAllocation depthMemory;
+	VkImageView depthImageView;
+	VkBuffer readbackBuffer = VK_NULL_HANDLE; // host visible copy of the color image, if readback is on.
+	MemoryAllocation readbackMemory;
+	void* readbackData = nullptr; // readbackMemory.mapped, for the whole run.
+};
+
 // store data for swap chain properties & stuff
 struct SwapChainSupportDetails
 {
@@ -146,12 +424,22 @@ struct SwapChainSupportDetails
 class VulkanRenderer
 {
 public:
+	VulkanRenderer(const RendererSettings& settings = RendererSettings());
 	void run();
 
 private:
 	// functions
 	void initGLFWWindow(); // init the glfw window
 	void initVulkan(); // Init Vulkan
+	void initVulkanSerial(); // every startup step in order on this thread, how it used to be
+	void initVulkanJobs(); // the same steps as a dependency graph, asset loading on the job workers
+	void readShaderFiles(); // read the SPIR-V into mVertShaderCode / mFragShaderCode
+	bool hashTexture(Texture& texture); // find what texture.path loads from and hash it into texture.key. False if there's no file. No vulkan
+	// map a KTX2 / DDS texture.loadPath, or just read the size of anything else. False for a KTX2 / DDS format the
+	// physical device can't sample, so it needs findPhysicalDevice first.
+	bool openTexture(Texture& texture);
+	void openTextureImage(); // open TEXTURE into mTextures[0], no vulkan
+	void openMaterialTextures(); // add every material's map_Kd to mTextures and open them. Needs the model loaded.
 	void createVkInstance(); // Create a vulkan instance
 	void populateDebugMessenger(VkDebugUtilsMessengerCreateInfoEXT &createInfo); // we can populate the messenger, and then that lets us do calls for instance creation and destruction.
 	void createDebugMessenger();
@@ -171,32 +459,48 @@ private:
 	void cleanupSwapChain();
 	void recreateSwapChain();
 	// end ^^^
+	// headless mode. Replaces the surface / swap chain with a ring of offscreen images.
+	void createOffscreenTargets();
+	void cleanupOffscreenTargets();
+	void writeReadbackImage(uint32_t imageIndex); // dump a read back frame to mSettings.readbackPath
 	void createDescriptorSetLayout();
 	void createRenderPass(); // create a render pass for graphics pipeline to use.
 	void createGraphicsPipeline(); // we have to make our own graphics pipeline. 
 	VkShaderModule createShaderModule(const std::vector<char>& code); // helper to create shader modules for vulkan from the shader code.
 	void createFrameBuffers(); // Create framebuffers
 	void createCommandPool(); // Create pool for command buffers
-	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory); // helper function to create buffers
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory); // helper function to create buffers
 	void createVertexBuffer(); // Create vertex buffer
 	void createIndexBuffer(); // create index buffers
 	void createUniformBuffers(); // create uniform buffers
 	void createDescriptorPool(); // create pool for uniforms
 	void createDescriptorSet(); // create descriptor set for uniforms.
-	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size); // copy a buffer into another one.
+	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0); // copy a buffer into another one.
+	// submits what's recorded in mUploads (its ring pieces only come back once it's done), or else waits for the
+	// oldest submit still holding any of the ring. False if nothing's holding any.
+	bool makeStagingRoom();
+	// a piece of the staging ring for a load time upload, waiting on earlier uploads if that's what it takes.
+	StagingRegion waitForStaging(VkDeviceSize size, VkDeviceSize alignment);
+	// count elements of elementSize into dst at dstOffset, through the staging ring a ring's quarter at a time. fill
+	// writes elements [first, first + count) to out. The copies are recorded into mUploads.
+	void uploadToBuffer(VkBuffer dst, VkDeviceSize dstOffset, size_t elementSize, size_t count,
+		const std::function<void(unsigned char* out, size_t first, size_t count)>& fill);
 	void createCommandBuffers(); // Function to create command buffers themselves.
 	void createSyncObjects();
-	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
-
-	void createTextureImage();
-	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
-		VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
-	VkCommandBuffer beginSingleTimeCommands();
-	void endSingleTimeCommands(VkCommandBuffer cmdBuffer);
-	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
-	void createTextureImageView(); // create an image view, ino a texture
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
+
+	void createTextureImage(); // decode and upload every opened texture in mTextures
+	VkMemoryPropertyFlags hostCachedMemoryProperties(); // host visible and coherent, and cached as well if the device has it
+	TextureUpload planTextureUpload(Texture& texture, bool blitMipmaps); // what texture needs in staging
+	void decodeTexture(TextureUpload& upload, unsigned mipThreads); // decode into upload.mapped, any thread. Sets upload.error on failure
+	void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage,
+		VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory);
+	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels); // every mip at once
+	void copyBufferToImage(VkBuffer buffer, VkImage image, const std::vector<MipLevel>& levels); // one region per level, levels[i] into mip i
+	bool canBlitMipmaps(VkFormat format); // whether generateMipmaps can linearly filter this format
+	void generateMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels); // blit each mip from the one above. Leaves the image shader readable.
+	void createTextureImageView(); // create an image view, ino a texture (all of them)
+	void releaseTextures(); // drop mTextures' references, the cache destroys them once no frame in flight can sample them
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
 	void createTextureSampler();
 
 	void createDepthResources(); // create resources for depth buffer
@@ -205,10 +509,33 @@ private:
 	bool hasStencilCompoonent(VkFormat format);
 
 	void loadModel(); // load the model.
+	// weld + reorder the raw triangle corners into mVertices / mIndices, one submesh at a time. corners holds the
+	// submeshes back to back, submeshCorners[i] of them for mSubmeshes[i].
+	void buildIndexedMesh(const std::vector<Vertex>& corners, const std::vector<size_t>& submeshCorners);
+	// simplify each submesh into LODs appended to mIndices (if generate), and fill in the bounds in mMeshInfo.
+	void buildLodChain(bool generate);
+	std::vector<char> packMeshInfo() const; // mMeshInfo, mSubmeshes and mMaterials, for the mesh cache
+	bool unpackMeshInfo(const void* data, size_t size); // the other way round, false if the size doesn't add up
+	uint32_t submeshTexture(const Submesh& submesh) const; // which of mTextures a submesh samples
+	void buildCompactVertices(); // quantize mVertices into mCompactVertices and fill in the dequantization in mMeshInfo.
+	void createIndirectBuffers(); // per swap chain image draw arguments, so the LOD can change without re-recording.
+	void selectLod(uint32_t imageIndex, const UniformBufferObject& ubo); // pick a LOD for this frame's matrices.
+	void beginMeshStream(); // --stream-mesh: size the mesh buffers from a face count and start the parse worker.
+	void streamMeshWorker(); // parse thread: reads, welds and queues chunks until the file's done or we cancel.
+	void pumpMeshStream(); // once a frame: copy whatever's been parsed into free staging slots and grow the draw.
+	void endMeshStream(); // stop the worker, wait for the last copies and free the staging ring.
+	void createVirtualTextures(); // --virtual-textures, instead of createTextureImage: the page atlas, page tables and upload slots, then start streaming.
+	void createFeedbackBuffers(); // one per swap chain image, a request per VT_FEEDBACK_TILE square of the extent.
+	void readVirtualTextureFeedback(uint32_t imageIndex); // once the image's fence has signalled: hand its feedback to the streamer, then clear it.
+	void pumpVirtualTextures(); // once a frame: copy ready pages into the atlas and changed page tables up.
+	void destroyVirtualTextures();
 
 	void runRenderer(); // The main loop - draw basically.
 	void drawFrame(); // function to acquire and draw a frame.
+	void drawOffscreenFrame(); // headless version of drawFrame, no acquire or present.
 	void updateUniformBuffer(uint32_t curImage); // update uniform buffer
+	void reportBenchmark(double wallSeconds); // print + write out the benchmark stats
+	void updateWindowTitle(); // rolling CPU / GPU frame times in the title bar
 	void cleanRenderer(); // Cleanup everything on destroy.
 
 	bool checkValidationLayerSupport(); // check for validation layers.
@@ -216,14 +543,15 @@ private:
 	bool frameBufferResized = false;
 
 	// member vars
-	GLFWwindow* mWindow; // The window that we see.
+	RendererSettings mSettings; // what mode we run in.
+	GLFWwindow* mWindow = nullptr; // The window that we see. Stays null in headless mode.
 
 	VkInstance mVkInstance; // Instance that allows us to interface w/ vulkan.
 	VkDebugUtilsMessengerEXT mDebugMessenger; // allows for debug callback with validation layers. 
-	VkPhysicalDevice mPhysicalDevice; // the graphcis card to interface with.
+	VkPhysicalDevice mPhysicalDevice = VK_NULL_HANDLE; // the graphcis card to interface with.
 	VkDevice mLogicalDevice; // the logical device that lets us interface with the physical device.
 	VkQueue mGraphicsQueue; // the graphics queue for graphics things to submit to the command buffer.
-	VkSurfaceKHR mSurface; // Windows surface to draw to. Linux needs another one. Mac probably needs moltenVk.
+	VkSurfaceKHR mSurface = VK_NULL_HANDLE; // Windows surface to draw to. Linux needs another one. Mac probably needs moltenVk.
 	VkQueue mPresentQueue; // queue for commands for presenting to the surface.
 	VkSwapchainKHR mSwapChain; // the swap chain - list of images that are ready to be rendered.
 	std::vector<VkImage> mSwapChainImages; // list of pointers / handles to get images back from the swap chain.
@@ -235,29 +563,97 @@ private:
 	VkRenderPass mRenderPass; // render pass storage
 	VkPipeline mGraphicsPipeline; // Stores the graphics pipeline & all stages.
 	std::vector<VkFramebuffer> mSwapChainFrameBuffers; // storage of frame buffers
+	MemoryAllocator mAllocator; // all the device memory below comes out of this
 	VkCommandPool mCommandPool; // pool for command buffers
 	std::vector<VkCommandBuffer> mCommandBuffers; // list of command buffers
 	VkBuffer mVertexBuffer; // the vertex buffer
+	std::vector<VkDeviceSize> mVertexStreamOffsets; // where each binding's stream starts in mVertexBuffer
 	VkMemoryRequirements mMemRequirements; // buffers have memory requirements.
-	VkDeviceMemory mVertexBufferDeviceMemory; // put down buffers in the memory of the device.
+	MemoryAllocation mVertexBufferDeviceMemory; // put down buffers in the memory of the device.
 	VkBuffer mIndexBuffer; // buffer for indices of vertices
-	VkDeviceMemory mIndexBufferMemory; // memory for above buffer
-	std::vector<VkBuffer> uniformBuffers; // uniform buffers
-	std::vector<VkDeviceMemory> uniformBuffersMemory; // uniform buffer memory
+	MemoryAllocation mIndexBufferMemory; // memory for above buffer
+	VkBuffer mUniformRing; // a UniformBufferObject per swap chain image, mUniformStride apart, bound with a dynamic offset
+	MemoryAllocation mUniformRingMemory; // persistently mapped
+	VkDeviceSize mUniformStride = 0; // sizeof(UniformBufferObject) rounded up to minUniformBufferOffsetAlignment
+	std::vector<VkBuffer> mIndirectBuffers; // one VkDrawIndexedIndirectCommand per submesh per swap chain image, host visible
+	std::vector<MemoryAllocation> mIndirectBuffersMemory;
+	std::vector<void*> mIndirectBuffersMapped; // persistently mapped
 	VkDescriptorPool mDescriptorPool; // descriptor pool.
-	std::vector<VkDescriptorSet> mDescriptorSets; // descriptor sets.
-	VkImage mTextureImage; // texture image
-	VkDeviceMemory mTextureImageMemory; // memory image memory
-	VkImageView mTextureimageView; // image view into the main texture
-	VkSampler mTextureSampler; // Sampler for the texture for shader
+	std::vector<VkDescriptorSet> mDescriptorSets; // descriptor sets, one per texture. Every swap chain image shares them, the per image buffers go in dynamic offsets.
+	std::vector<char> mVertShaderCode, mFragShaderCode; // kept around so recreating the pipeline doesn't read them again
+	std::vector<Texture> mTextures; // 0 is TEXTURE, for anything without a map_Kd. Then one per distinct map_Kd.
+	std::vector<uint32_t> mMaterialTextures; // which of mTextures each of mMaterials uses
+	VkSampler mTextureSampler; // Sampler for the texture for shader, owned by mSamplerCache
+	SamplerCache mSamplerCache; // every sampler we make
+	TextureCache mTextureCache; // the images and views behind mTextures
+	StagingRing mStaging; // every upload's staging, STAGING_RING_SIZE
+	UploadBatch mUploads; // load time copies, transitions and mip blits get recorded in here, and submitted together
+
+	// --virtual-textures state. mTextures only hold paths and sizes then, their pages live in mPageAtlas.
+	VirtualTextureStreamer mVirtualTextures;
+	VkImage mPageAtlas = VK_NULL_HANDLE; // VT_ATLAS_SLOTS x VT_ATLAS_SLOTS pages with their borders
+	MemoryAllocation mPageAtlasMemory;
+	VkImageView mPageAtlasView = VK_NULL_HANDLE;
+	std::vector<VirtualPageTable> mPageTables; // one per mTextures
+	VkSampler mPageAtlasSampler = VK_NULL_HANDLE; // bilinear and clamped, the borders cover the filter. Owned by mSamplerCache
+	VkSampler mPageTableSampler = VK_NULL_HANDLE; // only texelFetch'd, but a combined image sampler needs one
+	VkCommandPool mVirtualCommandPool = VK_NULL_HANDLE;
+	VkDeviceSize mVirtualUploadSize = 0; // the most a frame's upload takes: VT_MAX_PAGES_PER_FRAME pages plus every page table
+	std::vector<UploadSlot> mVirtualSlots;
+	uint32_t mVirtualNextSlot = 0;
+	std::vector<VirtualPage> mVirtualPages; // this frame's, kept to reuse the vector
+	VkBuffer mFeedbackRing = VK_NULL_HANDLE; // a feedback buffer per swap chain image, mFeedbackStride apart, host visible
+	MemoryAllocation mFeedbackRingMemory;
+	VkDeviceSize mFeedbackStride = 0, mFeedbackSize = 0; // size is what one image's takes, before aligning
+	std::vector<uint32_t*> mFeedbackBuffersMapped; // each image's piece of the ring
+	uint32_t mFeedbackTilesX = 0, mFeedbackTilesY = 0;
 
 	VkImage mDepthImage;
-	VkDeviceMemory mDepthImageMemory;
+	MemoryAllocation mDepthImageMemory;
 	VkImageView mDepthImageView;
 
+	std::vector<OffscreenTarget> mOffscreenTargets; // headless mode only, one per entry in mSwapChainImages.
+	uint32_t mFrameNumber = 0; // how many frames we've submitted so far.
+
+	FrameStats mFrameStats; // CPU time per frame phase, only recorded in benchmark mode.
+	GpuProfiler mGpuProfiler; // timestamp queries around the passes in each command buffer.
+	StatClock::time_point mLastTitleUpdate; // we put the rolling frame times in the window title once a second.
+
 	// model loading
 	std::vector<Vertex> mVertices;
 	std::vector<uint32_t> mIndices;
+	std::vector<CompactVertex> mCompactVertices; // only filled in for VERTEX_FORMAT_COMPACT.
+	MeshInfo mMeshInfo = {}; // bounds and dequantization (pushed with every draw).
+	std::vector<Submesh> mSubmeshes; // sorted by texture, which is the order they get drawn in
+	std::vector<MeshMaterial> mMaterials;
+	uint32_t mCurrentLod = 0; // the coarsest LOD selectLod picked last.
+	MeshCache mMeshCache; // only mapped between a cache hit in loadModel and the index buffer upload.
+
+	// what createVertexBuffer / createIndexBuffer upload from: mVertices / mIndices, or straight out of the mapped cache.
+	const void* mVertexData = nullptr;
+	size_t mVertexCount = 0;
+	size_t mVertexStride = sizeof(Vertex); // depends on mSettings.vertexFormat
+	const uint32_t* mIndexData = nullptr;
+	size_t mIndexCount = 0;
+
+	// --stream-mesh state. The worker only touches mStreamReader and the queue, everything else is the main thread's.
+	bool mStreaming = false;
+	ObjStreamReader mStreamReader;
+	std::thread mStreamThread;
+	std::mutex mStreamMutex;
+	std::condition_variable mStreamQueueSpace; // the worker waits on this when the queue is full
+	std::deque<MeshStreamChunk> mStreamQueue;
+	bool mStreamWorkerDone = false; // guarded by mStreamMutex
+	std::exception_ptr mStreamError; // guarded by mStreamMutex, rethrown on the main thread
+	std::atomic<bool> mStreamCancel{ false };
+	MeshStreamChunk mStreamChunk; // the chunk being uploaded right now
+	size_t mStreamVertexBytesDone = 0, mStreamIndexBytesDone = 0; // how much of mStreamChunk has gone out
+	bool mStreamChunkPending = false;
+	VkCommandPool mStreamCommandPool;
+	std::vector<UploadSlot> mStreamSlots;
+	uint32_t mStreamNextSlot = 0;
+	StatClock::time_point mStreamStart;
+	double mStreamFirstGeometryMs = -1.0;
 
 	// sync objects here
 	std::vector<VkSemaphore> mImageAvailableSemaphores; // Semaphores keep our async execution in line
@@ -284,6 +680,7 @@ private:
 	// Helper function to read in files (mostly shaders though). 
 	static std::vector<char> readFile(const std::string& fileName)
 	{
+		TRACE_FUNCTION();
 		std::ifstream file(fileName, std::ios::ate | std::ios::binary);
 
 		if (!file.is_open())